@@ -0,0 +1,85 @@
+#pragma once
+#include <array>
+#include <cstdint>
+
+//6502 arithmetic shared by the CPU instruction handlers. N and Z come from a 256 entry table and C / V
+//from the carry out of the wider sum, so no operation branches on its operands. Every function takes the
+//status register and returns the result, tools/alu_bench checks them against the plain implementation
+namespace ALU
+{
+    const uint8_t C = 0x01;
+    const uint8_t Z = 0x02;
+    const uint8_t V = 0x40;
+    const uint8_t N = 0x80;
+
+    constexpr std::array<uint8_t, 256> make_nz_table()
+    {
+        std::array<uint8_t, 256> table{};
+        for(int value = 0; value < 256; value++)
+            table[value] = (value & N) | (value == 0 ? Z : 0);
+        return table;
+    }
+
+    inline constexpr std::array<uint8_t, 256> NZ = make_nz_table();
+
+    inline void set_nz(uint8_t& P, uint8_t value)
+    {
+        P = (P & ~(N | Z)) | NZ[value];
+    }
+
+    inline uint8_t adc(uint8_t& P, uint8_t a, uint8_t operand)
+    {
+        unsigned sum = a + operand + (P & C);
+        uint8_t result = sum;
+        //Overflow when both inputs have the same sign and the result doesn't
+        uint8_t overflow = ((a ^ result) & (operand ^ result) & 0x80) >> 1;
+        P = (P & ~(N | V | Z | C)) | NZ[result] | overflow | (sum >> 8);
+        return result;
+    }
+
+    //The 2A03 has no decimal mode, SBC is ADC of the complement
+    inline uint8_t sbc(uint8_t& P, uint8_t a, uint8_t operand)
+    {
+        return adc(P, a, ~operand);
+    }
+
+    inline void cmp(uint8_t& P, uint8_t reg, uint8_t operand)
+    {
+        //reg + ~operand + 1 carries out exactly when reg >= operand
+        unsigned difference = reg + uint8_t(~operand) + 1;
+        P = (P & ~(N | Z | C)) | NZ[difference & 0xFF] | (difference >> 8);
+    }
+
+    inline void bit(uint8_t& P, uint8_t a, uint8_t operand)
+    {
+        P = (P & ~(N | V | Z)) | (operand & (N | V)) | (NZ[a & operand] & Z);
+    }
+
+    inline uint8_t asl(uint8_t& P, uint8_t value)
+    {
+        uint8_t result = value << 1;
+        P = (P & ~(N | Z | C)) | NZ[result] | (value >> 7);
+        return result;
+    }
+
+    inline uint8_t lsr(uint8_t& P, uint8_t value)
+    {
+        uint8_t result = value >> 1;
+        P = (P & ~(N | Z | C)) | NZ[result] | (value & C);
+        return result;
+    }
+
+    inline uint8_t rol(uint8_t& P, uint8_t value)
+    {
+        uint8_t result = (value << 1) | (P & C);
+        P = (P & ~(N | Z | C)) | NZ[result] | (value >> 7);
+        return result;
+    }
+
+    inline uint8_t ror(uint8_t& P, uint8_t value)
+    {
+        uint8_t result = (value >> 1) | ((P & C) << 7);
+        P = (P & ~(N | Z | C)) | NZ[result] | (value & C);
+        return result;
+    }
+}
@@ -67,7 +67,7 @@ struct DMC
     bool IRQ = false;
     bool loop = false;
     uint8_t rate_index = 0;
-    uint16_t rate = 0;
+    uint16_t rate = 428; //Timer period in CPU cycles, NTSC rate 0 until $4010 is written
     uint8_t output_level = 0;
     uint8_t direct_load = 0;
     uint16_t sample_address = 0;
@@ -76,21 +76,45 @@ struct DMC
     uint16_t timer_divider = 0;
     bool interrupt_flag = false;
 
-    //Memory reader
+    //Memory reader, the byte itself is fetched by the CPU (see CPU::request_dmc_dma)
     uint8_t sample_buffer = 0;
+    bool sample_buffer_empty = true;
+    bool dma_pending = false;
     uint16_t bytes_remaining = 0;
     uint16_t current_address = 0;
 
     //Output unit
     uint8_t shift_register = 0;
-    uint8_t bits_remaining = 0;
-    bool silence = false;
-
+    uint8_t bits_remaining = 8;
+    bool silence = true;
+};
 
+//Channel, frame counter and filter state, kept apart from the lookup tables and the wiring so a
+//machine state is copied with one assignment (see NES::clone_into)
+struct APUState
+{
+    uint32_t apu_half_cycles = 0; //Frame counter position in half APU cycles (CPU cycles)
+    Pulse pulse1, pulse2;
+    Triangle triangle;
+    Noise noise;
+    DMC dmc;
+    uint8_t status_register = 0;
+    bool sequence_mode = 0;
+    bool inhibit_flag = 1;
+    uint8_t sequence_step = 0;
+    bool region = 0; //0 NTSC |  1 PAL
+    bool frame_interrupt = false;
+    uint8_t delay_write_to_frame_counter = 0.0;
+    bool reset = false;
+
+    //Output filters state, kept per instance so several APUs can run in parallel
+    double prev_output_hp_90 = 0;
+    double prev_output_hp_440 = 0;
+    double prev_output_lp_14000 = 0;
 };
 
 class Bus;
-class APU
+class APU : private APUState
 {
     public:
         APU();
@@ -98,10 +122,26 @@ class APU
         void cpu_writes(uint16_t address, uint8_t value);
         uint8_t cpu_reads(uint16_t address);
         void connect_bus(std::shared_ptr<Bus> bus);
+        //Region is a template parameter so each timing compiles to constant comparisons
+        template <bool PAL>
         void tick();
+        void tick()
+        {
+            if(region)
+                tick<true>();
+            else
+                tick<false>();
+        }
         void set_timing(bool value);
         void soft_reset();
+        //Called by the CPU when the sample byte requested by the memory reader has been fetched
+        void dmc_dma_complete(uint8_t value);
         double get_output();
+        //Takes over another APU's state, the bus stays this APU's own
+        void copy_state(const APU& other)
+        {
+            static_cast<APUState&>(*this) = other;
+        }
 
     private:
         void tick_envelope();
@@ -122,18 +162,5 @@ class APU
         std::vector<uint16_t> ntsc_dpcm_period;
         std::vector<uint16_t> pal_dpcm_period;
 
-        float apu_cycles_counter = 0.0;
         std::shared_ptr<Bus> bus;
-        Pulse pulse1, pulse2;
-        Triangle triangle;
-        Noise noise;
-        DMC dmc;
-        uint8_t status_register = 0;
-        bool sequence_mode = 0;
-        bool inhibit_flag = 1;
-        uint8_t sequence_step = 0;
-        bool region = 0; //0 NTSC |  1 PAL
-        bool frame_interrupt = false;
-        uint8_t delay_write_to_frame_counter = 0.0;
-        bool reset = false;
 };
\ No newline at end of file
@@ -5,12 +5,13 @@ class Cartridge;
 class AxROM : public Mapper
 {
     public:
-        AxROM(int n_prg_rom_banks, int n_chr_rom_banks, std::shared_ptr<Cartridge> cart) : Mapper(n_prg_rom_banks, n_chr_rom_banks, cart) {};
+        AxROM(uint32_t prg_rom_size, uint32_t chr_size, std::shared_ptr<Cartridge> cart) : Mapper(prg_rom_size, chr_size, cart) {};
         ~AxROM() override { };
-        uint32_t cpu_reads(uint16_t address);
-        uint32_t ppu_reads(uint16_t address);
         void cpu_writes(uint16_t address, uint8_t value);
+        void copy_state(const Mapper& other) override
+        {
+            *this = static_cast<const AxROM&>(other);
+        }
     private:
-        uint8_t bank_number = 0;
         MIRROR mirroring_mode = MIRROR::HORIZONTAL;
-};
\ No newline at end of file
+};
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+enum BlockMode : uint8_t
+{
+    BLOCKS_OFF,
+    BLOCKS_ON,      //PRG-ROM instructions run in one go from their decoded form, see CPU::run_decoded
+    BLOCKS_VALIDATE //Decoded instructions are run, rolled back and run again by the interpreter, outcomes compared
+};
+
+//One instruction decoded from PRG ROM
+struct DecodedOp
+{
+    uint8_t opcode;
+    uint8_t mode;   //BlockCache::Mode
+    uint8_t access; //BlockCache::Access, what the instruction does at its effective address
+    uint8_t length;
+    uint16_t operand;
+};
+
+//Decoded PRG-ROM code indexed by ROM offset. The first time execution reaches an offset the basic block starting
+//there is decoded up to the next jump, branch or 8KB window end. ROM never changes, so a decoded instruction stays
+//valid through any bank switch: the CPU finds it through the mapper's page table and nothing is ever invalidated.
+//Code in RAM is never decoded. The cache belongs to one CPU, clones decode their own copy
+class BlockCache
+{
+    public:
+        enum Mode : uint8_t { UNDECODED, INTERPRET, IMP, IMM, ZP, ZPX, ZPY, ABS, ABX, ABY, IND, IZX, IZY, REL };
+        enum Access : uint8_t { NONE, READ, WRITE, MODIFY };
+        static const int MAX_BLOCK_LENGTH = 64;
+
+        //Points the cache at a PRG ROM, what was decoded is kept when it is the same one
+        void attach(const uint8_t* rom, uint32_t size);
+        //Forgets the ROM and everything decoded from it, the next attach starts over
+        void clear();
+        bool is_attached()
+        {
+            return attached;
+        }
+        //Asks for an attach before the next lookup without dropping anything, after the CPU state was replaced
+        void detach()
+        {
+            attached = false;
+        }
+
+        const DecodedOp& lookup(uint32_t offset)
+        {
+            if(offset >= ops.size())
+                return outside_rom;
+            if(ops[offset].mode == UNDECODED)
+                decode_block(offset);
+            return ops[offset];
+        }
+
+        uint64_t get_blocks_decoded()
+        {
+            return blocks_decoded;
+        }
+
+    private:
+        const uint8_t* rom = nullptr;
+        bool attached = false;
+        std::vector<DecodedOp> ops;
+        uint64_t blocks_decoded = 0;
+        static const DecodedOp outside_rom;
+
+        void decode_block(uint32_t offset);
+};
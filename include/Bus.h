@@ -21,11 +21,28 @@ enum IRQ
 };
 
 
+//Controller, zapper and interrupt line state, apart from the wiring so it is copied with one assignment
+struct BusState
+{
+    bool NMI = false;
+    uint16_t controller_state;
+    uint16_t shift_register_controller1;
+    uint16_t shift_register_controller2;
+    bool zapper_connected = false;
+    bool handle_input;
+    bool strobe;
+    //xxxx xDFM
+    //M = MMC3, F = Frame interrupt, D = DMC IRQ
+    uint8_t IRQ_line = 0;
+    Zapper zapper;
+};
+
 class PPU;
 class CPU;
 class APU;
 class Cartridge;
-class Bus : public std::enable_shared_from_this<Bus> 
+class PPULog;
+class Bus : public std::enable_shared_from_this<Bus>, private BusState
 {
     public:
         Bus(std::shared_ptr<PPU> ppu,  std::shared_ptr<Cartridge> cart, std::shared_ptr<APU> apu, std::shared_ptr<CPU> cpu);
@@ -38,6 +55,8 @@ class Bus : public std::enable_shared_from_this<Bus>
         void ppu_writes(uint16_t address, uint8_t value);
 
         void set_nmi(bool value);
+        int get_ppu_scanline();
+        int get_ppu_dot();
         bool is_new_instruction();
 
         void set_input(uint16_t state);
@@ -50,33 +69,38 @@ class Bus : public std::enable_shared_from_this<Bus>
         void assert_irq(IRQ);
         void ack_irq(IRQ);
         uint8_t get_irq();
+        void request_dmc_dma(uint16_t address);
+        void dmc_dma(uint16_t address);
+        const uint8_t* prg_rom_page(uint16_t address);
+        uint32_t prg_rom_offset(uint16_t address);
+        const uint8_t* get_prg_rom();
+        uint32_t get_prg_rom_size();
+        bool write_oam_page(const uint8_t* page, int dots);
 
         std::shared_ptr<Bus> get_shared() 
         {
             return shared_from_this();
         }
 
-        void set_irq_latch(uint8_t value);
-        void set_irq_enable(bool);
-        void set_irq_reload();
+        void A12_rising();
         void set_mapper(uint8_t value);
         void set_mirroring_mode(MIRROR);
+        void map_nametable(int page, uint8_t* memory);
+        //Logs what a PPU copy needs to follow this machine's, nullptr stops it
+        void set_ppu_log(PPULog* log)
+        {
+            ppu_log = log;
+        }
+        //Takes over another bus' state, the connected components stay this bus' own
+        void copy_state(const Bus& other)
+        {
+            static_cast<BusState&>(*this) = other;
+        }
         
     private:
         std::shared_ptr<PPU> ppu;
         std::shared_ptr<APU> apu;
         std::shared_ptr<Cartridge> cart;
         std::shared_ptr<CPU> cpu;
-
-        bool NMI = false;
-        uint16_t controller_state;
-        uint16_t shift_register_controller1;
-        uint16_t shift_register_controller2;
-        bool zapper_connected = false;
-        bool handle_input;
-        bool strobe;
-        //xxxx xDFM
-        //M = MMC3, F = Frame interrupt, D = DMC IRQ
-        uint8_t IRQ_line = 0;
-        Zapper zapper;
+        PPULog* ppu_log = nullptr;
 };
\ No newline at end of file
@@ -5,11 +5,11 @@ class Mapper;
 class CNROM : public Mapper
 {
     public:
-        CNROM(int n_prg_rom_banks, int n_chr_rom_banks, std::shared_ptr<Cartridge> cart) : Mapper(n_prg_rom_banks, n_chr_rom_banks, cart) {}
+        CNROM(uint32_t prg_rom_size, uint32_t chr_size, std::shared_ptr<Cartridge> cart) : Mapper(prg_rom_size, chr_size, cart) {}
         ~CNROM() override { };
-        uint32_t cpu_reads(uint16_t address);
-        uint32_t ppu_reads(uint16_t address);
         void cpu_writes(uint16_t address, uint8_t value);
-    private:
-        uint8_t bank_number = 0;
-};
\ No newline at end of file
+        void copy_state(const Mapper& other) override
+        {
+            *this = static_cast<const CNROM&>(other);
+        }
+};
@@ -3,10 +3,122 @@
 #include <vector>
 #include <fstream>
 #include <memory>
-#include "Logger.h"
+#include "TraceRecorder.h"
+#include "BlockCache.h"
+#include "CPUProbe.h"
 
 class Bus;
-class CPU
+//Everything the CPU needs to resume execution. Kept apart from the wiring (bus, trace recorder) so a
+//whole machine state is copied with one assignment, see NES::clone_into
+struct CPUState
+{
+    uint64_t cycles; //Cycles since power on, stamped on trace records
+    uint8_t opcode;
+    //Registers
+    uint8_t Accumulator;
+    uint8_t X;
+    uint8_t Y;
+    uint16_t PC; //Program counter
+    uint8_t SP; //Stack pointer
+    uint8_t P; //Status register
+    uint8_t OAMDMA;
+
+    bool oamdma_flag;
+    bool oamdma_copied; //The fast path already filled OAM, the transfer cycles only pass time
+    static const int OAM_DMA_MAX_DOTS = 1700; //514 cycles and two DMC fetches at PAL's 3.2 dots per cycle
+    bool halt_cycle = false;
+    bool get_cycle;
+    bool alignment_needed;
+    uint8_t dma_read;
+    uint16_t dma_address;
+    //DMC sample fetch: halt, dummy and (if needed) alignment cycles, then the read on a get cycle.
+    //During OAM DMA the CPU is already halted, so only the get cycle is stolen
+    enum DmcDmaStage : uint8_t { DMC_DMA_IDLE, DMC_DMA_HALT, DMC_DMA_DUMMY, DMC_DMA_GET };
+    DmcDmaStage dmc_dma_stage = DMC_DMA_IDLE;
+    uint16_t dmc_dma_address = 0;
+    bool reset_flag;
+    bool NMI = false;
+    uint16_t jmp_address;
+    uint16_t subroutine_address;
+    uint16_t zero_page_addr;
+    uint16_t absolute_addr;
+    uint16_t effective_addr;
+    bool page_crossing;
+    uint8_t n_cycles;
+    int8_t offset;     
+    uint8_t data;
+    uint8_t high_byte;
+    uint8_t low_byte;
+    uint16_t h;
+    uint16_t l;
+    bool new_instruction;
+    bool pending_NMI;
+    bool IRQ;
+    
+    uint8_t memory[0x800] = {0}; //2kb ram internal to cpu
+    bool branch_polled = false;
+
+    //An instruction run_decoded executed in one go: its cycles still pass one tick at a time and the interrupt
+    //polls (bit n = after cycle n) happen on the ticks the handler would have polled on
+    uint8_t decoded_cycles = 0;
+    uint8_t decoded_polls = 0;
+    uint64_t decoded_instructions = 0;
+
+    //Idle loop skipping: a short backward jump arms the detector, one iteration of the loop is
+    //recorded cycle by cycle and, if it ends in the same state it started, later iterations are
+    //replayed from the recording. Only reads of $2002 and interrupt polls touch the outside world,
+    //so those cycles are still run (or polled) for real and any divergence drops back to normal execution.
+    //A loop that reads only RAM and ROM is not replayed at all while nothing is pending, the NES runs the
+    //PPU and APU on their own and skip_idle_cycles moves the loop ahead afterwards
+    struct IdleState
+    {
+        uint16_t PC;
+        uint16_t jmp_address;
+        uint16_t subroutine_address;
+        uint16_t zero_page_addr;
+        uint16_t absolute_addr;
+        uint16_t effective_addr;
+        uint16_t h;
+        uint16_t l;
+        uint8_t Accumulator;
+        uint8_t X;
+        uint8_t Y;
+        uint8_t SP;
+        uint8_t P;
+        uint8_t opcode;
+        uint8_t n_cycles;
+        uint8_t data;
+        uint8_t high_byte;
+        uint8_t low_byte;
+        int8_t offset;
+        bool page_crossing;
+        bool branch_polled;
+        bool new_instruction;
+    };
+
+    enum IdleMode : uint8_t { IDLE_OFF, IDLE_SEARCH, IDLE_RECORD, IDLE_SKIP };
+    static const int IDLE_MAX_LOOP_BYTES = 32;
+    static const int IDLE_MAX_LOOP_CYCLES = 64;
+    static const int IDLE_MAX_RECORD_TRIES = 4;
+    static const uint8_t IDLE_CYCLE_POLL = 0x01;
+    static const uint8_t IDLE_CYCLE_VOLATILE = 0x02;
+
+    IdleMode idle_mode = IDLE_OFF;
+    uint16_t instruction_address = 0;
+    uint16_t idle_loop_address = 0;
+    int idle_length = 0;
+    int idle_index = 0;
+    int idle_record_tries = 0;
+    IdleState idle_states[IDLE_MAX_LOOP_CYCLES + 1];
+    uint8_t idle_cycle_flags[IDLE_MAX_LOOP_CYCLES];
+    bool idle_reads_io = false; //Some cycle of the loop reads $2002
+    bool idle_irq_masked = false; //The I flag is set on every cycle of the loop
+    uint64_t idle_loops_detected = 0;
+    uint64_t idle_cycles_replayed = 0;
+    uint64_t idle_cycles_skipped = 0;
+};
+
+class CPU : private CPUState
 {
     public:
 
@@ -17,50 +129,45 @@ class CPU
 
         void reset();
         void soft_reset();
+        void trigger_reset();
+        uint8_t peek(uint16_t address);
         bool is_new_instruction();
         void trigger_irq();
         void set_nmi(bool value);
+        void request_dmc_dma(uint16_t address);
+        bool start_trace(const std::string& filename);
+        void stop_trace();
+        bool is_tracing();
+        void set_idle_skip(bool enabled);
+        bool get_idle_skip();
+        uint64_t get_idle_loops_detected();
+        uint64_t get_idle_cycles_replayed();
+        uint64_t get_idle_cycles_skipped();
+        //True when the next cycle would only replay a loop that reads RAM and ROM with no interrupt or DMC fetch
+        //waiting, the CPU need not tick until skip_idle_cycles is told how many cycles passed meanwhile
+        bool can_skip_idle_cycles();
+        void skip_idle_cycles(uint32_t count);
+        void set_block_mode(BlockMode mode);
+        BlockMode get_block_mode();
+        uint64_t get_decoded_instructions();
+        uint64_t get_block_mismatches();
+        std::string get_block_mismatch_report();
+        //Reports instructions and bus accesses to probe, nullptr detaches it. The probe is not owned
+        void set_probe(CPUProbe* probe);
+        //Takes over another CPU's state, the bus, trace recorder and decoded code stay this CPU's own
+        void copy_state(const CPU& other)
+        {
+            static_cast<CPUState&>(*this) = other;
+            block_cache.detach();
+            block_check.active = false;
+        }
 
     private:
-        int cycles;
-        uint8_t opcode;
         std::shared_ptr<Bus> bus;
-        bool start_logging = false;
-        //Registers
-        uint8_t Accumulator;
-        uint8_t X;
-        uint8_t Y;
-        uint16_t PC; //Program counter
-        uint8_t SP; //Stack pointer
-        uint8_t P; //Status register
-        uint8_t OAMDMA;
-
-        bool oamdma_flag;
-        bool halt_cycle = false;
-        bool get_cycle;
-        bool alignment_needed;
-        uint8_t dma_read;
-        uint16_t dma_address;
-        bool reset_flag;
-        bool NMI = false;
-        uint16_t jmp_address;
-        uint16_t subroutine_address;
-        uint16_t zero_page_addr;
-        uint16_t absolute_addr;
-        uint16_t effective_addr;
-        bool page_crossing;
-        uint8_t n_cycles;
-        int8_t offset;     
-        uint8_t data;
-        uint8_t high_byte;
-        uint8_t low_byte;
-        uint16_t h;
-        uint16_t l;
-        bool new_instruction;
-        bool pending_NMI;
-        bool IRQ;
-        
-        uint8_t memory[0x800] = {0}; //2kb ram internal to cpu
+        std::unique_ptr<TraceRecorder> trace;
+        void record_trace();
+        CPUProbe* probe = nullptr;
+        void report_begin(CPUProbe::Entry entry);
 
         struct Instruction
         {
@@ -72,7 +179,6 @@ class CPU
         std::vector<CPU::Instruction> Instr;
 
         void poll_interrupts();
-        bool branch_polled = false;
 
         //Flag instructions
 
@@ -303,11 +409,45 @@ class CPU
         void ie_indy();
 
         void ADC_calc();
+        void SBC_calc();
         void CMP_calc(uint8_t reg);
 
         void write(uint16_t address, uint8_t value);
         uint8_t read(uint16_t address);
 
         void transfer_oam_bytes();
+        bool dmc_dma_cycle();
 
+
+        void save_idle_state(IdleState& state);
+        void load_idle_state(const IdleState& state);
+        bool same_idle_state(const IdleState& state);
+        void start_idle_record();
+        bool begin_idle_cycle();
+        void end_idle_cycle();
+        void leave_idle_loop();
+
+        BlockMode block_mode = BLOCKS_OFF;
+        BlockCache block_cache;
+        bool run_decoded();
+
+        //BLOCKS_VALIDATE: what run_decoded did to an instruction, compared with the interpreter once it ran it
+        struct BlockCheck
+        {
+            bool active = false;
+            uint16_t address;
+            uint8_t opcode;
+            uint8_t Accumulator, X, Y, SP, P;
+            uint16_t PC;
+            uint8_t cycles;
+            uint8_t polls;
+            uint8_t memory[0x800];
+            uint8_t interpreter_cycles;
+            uint8_t interpreter_polls;
+        };
+        BlockCheck block_check;
+        uint64_t block_mismatches = 0;
+        std::string block_mismatch_report;
+        void start_block_check();
+        void finish_block_check();
 };
\ No newline at end of file
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+
+//Registers at an instruction boundary, as a probe sees them
+struct CPURegisters
+{
+    uint64_t cycle; //CPU cycles since power on
+    uint16_t PC;
+    uint8_t A;
+    uint8_t X;
+    uint8_t Y;
+    uint8_t SP;
+    uint8_t P;
+};
+
+//Watches the CPU core from the outside, for checking tools like tools/cpu_diff. The CPU reports the start of
+//every instruction or interrupt sequence and every bus access in between. It runs instructions only through
+//the interpreter while a probe is attached: decoded execution and idle loop skipping don't touch the bus
+//the same way, so they step aside
+class CPUProbe
+{
+    public:
+        enum Entry : uint8_t { INSTRUCTION, NMI, IRQ, RESET };
+        enum Access : uint8_t { READ, WRITE, DMA_READ, DMA_WRITE };
+
+        virtual ~CPUProbe() {}
+        //Called on the first cycle, the previous instruction is complete by then
+        virtual void begin(Entry entry, const CPURegisters& registers) = 0;
+        virtual void access(Access kind, uint16_t address, uint8_t value) = 0;
+        //A cycle the CPU was halted for DMA, it counts towards no instruction
+        virtual void stall() = 0;
+};
@@ -4,6 +4,9 @@
 #include <vector>
 #include <memory>
 #include "Mapper.h"
+#include "RomImage.h"
+#include "PagedRam.h"
+#include "SaveFile.h"
 
 class Bus;
 class Cartridge : public std::enable_shared_from_this<Cartridge>
@@ -13,6 +16,29 @@ class Cartridge : public std::enable_shared_from_this<Cartridge>
         ~Cartridge();
         uint8_t ppu_reads(uint16_t address);
         uint8_t cpu_reads(uint16_t address);
+        //$8000-$FFFF only, for the DMC sample fetch
+        uint8_t read_prg_rom(uint16_t address)
+        {
+            return PRG_ROM[mapper->prg_rom_address(address)];
+        }
+        //The 256 bytes at a page aligned $8000-$FFFF address, a page never straddles two 8KB windows
+        const uint8_t* prg_rom_page(uint16_t address)
+        {
+            return &PRG_ROM[mapper->prg_rom_address(address)];
+        }
+        //Where a $8000-$FFFF address currently lands in PRG ROM, decoded code is kept by this offset
+        uint32_t prg_rom_offset(uint16_t address)
+        {
+            return mapper->prg_rom_address(address);
+        }
+        const uint8_t* get_prg_rom()
+        {
+            return PRG_ROM;
+        }
+        uint32_t get_prg_rom_size()
+        {
+            return PRG_ROM ? prg_rom_size : 0;
+        }
         void ppu_writes(uint16_t address, uint8_t value);
         void cpu_writes(uint16_t address, uint8_t value);
         bool is_new_instruction();
@@ -25,17 +51,44 @@ class Cartridge : public std::enable_shared_from_this<Cartridge>
             return shared_from_this();
         }
 
-        void set_irq_latch(uint8_t value);
-        void set_irq_enable(bool);
-        void set_irq_reload();
+        void set_irq(bool asserted);
+        void A12_rising();
         void set_mirroring_mode(MIRROR);
+        void map_nametable(int page, uint8_t* memory);
+        //Takes over another cartridge's RAM and mapper state, sharing its ROM image and PRG-RAM pages
+        void copy_state(const Cartridge& other);
+        void get_chr_layout(uint32_t pages[8]) const
+        {
+            mapper->get_chr_layout(pages);
+        }
+        void set_chr_layout(const uint32_t pages[8])
+        {
+            mapper->set_chr_layout(pages);
+        }
+        uint8_t get_timing()
+        {
+            return timing;
+        }
+        //CRC-32 of PRG and CHR ROM, the ROM database key
+        uint32_t get_crc()
+        {
+            return rom_crc;
+        }
+        //Writes out the dirty pages of the .sav file and closes it
+        void close_battery();
        
     private:
-        std::vector<uint8_t> CHR_ROM; 
-        std::vector<uint8_t> PRG_ROM;
+        //PRG and CHR ROM point into the shared read-only image, only RAM and mapper state belong to this cartridge
+        std::shared_ptr<RomImage> rom;
+        const uint8_t* PRG_ROM = nullptr;
+        const uint8_t* CHR_ROM = nullptr;
+        uint8_t* CHR = nullptr; //CHR seen by the PPU, CHR_ROM or CHR_RAM
         std::vector<uint8_t> CHR_RAM;
-        std::vector<uint8_t> PRG_RAM;
+        PagedRam PRG_RAM; //Copy on write between cloned cartridges
+        std::unique_ptr<SaveFile> battery; //.sav backing of PRG_RAM for battery games, never shared with clones
+        void open_battery(const std::string& filename);
         std::unique_ptr<Mapper> mapper;
+        bool create_mapper();
         std::shared_ptr<Bus> bus;
 
         struct Header
@@ -49,13 +102,18 @@ class Cartridge : public std::enable_shared_from_this<Cartridge>
             uint8_t prg_chr_rom_size = 0x00;
             uint8_t prg_ram_shift = 0x00;
             uint8_t chr_ram_shift = 0x00;
-            uint8_t ppu_type = 0;
+            uint8_t timing = 0;
             uint8_t misc[3] = {0}; //Unused for now
         } header;
 
         bool alternative_layout = 0;
-        uint16_t n_prg_rom_banks = 0;
-        uint16_t n_chr_rom_banks = 0;
-        uint16_t mapper_id;
+        size_t prg_rom_size = 0;
+        size_t chr_rom_size = 0;
+        uint16_t mapper_id = 0;
+        uint8_t submapper = 0;
+        uint8_t timing = 0; //NES 2.0 CPU/PPU timing: 0 NTSC, 1 PAL, 2 multi-region, 3 Dendy
+        uint32_t rom_crc = 0;
+        uint32_t prg_ram_mask = 0;
+        uint32_t chr_mask = 0;
         MIRROR mirror_mode;
 };
\ No newline at end of file
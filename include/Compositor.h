@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+
+//Scanline compositor. The PPU fills one 256 pixel line of background and sprite data and the
+//compositor resolves priority and looks the colors up for the whole line at once.
+//
+//bg_color      system palette index (0-63) of the background pixel, already resolved through the frame palette
+//bg_pixel      background pattern value (0-3), 0 means transparent
+//sprite_color  system palette index of the sprite pixel, only meaningful when the pixel is opaque
+//sprite_flags  SPRITE_OPAQUE, SPRITE_BEHIND and SPRITE_ZERO bits
+//
+//Returns the first x where an opaque sprite 0 pixel overlaps an opaque background pixel, -1 for none.
+//Sprite 0 hit timing seen by the CPU is still decided by the PPU dot by dot.
+
+namespace Compositor
+{
+    const int LINE_WIDTH = 256;
+
+    const uint8_t SPRITE_OPAQUE = 0x80;
+    const uint8_t SPRITE_BEHIND = 0x20;
+    const uint8_t SPRITE_ZERO = 0x01;
+
+    int compose_line(const uint8_t* bg_color, const uint8_t* bg_pixel, const uint8_t* sprite_color,
+                     const uint8_t* sprite_flags, const uint32_t* palette, uint32_t* out);
+
+    //The implementations behind compose_line, exposed for tools/compositor_bench
+    int compose_line_scalar(const uint8_t* bg_color, const uint8_t* bg_pixel, const uint8_t* sprite_color,
+                            const uint8_t* sprite_flags, const uint32_t* palette, uint32_t* out);
+#ifdef __SSE2__
+    int compose_line_sse2(const uint8_t* bg_color, const uint8_t* bg_pixel, const uint8_t* sprite_color,
+                          const uint8_t* sprite_flags, const uint32_t* palette, uint32_t* out);
+#endif
+#ifdef __AVX2__
+    int compose_line_avx2(const uint8_t* bg_color, const uint8_t* bg_pixel, const uint8_t* sprite_color,
+                          const uint8_t* sprite_flags, const uint32_t* palette, uint32_t* out);
+#endif
+
+    const char* backend();
+}
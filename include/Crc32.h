@@ -0,0 +1,7 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+//CRC-32 (IEEE 802.3, the one used by zip and the ROM databases), slice-by-8: eight table lookups per 8 input bytes.
+//Pass a previous result as crc to continue a checksum over several buffers
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0);
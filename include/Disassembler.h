@@ -0,0 +1,98 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+//Mnemonics and addressing modes of the official 6502 opcodes, for the tools that print CPU code.
+//Unofficial opcodes are listed as "???" with no operands
+namespace Disassembler
+{
+    enum Mode { IMP, ACC, IMM, ZP, ZPX, ZPY, ABS, ABX, ABY, IND, IZX, IZY, REL };
+
+    struct Opcode
+    {
+        const char* mnemonic;
+        Mode mode;
+    };
+
+    inline constexpr Opcode opcodes[256] =
+    {
+        {"BRK", IMP}, {"ORA", IZX}, {"???", IMP}, {"???", IMP}, {"???", IMP}, {"ORA", ZP}, {"ASL", ZP}, {"???", IMP},
+        {"PHP", IMP}, {"ORA", IMM}, {"ASL", ACC}, {"???", IMP}, {"???", IMP}, {"ORA", ABS}, {"ASL", ABS}, {"???", IMP},
+        {"BPL", REL}, {"ORA", IZY}, {"???", IMP}, {"???", IMP}, {"???", IMP}, {"ORA", ZPX}, {"ASL", ZPX}, {"???", IMP},
+        {"CLC", IMP}, {"ORA", ABY}, {"???", IMP}, {"???", IMP}, {"???", IMP}, {"ORA", ABX}, {"ASL", ABX}, {"???", IMP},
+        {"JSR", ABS}, {"AND", IZX}, {"???", IMP}, {"???", IMP}, {"BIT", ZP}, {"AND", ZP}, {"ROL", ZP}, {"???", IMP},
+        {"PLP", IMP}, {"AND", IMM}, {"ROL", ACC}, {"???", IMP}, {"BIT", ABS}, {"AND", ABS}, {"ROL", ABS}, {"???", IMP},
+        {"BMI", REL}, {"AND", IZY}, {"???", IMP}, {"???", IMP}, {"???", IMP}, {"AND", ZPX}, {"ROL", ZPX}, {"???", IMP},
+        {"SEC", IMP}, {"AND", ABY}, {"???", IMP}, {"???", IMP}, {"???", IMP}, {"AND", ABX}, {"ROL", ABX}, {"???", IMP},
+        {"RTI", IMP}, {"EOR", IZX}, {"???", IMP}, {"???", IMP}, {"???", IMP}, {"EOR", ZP}, {"LSR", ZP}, {"???", IMP},
+        {"PHA", IMP}, {"EOR", IMM}, {"LSR", ACC}, {"???", IMP}, {"JMP", ABS}, {"EOR", ABS}, {"LSR", ABS}, {"???", IMP},
+        {"BVC", REL}, {"EOR", IZY}, {"???", IMP}, {"???", IMP}, {"???", IMP}, {"EOR", ZPX}, {"LSR", ZPX}, {"???", IMP},
+        {"CLI", IMP}, {"EOR", ABY}, {"???", IMP}, {"???", IMP}, {"???", IMP}, {"EOR", ABX}, {"LSR", ABX}, {"???", IMP},
+        {"RTS", IMP}, {"ADC", IZX}, {"???", IMP}, {"???", IMP}, {"???", IMP}, {"ADC", ZP}, {"ROR", ZP}, {"???", IMP},
+        {"PLA", IMP}, {"ADC", IMM}, {"ROR", ACC}, {"???", IMP}, {"JMP", IND}, {"ADC", ABS}, {"ROR", ABS}, {"???", IMP},
+        {"BVS", REL}, {"ADC", IZY}, {"???", IMP}, {"???", IMP}, {"???", IMP}, {"ADC", ZPX}, {"ROR", ZPX}, {"???", IMP},
+        {"SEI", IMP}, {"ADC", ABY}, {"???", IMP}, {"???", IMP}, {"???", IMP}, {"ADC", ABX}, {"ROR", ABX}, {"???", IMP},
+        {"???", IMP}, {"STA", IZX}, {"???", IMP}, {"???", IMP}, {"STY", ZP}, {"STA", ZP}, {"STX", ZP}, {"???", IMP},
+        {"DEY", IMP}, {"???", IMP}, {"TXA", IMP}, {"???", IMP}, {"STY", ABS}, {"STA", ABS}, {"STX", ABS}, {"???", IMP},
+        {"BCC", REL}, {"STA", IZY}, {"???", IMP}, {"???", IMP}, {"STY", ZPX}, {"STA", ZPX}, {"STX", ZPY}, {"???", IMP},
+        {"TYA", IMP}, {"STA", ABY}, {"TXS", IMP}, {"???", IMP}, {"???", IMP}, {"STA", ABX}, {"???", IMP}, {"???", IMP},
+        {"LDY", IMM}, {"LDA", IZX}, {"LDX", IMM}, {"???", IMP}, {"LDY", ZP}, {"LDA", ZP}, {"LDX", ZP}, {"???", IMP},
+        {"TAY", IMP}, {"LDA", IMM}, {"TAX", IMP}, {"???", IMP}, {"LDY", ABS}, {"LDA", ABS}, {"LDX", ABS}, {"???", IMP},
+        {"BCS", REL}, {"LDA", IZY}, {"???", IMP}, {"???", IMP}, {"LDY", ZPX}, {"LDA", ZPX}, {"LDX", ZPY}, {"???", IMP},
+        {"CLV", IMP}, {"LDA", ABY}, {"TSX", IMP}, {"???", IMP}, {"LDY", ABX}, {"LDA", ABX}, {"LDX", ABY}, {"???", IMP},
+        {"CPY", IMM}, {"CMP", IZX}, {"???", IMP}, {"???", IMP}, {"CPY", ZP}, {"CMP", ZP}, {"DEC", ZP}, {"???", IMP},
+        {"INY", IMP}, {"CMP", IMM}, {"DEX", IMP}, {"???", IMP}, {"CPY", ABS}, {"CMP", ABS}, {"DEC", ABS}, {"???", IMP},
+        {"BNE", REL}, {"CMP", IZY}, {"???", IMP}, {"???", IMP}, {"???", IMP}, {"CMP", ZPX}, {"DEC", ZPX}, {"???", IMP},
+        {"CLD", IMP}, {"CMP", ABY}, {"???", IMP}, {"???", IMP}, {"???", IMP}, {"CMP", ABX}, {"DEC", ABX}, {"???", IMP},
+        {"CPX", IMM}, {"SBC", IZX}, {"???", IMP}, {"???", IMP}, {"CPX", ZP}, {"SBC", ZP}, {"INC", ZP}, {"???", IMP},
+        {"INX", IMP}, {"SBC", IMM}, {"NOP", IMP}, {"???", IMP}, {"CPX", ABS}, {"SBC", ABS}, {"INC", ABS}, {"???", IMP},
+        {"BEQ", REL}, {"SBC", IZY}, {"???", IMP}, {"???", IMP}, {"???", IMP}, {"SBC", ZPX}, {"INC", ZPX}, {"???", IMP},
+        {"SED", IMP}, {"SBC", ABY}, {"???", IMP}, {"???", IMP}, {"???", IMP}, {"SBC", ABX}, {"INC", ABX}, {"???", IMP},
+    };
+
+    inline int operand_size(Mode mode)
+    {
+        switch(mode)
+        {
+            case IMP: case ACC: return 0;
+            case ABS: case ABX: case ABY: case IND: return 2;
+            default: return 1;
+        }
+    }
+
+    //The instruction at PC as assembly text, operands are the two bytes after the opcode
+    inline void disassemble(uint16_t PC, uint8_t opcode, const uint8_t operands[2], char* text, size_t size)
+    {
+        const Opcode& op = opcodes[opcode];
+        uint8_t low = operands[0];
+        uint16_t word = operands[0] | (operands[1] << 8);
+        switch(op.mode)
+        {
+            case IMP: snprintf(text, size, "%s", op.mnemonic); break;
+            case ACC: snprintf(text, size, "%s A", op.mnemonic); break;
+            case IMM: snprintf(text, size, "%s #$%02X", op.mnemonic, low); break;
+            case ZP:  snprintf(text, size, "%s $%02X", op.mnemonic, low); break;
+            case ZPX: snprintf(text, size, "%s $%02X,X", op.mnemonic, low); break;
+            case ZPY: snprintf(text, size, "%s $%02X,Y", op.mnemonic, low); break;
+            case ABS: snprintf(text, size, "%s $%04X", op.mnemonic, word); break;
+            case ABX: snprintf(text, size, "%s $%04X,X", op.mnemonic, word); break;
+            case ABY: snprintf(text, size, "%s $%04X,Y", op.mnemonic, word); break;
+            case IND: snprintf(text, size, "%s ($%04X)", op.mnemonic, word); break;
+            case IZX: snprintf(text, size, "%s ($%02X,X)", op.mnemonic, low); break;
+            case IZY: snprintf(text, size, "%s ($%02X),Y", op.mnemonic, low); break;
+            case REL: snprintf(text, size, "%s $%04X", op.mnemonic, (uint16_t)(PC + 2 + (int8_t)low)); break;
+        }
+    }
+
+    //Opcode and operand bytes as hex, as many as the instruction has
+    inline void format_bytes(uint8_t opcode, const uint8_t operands[2], char* text, size_t size)
+    {
+        switch(operand_size(opcodes[opcode].mode))
+        {
+            case 0: snprintf(text, size, "%02X", opcode); break;
+            case 1: snprintf(text, size, "%02X %02X", opcode, operands[0]); break;
+            default: snprintf(text, size, "%02X %02X %02X", opcode, operands[0], operands[1]); break;
+        }
+    }
+}
@@ -1,4 +1,6 @@
 #pragma once
+#include <algorithm>
+#include <cstdint>
 #include <memory>
 
 const int PRG_ROM_BANK_SIZE_16KB = 0x4000;
@@ -18,24 +20,105 @@ enum MIRROR
     FOUR_SCREEN
 };
 
+//A mapper only decodes register writes. It lays out its banks with map_prg / map_chr / map_prg_ram whenever a register
+//changes, which fills the page tables below: four 8KB PRG-ROM windows at $8000-$FFFF, eight 1KB CHR windows at
+//$0000-$1FFF and one 8KB PRG-RAM window at $6000. Reads go through the tables without a virtual call, so every mapper
+//costs the same per access.
 class Cartridge;
 class Mapper
 {
     public:
-         Mapper(int n_prg_rom_banks, int n_chr_rom_banks, std::shared_ptr<Cartridge> cart)
+        //Sizes in bytes, chr_size is the CHR-RAM size for boards without CHR-ROM
+        Mapper(uint32_t prg_rom_size, uint32_t chr_size, std::shared_ptr<Cartridge> cart)
         {
-            this->n_prg_rom_banks = n_prg_rom_banks;
-            this->n_chr_rom_banks = n_chr_rom_banks;
+            prg_rom_windows = (prg_rom_size >= PRG_ROM_BANK_SIZE_8KB) ? prg_rom_size / PRG_ROM_BANK_SIZE_8KB : 1;
+            chr_windows = (chr_size >= CHR_ROM_BANK_SIZE_1KB) ? chr_size / CHR_ROM_BANK_SIZE_1KB : 1;
             this->cart = cart;
+            map_prg<32>(0, 0);
+            map_chr<8>(0, 0);
         };
         
         virtual ~Mapper() { };
-        virtual uint32_t cpu_reads(uint16_t address) = 0;
-        virtual uint32_t ppu_reads(uint16_t address) = 0;
         virtual void cpu_writes(uint16_t address, uint8_t value) = 0;
+        //Takes over the registers of a mapper of the same type
+        virtual void copy_state(const Mapper& other) = 0;
+        //Filtered rising edge of PPU A12, see PPU::A12_changed
+        virtual void A12_rising() { };
+
+        uint32_t prg_rom_address(uint16_t address) const
+        {
+            return prg_rom_pages[(address >> 13) & 3] + (address & (PRG_ROM_BANK_SIZE_8KB - 1));
+        }
+
+        uint32_t prg_ram_address(uint16_t address) const
+        {
+            return prg_ram_page + (address & (PRG_ROM_BANK_SIZE_8KB - 1));
+        }
+
+        uint32_t chr_address(uint16_t address) const
+        {
+            return chr_pages[(address >> 10) & 7] + (address & (CHR_ROM_BANK_SIZE_1KB - 1));
+        }
+
+        //The CHR page table alone, so another mapper can show the same banks without its registers (see PPUPipeline)
+        void get_chr_layout(uint32_t pages[8]) const
+        {
+            std::copy(chr_pages, chr_pages + 8, pages);
+        }
+        void set_chr_layout(const uint32_t pages[8])
+        {
+            std::copy(pages, pages + 8, chr_pages);
+        }
+
+        //Copying a mapper copies its registers and bank layout, the cartridge stays the one this mapper belongs to
+        Mapper& operator=(const Mapper& other)
+        {
+            prg_rom_windows = other.prg_rom_windows;
+            chr_windows = other.chr_windows;
+            std::copy(other.prg_rom_pages, other.prg_rom_pages + 4, prg_rom_pages);
+            std::copy(other.chr_pages, other.chr_pages + 8, chr_pages);
+            prg_ram_page = other.prg_ram_page;
+            return *this;
+        }
     protected:
-        int n_prg_rom_banks;
-        int n_chr_rom_banks;
         std::shared_ptr<Cartridge> cart;
-        uint32_t mapped_address = 0;
-};
\ No newline at end of file
+
+        //Maps bank number bank of KB sized banks into the slot-th KB sized window. Bank numbers wrap around the
+        //ROM like the unconnected upper address lines do, negative numbers count from the last bank
+        template <int KB>
+        void map_prg(int slot, int bank)
+        {
+            static_assert(KB == 8 || KB == 16 || KB == 32, "PRG windows are 8, 16 or 32KB");
+            constexpr int windows = KB / 8;
+            bank = wrap(bank, (prg_rom_windows + windows - 1) / windows);
+            for(int i = 0; i < windows; i++)
+                prg_rom_pages[slot * windows + i] = ((bank * windows + i) % prg_rom_windows) * PRG_ROM_BANK_SIZE_8KB;
+        }
+
+        template <int KB>
+        void map_chr(int slot, int bank)
+        {
+            static_assert(KB == 1 || KB == 2 || KB == 4 || KB == 8, "CHR windows are 1, 2, 4 or 8KB");
+            bank = wrap(bank, (chr_windows + KB - 1) / KB);
+            for(int i = 0; i < KB; i++)
+                chr_pages[slot * KB + i] = ((bank * KB + i) % chr_windows) * CHR_ROM_BANK_SIZE_1KB;
+        }
+
+        void map_prg_ram(int bank)
+        {
+            prg_ram_page = bank * PRG_ROM_BANK_SIZE_8KB;
+        }
+
+    private:
+        int prg_rom_windows;
+        int chr_windows;
+        uint32_t prg_rom_pages[4];
+        uint32_t chr_pages[8];
+        uint32_t prg_ram_page = 0;
+
+        static int wrap(int bank, int banks)
+        {
+            bank %= banks;
+            return (bank < 0) ? bank + banks : bank;
+        }
+};
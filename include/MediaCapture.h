@@ -0,0 +1,122 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Records what the machine shows and plays. Video goes to base.y4m (4:2:0, BT.601 studio range) or to base.rgba
+//(the 256x240 screen words as they are, ffmpeg -f rawvideo -pix_fmt abgr on little endian hosts), audio to a 16 bit
+//mono base.wav. The emulation thread fills one slot per frame from a fixed pool and a background thread converts
+//and writes them. When the writer falls behind and no slot is free the frame is dropped and counted, the writer
+//repeats the last frame in its place so the video keeps its frame rate and stays in step with the audio
+class MediaCapture
+{
+    public:
+        enum VideoFormat : uint8_t { Y4M, RAW_RGBA };
+
+        static const int WIDTH = 256;
+        static const int HEIGHT = 240;
+        static const int POOL_FRAMES = 32;
+        //Audio of dropped frames rides along with the next frame that gets a slot, past this it is written as silence
+        static const size_t MAX_STAGED_SAMPLES = 1 << 16;
+
+        MediaCapture();
+        ~MediaCapture();
+
+        //The frame rate is rate_numerator / rate_denominator frames per second
+        bool start(const std::string& base_filename, VideoFormat format, uint32_t rate_numerator,
+                   uint32_t rate_denominator, uint32_t sample_rate);
+        //Writes out every frame handed over and closes the files
+        void stop();
+        bool is_recording()
+        {
+            return recording;
+        }
+
+        //Called by the emulation thread only
+        void add_sample(int16_t sample)
+        {
+            if(staged_samples.size() < MAX_STAGED_SAMPLES)
+                staged_samples.push_back(sample);
+            else
+                staged_silence++;
+        }
+        //Ends a frame, screen is null when no new frame was drawn and the last one is shown again. Never waits
+        //for the writer
+        void end_frame(const std::vector<uint32_t>* screen);
+
+        uint64_t get_frames_written()
+        {
+            return frames_written.load(std::memory_order_relaxed);
+        }
+        uint64_t get_frames_dropped()
+        {
+            return frames_dropped.load(std::memory_order_relaxed);
+        }
+        //A write failed, the rest of the recording is discarded
+        bool has_failed()
+        {
+            return failed.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct Slot
+        {
+            std::vector<uint32_t> pixels;
+            bool has_pixels = false;
+            uint32_t repeats = 0; //Frames dropped before this one, shown as the last frame written
+            std::vector<int16_t> samples;
+            uint32_t silence = 0;
+        };
+
+        VideoFormat format = Y4M;
+        bool recording = false;
+        std::FILE* video = nullptr;
+        std::FILE* audio = nullptr;
+        uint32_t audio_bytes = 0;
+
+        //Emulation thread side
+        std::vector<int16_t> staged_samples;
+        uint32_t staged_silence = 0;
+        uint32_t staged_repeats = 0;
+
+        std::vector<std::unique_ptr<Slot>> pool;
+        std::vector<Slot*> free_slots;
+        std::deque<Slot*> ready_slots;
+        std::mutex mutex;
+        std::condition_variable work_ready;
+        bool stopping = false;
+        std::thread writer;
+
+        //Writer thread side
+        std::vector<uint8_t> frame_bytes; //Last frame converted, written again for repeats
+        std::vector<int16_t> silence_buffer;
+
+        std::atomic<uint64_t> frames_written{0};
+        std::atomic<uint64_t> frames_dropped{0};
+        std::atomic<bool> failed{false};
+
+        void write_loop();
+        void write_slot(Slot& slot);
+        void convert_frame(const uint32_t* pixels);
+        void write_frame();
+        void write_wav_header(uint32_t sample_rate);
+};
+
+//RGBA screen (0xRRGGBBAA words) to planar 4:2:0, each chroma sample is the average of a 2x2 block.
+//Exposed along with its implementations so they can be checked against each other
+namespace YUV
+{
+    void rgba_to_yuv420(const uint32_t* rgba, int width, int height, uint8_t* y, uint8_t* u, uint8_t* v);
+    void rgba_to_yuv420_scalar(const uint32_t* rgba, int width, int height, uint8_t* y, uint8_t* u, uint8_t* v);
+#ifdef __SSE2__
+    //width has to be a multiple of 16
+    void rgba_to_yuv420_sse2(const uint32_t* rgba, int width, int height, uint8_t* y, uint8_t* u, uint8_t* v);
+#endif
+}
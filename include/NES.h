@@ -3,11 +3,15 @@
 #include "APU.h"
 #include "Cartridge.h"
 #include "Bus.h"
+#include "PPUPipeline.h"
+#include "TurboRenderer.h"
+#include "MediaCapture.h"
 
 class NES
 {
     public:
         NES();
+        ~NES();
         bool load_game(std::string filename);
         void run_frame();
         void change_pause(SDL_AudioDeviceID audio_device);
@@ -16,6 +20,7 @@ class NES
         std::shared_ptr<PPU> get_ppu();
         std::shared_ptr<CPU> get_cpu();
         void reset();
+        void press_reset();
         void reload_game();
         void alternate_zapper();
         bool get_zapper();
@@ -26,15 +31,65 @@ class NES
         std::string get_info();
         bool set_audio_buffer(int16_t *buffer, int BUFFER_SIZE, uint16_t* write_pos);
         int get_write_pos();
+        uint8_t peek(uint16_t address);
+        void set_render_interval(int interval);
+        bool is_frame_rendered();
+        bool start_trace(std::string filename);
+        void stop_trace();
+        bool is_tracing();
+        //Records video and audio to base_filename.y4m (or .rgba) and base_filename.wav, see MediaCapture. Every
+        //frame that runs to its end is recorded, the frame rate is the region's when recording starts
+        bool start_capture(std::string base_filename, MediaCapture::VideoFormat format);
+        void stop_capture();
+        bool is_capturing();
+        uint64_t get_capture_frames_dropped();
+        void set_idle_skip(bool enabled);
+        bool get_idle_skip();
+        uint64_t get_idle_loops_detected();
+        uint64_t get_idle_cycles_replayed();
+        uint64_t get_idle_cycles_skipped();
+        void set_block_mode(BlockMode mode);
+        BlockMode get_block_mode();
+        uint64_t get_decoded_instructions();
+        uint64_t get_block_mismatches();
+        std::string get_block_mismatch_report();
+        void set_cpu_probe(CPUProbe* probe);
+        //Draws frames on a second thread one frame behind the emulation, see PPUPipeline. The zapper needs the
+        //frame being emulated, the machine runs serially while one is connected
+        void set_pipelined_ppu(bool enabled);
+        bool get_pipelined_ppu();
+        //Draws frames on a pool of workers threads while the emulation runs the PPU for timing only, see
+        //TurboRenderer. Meant for fast-forward: frames are drawn as workers are free and only the newest is shown.
+        //The render interval still picks the frames that may be drawn. 0 workers turns it off, it takes over
+        //from the pipelined PPU while on
+        void set_turbo_render(int workers);
+        int get_turbo_render();
+        //Frame to show after run_frame when is_frame_rendered. The pipelined PPU shows the previous frame,
+        //turbo rendering the newest one its workers finished
+        std::vector<uint32_t>& get_screen();
+        //Waits for the other threads to draw what they were given, get_screen then shows the latest frame
+        void finish_frame();
+        //Makes target an independent copy of this machine. ROM images and PRG-RAM pages are shared, the rest
+        //of the machine state is copied. Neither machine may be running a frame meanwhile.
+        //Audio buffer, render interval, tracing and capture stay the target's own
+        void clone_into(NES& target);
 
     private:
+        template <bool PAL>
+        void run_frame_loop();
+        //Everything that happens in a CPU cycle besides the CPU itself
+        template <bool PAL>
+        void tick_apu_and_ppu();
+        void set_region(bool pal);
+        void stop_pipeline();
+
         std::shared_ptr<CPU> cpu;
         std::shared_ptr<PPU> ppu;
         std::shared_ptr<APU> apu;
         std::shared_ptr<Cartridge> cart;
         std::shared_ptr<Bus> bus;
         bool current_frame;
-        float ppu_accumulator = 0.0;
+        uint8_t pal_cadence = 0; //CPU cycles into the current 5 cycle PAL group
         bool region = 0; // 0: NTSC, 1: PAL
         bool pause = false;
         bool game_loaded = false;
@@ -46,7 +101,34 @@ class NES
         bool reset_flag = false;
         std::string game_title = "";
         std::string region_info = "NTSC";
-        int16_t *audio_buffer;
-        int buffer_size;
-        uint16_t *write_pos;
+        int16_t *audio_buffer = nullptr; //No audio output when not set
+        int buffer_size = 0;
+        uint16_t *write_pos = nullptr;
+        int render_interval = 1; // Render 1 in N frames, 0 never renders (headless)
+        int frames_since_render = 0;
+        enum FrameSource { SERIAL_PPU, PIPELINE, TURBO };
+        FrameSource frame_source = SERIAL_PPU; //Where the last run_frame left its frame
+        PPULog ppu_log; //Attached to the bus while another thread follows the PPU
+        std::unique_ptr<PPUPipeline> pipeline; //Set while the pipelined PPU is enabled
+        bool pipeline_running = false; //The log is kept for it and its renderer follows this machine
+        std::unique_ptr<TurboRenderer> turbo; //Set while turbo rendering is enabled
+        bool turbo_frame_collected = false;
+        bool at_frame_start = true; //The PPU is at vblank or power on, where a turbo frame can start
+        std::unique_ptr<MediaCapture> capture; //Set while recording
+};
+
+//Recycles machines for search workloads that branch a state thousands of times per second.
+//Released machines are reused by the next clone, so once the pool is warm cloning does not allocate
+class NESPool
+{
+    public:
+        std::unique_ptr<NES> clone(NES& source);
+        void release(std::unique_ptr<NES> nes);
+        size_t get_free_count()
+        {
+            return free_machines.size();
+        }
+
+    private:
+        std::vector<std::unique_ptr<NES>> free_machines;
 };
\ No newline at end of file
@@ -1,13 +1,16 @@
 #pragma once
 #include "Mapper.h"
 
+//No registers, the base mapper's power on layout (32KB PRG, mirrored for 16KB boards, and 8KB CHR) is NROM
 class Cartridge;
 class NROM : public Mapper
 {
     public:
-        NROM(int n_prg_rom_banks, int n_chr_rom_banks, std::shared_ptr<Cartridge> cart) : Mapper(n_prg_rom_banks, n_chr_rom_banks, cart) {};
+        NROM(uint32_t prg_rom_size, uint32_t chr_size, std::shared_ptr<Cartridge> cart) : Mapper(prg_rom_size, chr_size, cart) {};
         ~NROM() override { };
-        uint32_t cpu_reads(uint16_t address);
-        uint32_t ppu_reads(uint16_t address);
         void cpu_writes(uint16_t address, uint8_t value) { };
-};
\ No newline at end of file
+        void copy_state(const Mapper& other) override
+        {
+            *this = static_cast<const NROM&>(other);
+        }
+};
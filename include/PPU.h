@@ -1,25 +1,141 @@
 #include <iostream>
 #include <cstdint>
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <vector>
 #include "Mapper.h"
 
 
-struct ScanlineCounter
+//PPU memory as of the last vblank, what the debug views draw from
+struct DebugSnapshot
 {
-    bool irq_enable = false;
-    uint8_t irq_counter = 0;
-    uint8_t irq_latch = 0;
-    bool irq_reload = false;
+    uint8_t chr[0x2000];
+    uint8_t nametables[0x1000]; //$2000-$2FFF after mirroring
+    uint8_t palette[0x20];
+    uint8_t oam[0x100];
+    uint8_t ppuctrl;
+    bool valid = false;
+};
+
+//Caller owned state of one debug view. It holds what every tile of the caller's pixel buffer was drawn from,
+//so the buffer must be kept between calls. Clear tile_keys when switching to a new buffer
+struct DebugViewCache
+{
+    std::vector<uint8_t> tile_keys;
 };
 
 class Bus;
-class PPU
+//Everything the PPU needs to resume rendering, kept apart from the wiring, the output frame and the debug
+//views so a machine state is copied with one assignment (see NES::clone_into)
+struct PPUState
+{
+    uint32_t dot_clock = 0; //Dots since power on, wraps
+    bool prev_A12 = false;
+    uint32_t A12_low_since = 0; //dot_clock of the first dot A12 was low
+    uint16_t PPU_BUS = 0x0000;
+    MIRROR mirroring_mode = MIRROR::HORIZONTAL;
+
+    //PPU Registers
+    uint8_t PPUCTRL;
+    uint8_t PPUMASK;
+    uint8_t PPUSTATUS;
+    uint8_t OAMADDR;
+    uint8_t OAMDATA;
+    uint8_t PPUSCROLL;
+    uint8_t PPUADDR;
+    uint8_t PPUDATA;
+    uint8_t OAMDMA;
+
+    uint8_t nametable[0x1000] = {0}; //VRAM 2kb
+
+    uint8_t frame_palette[0x20] = {0};       
+    uint8_t OAM[0x100] = {0}; //256 bytes that determines how sprites are rendered
+    uint8_t secondary_oam[0x20] = {0};
+    uint8_t scanline_sprite_buffer[0x30] = {0};
+
+    //PPU internal registers
+    uint16_t v; //Current VRAM address; 15bits
+    uint16_t t; //Temporary VRAM address; 15bits
+    uint8_t fine_x; //X Scroll
+    bool w = 0; //Firs or second write
+    bool odd;
+
+    int cycles;
+    int scanline;
+    bool frame;
+
+    int mapper;
+
+
+    uint8_t nametable_id;
+    uint8_t attribute;
+    
+    uint8_t bg_lsb;
+    uint8_t bg_msb;
+
+    uint16_t bg_shift_register;
+    uint16_t bg_shift_register1;
+
+    uint16_t palette_bit_0;
+    uint16_t palette_bit_1;
+
+    uint8_t coarse_x_bit1;
+    uint8_t coarse_y_bit1; 
+
+    uint8_t ppudata_read_buffer;   
+
+    uint8_t scanline_buffer[256] = {0}; //Background pixel values (0-3) of the current scanline
+
+    //Variables used in sprite evaluation
+    int sprite_overflow_dot = 0; //Dot of the current scanline where the overflow flag gets set, 0 for none
+
+    //Current scanline in system palette indices, merged by the Compositor at dot 256
+    uint8_t bg_color[256] = {0};
+    uint8_t sprite_line[256] = {0}; //Compositor sprite flags
+    uint8_t sprite_line_color[256] = {0};
+
+    //Used for clearing OAM
+    int secondary_oam_index;
+    int i;
+
+
+    //Variables for sprite 0 hit handling
+    bool sprite_0_next_scanline;
+    bool sprite_0_current_scanline;
+
+    uint8_t sprite_y_coord;
+    uint8_t attribute_sprite;
+    uint8_t tile_id;
+    uint16_t address;
+    uint16_t pre_render_scanline;
+
+    bool ppu_timing;
+    uint8_t open_bus;
+    bool supress = false;
+
+    int zapper_x, zapper_y;
+    bool zapper_connected = false;
+
+    uint8_t is_rendering_enabled;
+    uint8_t toggling_rendering_counter = 3;
+};
+
+class PPU : private PPUState
 {
     public:
         PPU();
         ~PPU();
+        //Region is a template parameter so the frame layout compiles to constants
+        template <bool PAL>
         void tick();
+        void tick()
+        {
+            if(ppu_timing)
+                tick<true>();
+            else
+                tick<false>();
+        }
 
 
         //PPU read an write functions
@@ -29,13 +145,16 @@ class PPU
         //CPU read and write functions
         uint8_t cpu_reads(uint16_t address);
         void cpu_writes(uint16_t address, uint8_t value); 
+        bool write_oam_page(const uint8_t* page, int dots);
         //Functions for sprite handling
         void sprite_evaluation();
         void check_sprite_0_hit();
 
         //Functions for drawing data to screen
         void draw_background_pixel();
-        void draw_sprite_pixel();
+        bool needs_background_pixel();
+        void compose_sprite_line();
+        void draw_scanline();
         
         void increment_hori_v();
         void increment_vert_v();
@@ -49,70 +168,67 @@ class PPU
         
         uint32_t get_palette_color(uint8_t paletteFF, uint8_t pixel);
         std::vector<uint32_t>& get_screen();
-        //Functions useful for debugging
-        std::vector<uint32_t> get_pattern_table(int);
-        std::vector<uint32_t> get_nametable(int);
-        std::vector<uint32_t> get_sprite();
+        //Debug views, safe to call from the UI thread. They draw the last vblank snapshot into the caller's
+        //buffer, redraw only the tiles that changed and return how many were redrawn
+        int render_pattern_table(int table, uint32_t* pixels, DebugViewCache& cache); //128x128
+        int render_nametable(int table, uint32_t* pixels, DebugViewCache& cache); //256x240
+        int render_sprites(uint32_t* pixels, DebugViewCache& cache); //64x64, the 64 OAM entries in an 8x8 grid
+        //Stops the vblank snapshots the views need. They also stop by themselves once no view was drawn for
+        //DEBUG_VIEW_TIMEOUT_FRAMES frames, a render call starts them again
+        void close_debug_views();
 
         bool get_frame();
+        int get_scanline()
+        {
+            return scanline;
+        }
+        int get_dot()
+        {
+            return cycles;
+        }
+        uint32_t get_dot_clock()
+        {
+            return dot_clock;
+        }
         void set_ppu_timing(uint8_t);
 
-
-        //Zapper useful functions
-        void is_pixel_bright(int x, int y);
-        void set_zapper(bool zapper);
-        void check_target_hit(int x, int y);
-
-        void set_irq_latch(uint8_t value)
+        //When disabled the PPU keeps its timing (sprite 0 hit, overflow, A12, NMI) but skips pixel output
+        void set_render_output(bool value)
         {
-            sc.irq_latch = value;
+            render_output = value;
         }
-        void set_irq_enable(bool value);
-        void set_irq_reload()
+        bool get_render_output()
         {
-            sc.irq_counter = 0;
-            sc.irq_reload = true;
+            return render_output;
         }
 
-        void clock_scanline_counter();
+
+        //Zapper useful functions
+        void is_pixel_bright(int x, int y);
+        void set_zapper(bool zapper);
+        void check_target_hit(int x, int y);
 
         void set_mapper(uint8_t value)
         {
             mapper = value;
         }
 
-        void set_mirroring_mode(MIRROR value)
-        {
-            if(mirroring_mode != MIRROR::FOUR_SCREEN)
-                mirroring_mode = value;
-        }
+        void set_mirroring_mode(MIRROR value);
+        //Maps a 1KB nametable page ($2000, $2400, $2800, $2C00) to mapper supplied memory.
+        //A later mirroring change points the page back at the PPU VRAM, so mappers map again after it
+        void map_nametable(int page, uint8_t* memory);
+
+        //Takes over another PPU's state. The bus, the output frame and the debug views stay this PPU's own
+        void copy_state(const PPU& other);
         
     private:
-        int M2_falling_edges = 0;
-        int ppu_cycles = 0;
-        bool prev_A12 = false;
-        void detect_filtered_A12();
-        int prev_scanline = 0;
-        uint16_t PPU_BUS = 0x0000;
-        MIRROR mirroring_mode = MIRROR::HORIZONTAL;
-
-        //PPU Registers
-        uint8_t PPUCTRL;
-        uint8_t PPUMASK;
-        uint8_t PPUSTATUS;
-        uint8_t OAMADDR;
-        uint8_t OAMDATA;
-        uint8_t PPUSCROLL;
-        uint8_t PPUADDR;
-        uint8_t PPUDATA;
-        uint8_t OAMDMA;
+        void A12_changed(bool A12);
 
         std::shared_ptr<Bus> bus;
 
-        //Logger logger;
 
-
-        uint8_t nametable[0x1000] = {0}; //VRAM 2kb
+        uint8_t* nametable_pages[4]; //1KB page seen at $2000, $2400, $2800 and $2C00
+        void update_nametable_pages();
         const uint32_t system_palette[64] = {
                     0x666666FF, 0x002a88FF, 0x1412a7FF, 0x3b00a4FF, 0x5c007eFF, 0x6e0040FF, 0x6c0600FF, 0x561d00FF,
                     0x333500FF, 0x0b4800FF, 0x005200FF, 0x004f08FF, 0x00404dFF, 0x000000FF, 0x000000FF, 0x000000FF,
@@ -124,85 +240,18 @@ class PPU
                     0xe4e594FF, 0xcfef96FF, 0xbdf4abFF, 0xb3f3ccFF, 0xb5ebf2FF, 0xb8b8b8FF, 0x000000FF, 0x000000FF,
                 };
 
-        uint8_t frame_palette[0x20] = {0};       
-        uint8_t OAM[0x100] = {0}; //256 bytes that determines how sprites are rendered
-        uint8_t secondary_oam[0x20] = {0};
-        uint8_t scanline_sprite_buffer[0x30] = {0};
-
-        ScanlineCounter sc; //Scanline counter for MMC3
-        //PPU internal registers
-        uint16_t v; //Current VRAM address; 15bits
-        uint16_t t; //Temporary VRAM address; 15bits
-        uint8_t fine_x; //X Scroll
-        bool w = 0; //Firs or second write
-        bool odd;
-
-        int cycles;
-        int scanline;
-        bool frame;
-
-        int mapper;
-
-
-        uint8_t nametable_id;
-        uint8_t attribute;
-        
-        uint8_t bg_lsb;
-        uint8_t bg_msb;
-
-        uint16_t bg_shift_register;
-        uint16_t bg_shift_register1;
-
-        uint16_t palette_bit_0;
-        uint16_t palette_bit_1;
-
-        uint8_t coarse_x_bit1;
-        uint8_t coarse_y_bit1; 
-
-        uint8_t ppudata_read_buffer;   
-
 
         std::vector<uint32_t> screen;
-        std::vector<uint8_t> scanline_buffer;
-        std::vector<uint32_t> pattern_buffer;
-        std::vector<uint32_t> nametable_buffer;
-        std::vector<uint32_t> sprite_buffer;
-           
-        int n; // variable for OAM fetching
-        int m;
 
+        //Taken at vblank once a debug view asked for it. The emulation thread only try_locks, so a view
+        //being drawn costs it one skipped snapshot instead of a stall
+        std::mutex debug_mutex;
+        DebugSnapshot debug_snapshot;
+        static const int DEBUG_VIEW_TIMEOUT_FRAMES = 60;
+        std::atomic<int> debug_view_frames{0}; //Vblank snapshots left before the views count as closed
+        void take_debug_snapshot();
+        int draw_debug_tile(DebugViewCache& cache, int tile, const uint8_t* chr, const uint32_t colors[4], uint32_t* pixels, int pitch);
+           
 
-        //Variables used in sprite evaluation
-        uint8_t oam_data;
-        uint8_t y_coord;
-        bool oam_writes;
-        int secondary_oam_pos;
-        int sprites_found;
-        bool overflow_n;
-        bool in_range;
-
-        //Used for clearing OAM
-        int secondary_oam_index;
-        int i;
-
-
-        //Variables for sprite 0 hit handling
-        bool sprite_0_next_scanline;
-        bool sprite_0_current_scanline;
-
-        uint8_t sprite_y_coord;
-        uint8_t attribute_sprite;
-        uint8_t tile_id;
-        uint16_t address;
-        uint16_t pre_render_scanline;
-
-        bool ppu_timing;
-        uint8_t open_bus;
-        bool supress = false;
-
-        int zapper_x, zapper_y;
-        bool zapper_connected = false;
-
-        uint8_t is_rendering_enabled;
-        uint8_t toggling_rendering_counter = 3;
+        bool render_output = true;
 };
\ No newline at end of file
@@ -0,0 +1,87 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Mapper.h"
+
+class PPU;
+class CPU;
+class APU;
+class Bus;
+class Cartridge;
+
+//What a PPU's drawing depends on besides its own state, logged by the bus while one is attached (Bus::set_ppu_log).
+//Every entry is stamped with the PPU dot clock it happened on: PPU register writes, the register reads with side
+//effects ($2002 and $2007), CHR bank and mirroring changes and OAM DMA pages. A copy of the PPU taken when the log
+//began and fed the log at the same dots draws exactly what the logged PPU would have, see PPUFollower.
+//Mapper memory mapped as nametables (map_nametable) is not logged, none of the supported boards use it
+class PPULog
+{
+    public:
+        //Starts over, banks are logged from the cartridge's current layout on
+        void begin(const Cartridge& cart);
+        void clear();
+        //Exchanges the logged entries with another log, the bank tracking stays with each log
+        void swap_entries(PPULog& other);
+        bool empty()
+        {
+            return events.empty();
+        }
+
+        void register_write(uint32_t dot, uint8_t reg, uint8_t value)
+        {
+            events.push_back({dot, 0, WRITE, reg, value, 0});
+        }
+        void register_read(uint32_t dot, uint8_t reg)
+        {
+            events.push_back({dot, 0, READ, reg, 0, 0});
+        }
+        void mirroring_changed(uint32_t dot, MIRROR mode)
+        {
+            events.push_back({dot, 0, MIRRORING, 0, static_cast<uint8_t>(mode), 0});
+        }
+        //After a mapper register write, logs the CHR banks when they moved
+        void chr_banks_written(uint32_t dot, const Cartridge& cart);
+        void oam_page_copied(uint32_t dot, const uint8_t* page, int dots);
+
+    private:
+        friend class PPUFollower;
+        enum Kind : uint8_t { WRITE, READ, CHR_LAYOUT, MIRRORING, OAM_PAGE };
+        struct Event
+        {
+            uint32_t dot;
+            uint32_t offset; //Into chr_layouts or oam_pages
+            Kind kind;
+            uint8_t reg;
+            uint8_t value;
+            uint16_t dots; //OAM_PAGE: the dots write_oam_page was given
+        };
+
+        std::vector<Event> events;
+        std::vector<uint32_t> chr_layouts; //8 pages per CHR_LAYOUT event
+        std::vector<uint8_t> oam_pages;
+        uint32_t last_chr_layout[8] = {0};
+};
+
+//A PPU and the cartridge it reads CHR from, on a bus of their own, that draws another machine's frames from its log.
+//Only the PPU ticks, the cartridge gets its banks from the log
+class PPUFollower
+{
+    public:
+        PPUFollower();
+        //Takes over the state to follow. The timing only PPU of a pipelined machine leaves its tile fetches and
+        //pixels behind, a copy taken in vblank has them all fetched again before they are drawn
+        void start(const PPU& ppu, const Cartridge& cart);
+        //Runs the PPU to end_dot, replaying the log on the way
+        void replay(const PPULog& log, uint32_t end_dot, bool render);
+        std::vector<uint32_t>& get_screen();
+
+    private:
+        std::shared_ptr<CPU> cpu;
+        std::shared_ptr<PPU> ppu;
+        std::shared_ptr<APU> apu;
+        std::shared_ptr<Cartridge> cart;
+        std::shared_ptr<Bus> bus;
+
+        void advance(uint32_t dot);
+};
@@ -0,0 +1,57 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "PPULog.h"
+
+//Draws a machine's frames on a thread of its own. The emulation thread keeps its PPU for timing only (vblank,
+//NMI, sprite 0 hit, overflow, A12) and the bus logs what the drawing depends on (see PPULog). The renderer follows
+//the machine with a copy of the PPU taken at start, so it draws exactly what the serial machine would have.
+//Nothing the CPU sees waits for it: sprite 0 hit and PPUSTATUS come from the timing PPU, which only looks at
+//background pixels on lines sprite 0 is on. Frames are handed over at the end of NES::run_frame and the
+//renderer is at most one frame behind
+class PPUPipeline
+{
+    public:
+        PPUPipeline();
+        ~PPUPipeline();
+
+        //Takes over the state to follow, the renderer must be idle (see wait)
+        void start(const PPU& ppu, const Cartridge& cart);
+        //Hands what was logged since the last call to the renderer, up to end_dot, and leaves log empty. A frame
+        //is only shown when the part ending it was drawn, render tells whether this part draws pixels
+        void submit(PPULog& log, uint32_t end_dot, bool frame_complete, bool render);
+        //Waits for the renderer to finish what it was handed and takes the last frame it completed
+        void wait();
+        //Whether a new frame was taken since the last submit, get_frame then holds it
+        bool is_frame_ready()
+        {
+            return frame_ready;
+        }
+        std::vector<uint32_t>& get_frame()
+        {
+            return frame;
+        }
+
+    private:
+        PPUFollower follower;
+        PPULog pending;
+        uint32_t end_dot = 0;
+        bool frame_complete = false;
+        bool render = false;
+
+        std::vector<uint32_t> frame;
+        bool frame_ready = false;
+        bool frame_drawn = false; //Renderer finished a frame that is not taken yet
+
+        std::mutex mutex;
+        std::condition_variable work_ready;
+        std::condition_variable work_done;
+        bool busy = false;
+        bool quit = false;
+        std::thread worker;
+
+        void run();
+};
@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//RAM made of 1KB reference counted pages. share() makes two RAMs point at the same pages and the first
+//write to a shared page gives the writer its own copy, so cloning a machine does not copy its PRG-RAM.
+//Pages come from a process wide free list and go back to it, so steady state cloning does not allocate.
+class PagedRam
+{
+    public:
+        static const int PAGE_SIZE = 0x400;
+
+        PagedRam() = default;
+        ~PagedRam();
+        PagedRam(const PagedRam&) = delete;
+        PagedRam& operator=(const PagedRam&) = delete;
+
+        //Zero filled, the size is rounded up to whole pages
+        void resize(size_t size);
+        void clear();
+        size_t size() const
+        {
+            return pages.size() * PAGE_SIZE;
+        }
+
+        uint8_t read(uint32_t address) const
+        {
+            return pages[address / PAGE_SIZE]->data[address % PAGE_SIZE];
+        }
+
+        void write(uint32_t address, uint8_t value)
+        {
+            Page*& page = pages[address / PAGE_SIZE];
+            if(page->references.load(std::memory_order_acquire) != 1)
+                page = unshare(page);
+            page->data[address % PAGE_SIZE] = value;
+        }
+
+        //Drops this RAM's pages and references the other's, sizes are taken from the other RAM
+        void share(const PagedRam& other);
+
+    private:
+        struct Page
+        {
+            std::atomic<int> references;
+            uint8_t data[PAGE_SIZE];
+        };
+
+        std::vector<Page*> pages;
+
+        static Page* allocate_page();
+        static void release_page(Page* page);
+        static Page* unshare(Page* page);
+};
@@ -0,0 +1,129 @@
+#pragma once
+#include <cstdint>
+
+//Hot path profiler, compiled in only with -DCALASCIO_PROFILE (make PROFILE=1).
+//Without it every macro below expands to nothing, so the instrumented code is unchanged.
+//
+//PROFILE_ZONE(zone)        times the enclosing scope (inclusive of nested zones)
+//PROFILE_COUNT(zone, n)    adds n events to a zone without timing it
+//PROFILE_EXPORT_START(f)   starts the once per second exporter, writing a Chrome trace to f
+//PROFILE_EXPORT_STOP()     stops the exporter and closes the trace
+
+namespace Profiler
+{
+    enum Zone
+    {
+        ZONE_CPU_TICK,
+        ZONE_PPU_TICK,
+        ZONE_APU_TICK,
+        ZONE_MAPPER,
+        ZONE_AUDIO_RESAMPLE,
+        ZONE_FRAME,
+        ZONE_COUNT
+    };
+
+    const int HISTOGRAM_BUCKETS = 32; //Bucket i holds samples taking [2^i, 2^(i+1)) timer ticks
+
+    //Per second view of a zone, aggregated over all threads
+    struct ZoneReport
+    {
+        const char* name;
+        uint64_t calls;
+        double total_ms;
+        double mean_ns;
+        double p50_ns;
+        double p99_ns;
+    };
+
+    struct Report
+    {
+        uint64_t timestamp_us;
+        ZoneReport zones[ZONE_COUNT];
+    };
+}
+
+#ifdef CALASCIO_PROFILE
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace Profiler
+{
+    //Written only by the owning thread, read by the exporter, so relaxed loads and stores are enough
+    struct ZoneStats
+    {
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> ticks{0};
+        std::atomic<uint64_t> histogram[HISTOGRAM_BUCKETS] = {};
+    };
+
+    struct ThreadStats
+    {
+        ZoneStats zones[ZONE_COUNT];
+    };
+
+    ThreadStats& thread_stats();
+
+    inline uint64_t now_ticks()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    inline void add(std::atomic<uint64_t>& counter, uint64_t n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    inline void record(Zone zone, uint64_t ticks)
+    {
+        ZoneStats& stats = thread_stats().zones[zone];
+        int bucket = ticks ? 63 - __builtin_clzll(ticks) : 0;
+        add(stats.calls, 1);
+        add(stats.ticks, ticks);
+        add(stats.histogram[bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1], 1);
+    }
+
+    inline void count(Zone zone, uint64_t n)
+    {
+        add(thread_stats().zones[zone].calls, n);
+    }
+
+    void start_export(const std::string& filename);
+    void stop_export();
+    bool get_report(Report& report);
+
+    class ScopedTimer
+    {
+        public:
+            ScopedTimer(Zone zone) : zone(zone), start(now_ticks()) {}
+            ~ScopedTimer() { record(zone, now_ticks() - start); }
+
+        private:
+            Zone zone;
+            uint64_t start;
+    };
+}
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(zone) Profiler::ScopedTimer PROFILE_CONCAT(profile_timer_, __LINE__)(Profiler::zone)
+#define PROFILE_COUNT(zone, n) Profiler::count(Profiler::zone, n)
+#define PROFILE_EXPORT_START(filename) Profiler::start_export(filename)
+#define PROFILE_EXPORT_STOP() Profiler::stop_export()
+
+#else
+
+#define PROFILE_ZONE(zone) do {} while(0)
+#define PROFILE_COUNT(zone, n) do {} while(0)
+#define PROFILE_EXPORT_START(filename) do {} while(0)
+#define PROFILE_EXPORT_STOP() do {} while(0)
+
+#endif
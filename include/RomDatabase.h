@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+//Header corrections for known dumps, keyed by the CRC-32 of the PRG-ROM then CHR-ROM, exactly the sizes the header
+//gives. Bytes trailing the CHR-ROM are not part of the key. Fields left at -1 keep the value from the header.
+struct RomDatabaseEntry
+{
+    uint32_t crc = 0;
+    int16_t mapper = -1;
+    int8_t submapper = -1;
+    int8_t mirroring = -1; //MIRROR
+    int8_t timing = -1; //NES 2.0 timing: 0 NTSC, 1 PAL, 2 multi-region, 3 Dendy
+    int8_t battery = -1;
+    int32_t prg_ram_size = -1; //Bytes, volatile and battery backed together
+    int32_t chr_ram_size = -1;
+};
+
+//The built in entries plus the ones in OVERRIDE_FILE next to the ROM, read once per directory. A line is a
+//CRC followed by the fields to correct, # starts a comment:
+//
+//  1a2b3c4d mapper=4 submapper=1 mirroring=v timing=pal battery=1 prg_ram=8192 chr_ram=0
+//
+//mirroring is h, v, 1l, 1u (one screen lower/upper) or 4, timing is ntsc, pal, multi or dendy.
+//Entries in the file replace built in entries with the same CRC. The tables are sorted once and searched with a
+//binary search, so a lookup costs well under a microsecond.
+namespace RomDatabase
+{
+    const char* const OVERRIDE_FILE = "romdb.txt";
+
+    //nullptr for ROMs the database does not know
+    const RomDatabaseEntry* find(uint32_t crc, const std::string& rom_filename);
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+//Read-only image of a ROM file. Every open() of the same unchanged file returns the same image for as long as
+//someone holds it, so instances running one game share PRG/CHR.
+//On Windows the file is memory mapped, which keeps it from being truncated or deleted while the image lives, but a
+//program writing into the file in place changes the running game's ROM. Elsewhere, and when mapping fails, the
+//file is read into memory once: mapping it there would raise SIGBUS on the first access after the file shrinks.
+class RomImage
+{
+    public:
+        static std::shared_ptr<RomImage> open(const std::string& filename, std::string& error);
+        ~RomImage();
+
+        RomImage(const RomImage&) = delete;
+        RomImage& operator=(const RomImage&) = delete;
+
+        const uint8_t* data() const
+        {
+            return bytes;
+        }
+        size_t size() const
+        {
+            return length;
+        }
+
+    private:
+        RomImage() = default;
+        bool map(const std::string& filename, std::string& error);
+
+        const uint8_t* bytes = nullptr;
+        size_t length = 0;
+        bool mapped = false;
+        std::vector<uint8_t> fallback;
+#ifdef _WIN32
+        void* mapping_handle = nullptr;
+#endif
+};
@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Battery backed RAM persisted to a .sav file. The emulation thread mirrors every RAM write here and marks
+//its 256 byte page dirty, a background thread writes only the dirty pages back and syncs the file to disk
+//every FLUSH_INTERVAL_MS and once more on close, so a crash loses at most that much play.
+class SaveFile
+{
+    public:
+        static const int PAGE_SIZE = 0x100;
+        static const int FLUSH_INTERVAL_MS = 500;
+
+        //Opens or creates the file. Existing contents are loaded, shorter files are zero padded
+        static std::unique_ptr<SaveFile> open(const std::string& filename, size_t size);
+        ~SaveFile();
+
+        SaveFile(const SaveFile&) = delete;
+        SaveFile& operator=(const SaveFile&) = delete;
+
+        size_t size() const
+        {
+            return contents.size();
+        }
+
+        uint8_t read(uint32_t address) const
+        {
+            return contents[address].load(std::memory_order_relaxed);
+        }
+
+        //Called by the emulation thread only, never waits for the disk
+        void write(uint32_t address, uint8_t value)
+        {
+            contents[address].store(value, std::memory_order_relaxed);
+            uint32_t page = address / PAGE_SIZE;
+            dirty[page / 64].fetch_or(1ull << (page % 64), std::memory_order_release);
+        }
+
+    private:
+        SaveFile() = default;
+        void flush_loop();
+        void flush();
+
+        std::FILE* file = nullptr;
+        std::vector<std::atomic<uint8_t>> contents;
+        std::vector<std::atomic<uint64_t>> dirty;
+        std::vector<uint8_t> page_buffer;
+
+        std::thread flusher;
+        std::mutex stop_mutex;
+        std::condition_variable stop_signal;
+        bool stopping = false;
+};
@@ -6,13 +6,16 @@ class Cartridge;
 class SxROM : public Mapper
 {
     public:
-        SxROM(int n_prg_rom_banks, int n_chr_rom_banks, std::shared_ptr<Cartridge> cart);
+        SxROM(uint32_t prg_rom_size, uint32_t chr_size, std::shared_ptr<Cartridge> cart);
         ~SxROM() override { };
-        uint32_t cpu_reads(uint16_t address);
-        uint32_t ppu_reads(uint16_t address);
         void cpu_writes(uint16_t address, uint8_t value);
+        void copy_state(const Mapper& other) override
+        {
+            *this = static_cast<const SxROM&>(other);
+        }
         void update_state();
     private:
+        void update_banks();
         uint8_t load_register;
         uint8_t control ;
         uint8_t chr_bank_0;
@@ -0,0 +1,163 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Binary CPU trace. The emulation thread pushes one fixed size record per instruction into a single
+//producer / single consumer ring, a background thread delta-compresses the records and writes them out.
+//tools/trace_dump renders a trace file as nestest style text, tools/cpu_diff compares two of them.
+//
+//File layout: TRACE_MAGIC, version byte, record size byte, then per record a TRACE_MASK_BYTES bitmask
+//of the bytes that differ from the previous record followed by the new value of each of those bytes.
+
+const char TRACE_MAGIC[8] = {'C', 'A', 'L', 'T', 'R', 'A', 'C', 'E'};
+const uint8_t TRACE_VERSION = 1;
+const int TRACE_MASK_BYTES = 3;
+
+#pragma pack(push, 1)
+struct TraceRecord
+{
+    uint64_t cycle; //CPU cycles since power on
+    uint16_t PC;
+    uint8_t opcode;
+    uint8_t operands[2];
+    uint8_t A;
+    uint8_t X;
+    uint8_t Y;
+    uint8_t P;
+    uint8_t SP;
+    uint16_t scanline;
+    uint16_t dot;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(TraceRecord) <= TRACE_MASK_BYTES * 8, "the change mask must cover every byte of a record");
+
+class TraceRecorder
+{
+    public:
+        TraceRecorder();
+        ~TraceRecorder();
+
+        bool start(const std::string& filename);
+        void stop();
+        bool is_recording()
+        {
+            return recording;
+        }
+
+        //Called by the emulation thread only. Waits for the writer instead of dropping records
+        void record(const TraceRecord& entry)
+        {
+            size_t position = head.load(std::memory_order_relaxed);
+            while(position - tail.load(std::memory_order_acquire) == RING_SIZE)
+                std::this_thread::yield();
+
+            ring[position & (RING_SIZE - 1)] = entry;
+            head.store(position + 1, std::memory_order_release);
+        }
+
+        uint64_t get_records_written()
+        {
+            return records_written.load(std::memory_order_relaxed);
+        }
+
+    private:
+        static const size_t RING_SIZE = 1 << 16;
+        static const size_t FLUSH_SIZE = 1 << 16;
+
+        std::vector<TraceRecord> ring;
+        std::atomic<size_t> head{0};
+        std::atomic<size_t> tail{0};
+        std::atomic<bool> running{false};
+        std::atomic<uint64_t> records_written{0};
+        bool recording = false;
+
+        std::thread writer;
+        std::ofstream file;
+
+        void write_loop();
+};
+
+//Reads a trace file back one record at a time, header only so the tools need none of the core
+class TraceReader
+{
+    public:
+        //False when the file can't be read or isn't a trace of this version, get_error says which
+        bool open(const std::string& filename)
+        {
+            std::ifstream file(filename, std::ios::binary);
+            data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            position = sizeof(TRACE_MAGIC) + 2;
+            records_read = 0;
+            truncated = false;
+            std::memset(&current, 0, sizeof(current));
+            if(data.size() < position || std::memcmp(data.data(), TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0)
+            {
+                error = filename + " is not a trace file";
+                return false;
+            }
+            if(data[sizeof(TRACE_MAGIC)] != TRACE_VERSION || data[sizeof(TRACE_MAGIC) + 1] != sizeof(TraceRecord))
+            {
+                error = "unsupported trace version " + std::to_string(data[sizeof(TRACE_MAGIC)]);
+                return false;
+            }
+            return true;
+        }
+
+        //False at the end of the trace, or when it stops in the middle of a record (see is_truncated)
+        bool next(TraceRecord& entry)
+        {
+            if(position + TRACE_MASK_BYTES > data.size())
+                return false;
+
+            const uint8_t* mask = &data[position];
+            size_t end = position + TRACE_MASK_BYTES;
+            uint8_t* bytes = reinterpret_cast<uint8_t*>(&current);
+            for(size_t i = 0; i < sizeof(TraceRecord); i++)
+            {
+                if(mask[i / 8] & (1 << (i % 8)))
+                {
+                    if(end >= data.size())
+                    {
+                        truncated = true;
+                        position = data.size();
+                        return false;
+                    }
+                    bytes[i] = data[end++];
+                }
+            }
+            position = end;
+            records_read++;
+            entry = current;
+            return true;
+        }
+
+        bool is_truncated()
+        {
+            return truncated;
+        }
+
+        uint64_t get_records_read()
+        {
+            return records_read;
+        }
+
+        const std::string& get_error()
+        {
+            return error;
+        }
+
+    private:
+        std::vector<uint8_t> data;
+        size_t position = 0;
+        TraceRecord current;
+        uint64_t records_read = 0;
+        bool truncated = false;
+        std::string error;
+};
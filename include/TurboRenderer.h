@@ -0,0 +1,67 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "PPULog.h"
+
+//Draws fast-forwarded frames on a pool of threads. Unlike the pipelined PPU no frame depends on the one before:
+//a job is a copy of the PPU and CHR taken at the start of a frame plus the log of that frame, so the workers draw
+//as many frames at once as there are of them. A frame only becomes a job when a worker is free, the others run
+//on the timing only PPU and are never drawn. What is shown is the newest frame finished
+class TurboRenderer
+{
+    public:
+        explicit TurboRenderer(int workers);
+        ~TurboRenderer();
+
+        //At the start of a frame, claims a free worker and copies the state the frame starts from.
+        //False when every worker is busy, the frame is then not drawn
+        bool begin_frame(const PPU& ppu, const Cartridge& cart);
+        //Hands the frame begun last, logged up to end_dot, to its worker and leaves log empty
+        void end_frame(PPULog& log, uint32_t end_dot);
+        //Gives the worker back, the frame begun last did not run to its end
+        void cancel_frame();
+        //Waits until every frame handed over is drawn
+        void wait();
+        //Takes the newest frame drawn since the last call into get_frame, false when there is none
+        bool collect();
+        std::vector<uint32_t>& get_frame()
+        {
+            return frame;
+        }
+        int get_workers()
+        {
+            return static_cast<int>(workers.size());
+        }
+
+    private:
+        enum State { IDLE, CLAIMED, DRAWING };
+        struct Worker
+        {
+            PPUFollower follower;
+            PPULog log;
+            uint32_t end_dot = 0;
+            uint64_t sequence = 0;
+            State state = IDLE;
+            std::thread thread;
+        };
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        Worker* claimed = nullptr;
+        uint64_t next_sequence = 1;
+
+        std::vector<uint32_t> frame;
+        std::vector<uint32_t> newest; //Newest drawn frame, swapped out of the worker that drew it
+        uint64_t newest_sequence = 0;
+        bool newest_taken = true;
+
+        std::mutex mutex;
+        std::condition_variable work_ready;
+        std::condition_variable work_done;
+        bool quit = false;
+
+        void run(Worker& worker);
+};
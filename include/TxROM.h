@@ -6,12 +6,16 @@ class Cartridge;
 class TxROM : public Mapper
 {
     public:
-        TxROM(int n_prg_rom_banks, int n_chr_rom_banks, std::shared_ptr<Cartridge> cart);
+        TxROM(uint32_t prg_rom_size, uint32_t chr_size, std::shared_ptr<Cartridge> cart);
         ~TxROM() override { };
-        uint32_t cpu_reads(uint16_t address);
-        uint32_t ppu_reads(uint16_t address);
         void cpu_writes(uint16_t address, uint8_t value);
+        void copy_state(const Mapper& other) override
+        {
+            *this = static_cast<const TxROM&>(other);
+        }
+        void A12_rising() override;
     private:
+        void update_banks();
         uint8_t select_bank;
         uint8_t R0;
         uint8_t R1;
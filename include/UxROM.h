@@ -5,11 +5,11 @@ class Cartridge;
 class UxROM : public Mapper
 {
     public:
-        UxROM(int n_prg_rom_banks, int n_chr_rom_banks, std::shared_ptr<Cartridge> cart) : Mapper(n_prg_rom_banks, n_chr_rom_banks, cart) {};
+        UxROM(uint32_t prg_rom_size, uint32_t chr_size, std::shared_ptr<Cartridge> cart);
         ~UxROM() override { };
-        uint32_t cpu_reads(uint16_t address);
-        uint32_t ppu_reads(uint16_t address);
         void cpu_writes(uint16_t address, uint8_t value);
-    private:
-        uint8_t bank_number = 0;
-};
\ No newline at end of file
+        void copy_state(const Mapper& other) override
+        {
+            *this = static_cast<const UxROM&>(other);
+        }
+};
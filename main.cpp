@@ -1,4 +1,5 @@
 // Standard Library Headers
+#include <algorithm>
 #include <atomic>
 #include <cmath>
 #include <filesystem>
@@ -9,6 +10,7 @@
 
 // NES Emulator Components
 #include "NES.h"
+#include "Profiler.h"
 
 // UI and Rendering
 #include "imgui.h"
@@ -57,6 +59,33 @@ SDL_AudioDeviceID audio_device = 0;
 // Gerenciamento de FPS
 double desired_fps = 60.0;
 std::atomic<double> frame_time = 1000.0 / desired_fps;
+
+// Fast-forward: run unthrottled and only compose 1 in N frames
+constexpr int FAST_FORWARD_RENDER_INTERVAL = 4;
+std::atomic<bool> fast_forward(false);
+// Turbo: fast-forward frames are drawn by a pool of threads while the emulation runs the PPU for timing only,
+// the pool draws what it keeps up with and the newest frame is shown
+std::atomic<bool> turbo_fast_forward(false);
+const int TURBO_WORKERS = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+
+// Idle loop skipping, with its counters published for the menu. Off until the conformance suite runs with it too
+std::atomic<bool> skip_idle_loops(false);
+std::atomic<uint64_t> idle_loops_detected(0);
+std::atomic<uint64_t> idle_cycles_replayed(0);
+std::atomic<uint64_t> idle_cycles_skipped(0);
+
+// Pipelined PPU: frames are drawn on a second thread, one frame behind the emulation
+std::atomic<bool> pipelined_ppu(false);
+
+// Trace binário da CPU, convertido em texto com tools/trace_dump
+const char* TRACE_FILENAME = "calascio_trace.bin";
+std::atomic<bool> trace_cpu(false);
+
+// Recording to calascio_capture.y4m and calascio_capture.wav, frames the disk can't keep up with are dropped
+const char* CAPTURE_FILENAME = "calascio_capture";
+std::atomic<bool> capture_av(false);
+std::atomic<uint64_t> capture_frames_dropped(0);
+
 int FPS;
 int padding = 0; // Altura da barra de menu ImGui
 
@@ -143,6 +172,7 @@ int SDL_main(int argc, char* argv[]) {
         SDL_Log("Please create the folder and place a ROM named 'default.nes' inside.");
     }
 
+    PROFILE_EXPORT_START("calascio_profile.json");
     std::thread emulation_thread(emulate_nes, &nes);
 
     // Medir altura da barra de menu uma vez
@@ -176,6 +206,7 @@ int SDL_main(int argc, char* argv[]) {
     }
 
     emulation_thread.join();
+    PROFILE_EXPORT_STOP();
     cleanupImGui();
     SDL_DestroyTexture(screenBuffer);
     SDL_DestroyRenderer(renderer);
@@ -193,13 +224,42 @@ void emulate_nes(NES* nes) {
         auto frame_time_ms = duration<double, std::milli>(frame_time);
         auto frame_start = high_resolution_clock::now();
 
+        bool turbo = fast_forward && turbo_fast_forward;
+        nes->set_render_interval((fast_forward && !turbo) ? FAST_FORWARD_RENDER_INTERVAL : 1);
+        if (nes->get_turbo_render() != (turbo ? TURBO_WORKERS : 0)) {
+            nes->set_turbo_render(turbo ? TURBO_WORKERS : 0);
+        }
+        if (nes->get_idle_skip() != skip_idle_loops) {
+            nes->set_idle_skip(skip_idle_loops);
+        }
+        if (nes->get_pipelined_ppu() != pipelined_ppu) {
+            nes->set_pipelined_ppu(pipelined_ppu);
+        }
+        if (nes->is_tracing() != trace_cpu) {
+            if (trace_cpu) {
+                if (!nes->start_trace(TRACE_FILENAME)) trace_cpu = false;
+            } else {
+                nes->stop_trace();
+            }
+        }
+        if (nes->is_capturing() != capture_av) {
+            if (capture_av) {
+                if (!nes->start_capture(CAPTURE_FILENAME, MediaCapture::Y4M)) capture_av = false;
+            } else {
+                nes->stop_capture();
+            }
+        }
         if (nes->is_game_loaded()) {
             nes->run_frame();
         }
+        idle_loops_detected = nes->get_idle_loops_detected();
+        idle_cycles_replayed = nes->get_idle_cycles_replayed();
+        idle_cycles_skipped = nes->get_idle_cycles_skipped();
+        capture_frames_dropped = nes->get_capture_frames_dropped();
 
-        {
+        if (nes->is_frame_rendered()) {
             std::lock_guard<std::mutex> lock(framebuffer_mutex);
-            screen = nes->get_ppu()->get_screen();
+            screen = nes->get_screen();
         }
 
         frame_count++;
@@ -214,7 +274,7 @@ void emulate_nes(NES* nes) {
         auto elapsed = duration<double, std::milli>(frame_end - frame_start);
         auto remaining_time = frame_time_ms - elapsed;
 
-        if (remaining_time.count() > 1) {
+        if (!fast_forward && remaining_time.count() > 1) {
             SDL_Delay(static_cast<Uint32>(remaining_time.count() - 1));
         }
     }
@@ -394,12 +454,42 @@ void handle_imGui(NES* nes) {
             if (ImGui::MenuItem("Reset")) {
                 if (nes->is_game_loaded()) nes->reload_game();
             }
+            bool ff = fast_forward;
+            if (ImGui::MenuItem("Fast-forward", nullptr, ff)) {
+                fast_forward = !ff;
+            }
+            bool turbo = turbo_fast_forward;
+            if (ImGui::MenuItem("Turbo fast-forward", nullptr, turbo)) {
+                turbo_fast_forward = !turbo;
+            }
             ImGui::EndMenu();
         }
         if(ImGui::BeginMenu("Settings")) {
             if (ImGui::MenuItem("Toggle Zapper")) {
                 nes->alternate_zapper();
             }
+            bool skip = skip_idle_loops;
+            if (ImGui::MenuItem("Skip idle loops", nullptr, skip)) {
+                skip_idle_loops = !skip;
+            }
+            ImGui::TextDisabled("Idle loops: %llu, cycles skipped: %llu, replayed: %llu",
+                                (unsigned long long)idle_loops_detected, (unsigned long long)idle_cycles_skipped,
+                                (unsigned long long)idle_cycles_replayed);
+            bool pipelined = pipelined_ppu;
+            if (ImGui::MenuItem("Pipelined PPU", nullptr, pipelined)) {
+                pipelined_ppu = !pipelined;
+            }
+            bool tracing = trace_cpu;
+            if (ImGui::MenuItem("Trace CPU", nullptr, tracing)) {
+                trace_cpu = !tracing;
+            }
+            bool recording = capture_av;
+            if (ImGui::MenuItem("Record video", nullptr, recording)) {
+                capture_av = !recording;
+            }
+            if (recording) {
+                ImGui::TextDisabled("Frames dropped: %llu", (unsigned long long)capture_frames_dropped);
+            }
             ImGui::EndMenu();
         }
 
@@ -408,6 +498,34 @@ void handle_imGui(NES* nes) {
 
         ImGui::EndMainMenuBar();
     }
+
+#ifdef CALASCIO_PROFILE
+    // Overlay do profiler, atualizado uma vez por segundo
+    Profiler::Report report;
+    if (Profiler::get_report(report)) {
+        ImGui::SetNextWindowPos(ImVec2(10, padding + 10), ImGuiCond_FirstUseEver);
+        ImGui::SetNextWindowBgAlpha(0.6f);
+        ImGui::Begin("Profiler", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+        if (ImGui::BeginTable("zones", 5)) {
+            ImGui::TableSetupColumn("Zone");
+            ImGui::TableSetupColumn("calls/s");
+            ImGui::TableSetupColumn("ms/s");
+            ImGui::TableSetupColumn("mean ns");
+            ImGui::TableSetupColumn("p99 ns");
+            ImGui::TableHeadersRow();
+            for (const Profiler::ZoneReport& zone : report.zones) {
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn(); ImGui::TextUnformatted(zone.name);
+                ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)zone.calls);
+                ImGui::TableNextColumn(); ImGui::Text("%.1f", zone.total_ms);
+                ImGui::TableNextColumn(); ImGui::Text("%.0f", zone.mean_ns);
+                ImGui::TableNextColumn(); ImGui::Text("%.0f", zone.p99_ns);
+            }
+            ImGui::EndTable();
+        }
+        ImGui::End();
+    }
+#endif
 }
 
 // Uma última modificação necessária é no arquivo Bus.cpp.
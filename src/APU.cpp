@@ -1,5 +1,6 @@
 #include "APU.h"
 #include "Bus.h"
+#include "Profiler.h"
 #include <cmath>
 
 
@@ -184,7 +185,7 @@ void APU::cpu_writes(uint16_t address, uint8_t value)
             if (!(value & 0x02)) pulse2.length_counter_load = 0;
             if (!(value & 0x04)) triangle.length_counter_load = 0;
             if (!(value & 0x8)) noise.length_counter_load = 0;
-            //TODO: Fix this, this should reload the sample if bits_remaining are zero, if they are not zero it should wait until they arent
+            //Restarting only reloads the memory reader, the output unit finishes its current byte
             if (value & 0x10)
             {
                 if(dmc.bytes_remaining == 0)
@@ -210,7 +211,7 @@ void APU::cpu_writes(uint16_t address, uint8_t value)
                 bus->ack_irq(Frame_IRQ);
             }
 
-            if(ceil(apu_cycles_counter) == apu_cycles_counter)
+            if((apu_half_cycles & 1) == 0)
                 delay_write_to_frame_counter = 3;
             else
                 delay_write_to_frame_counter = 4;
@@ -254,50 +255,66 @@ e e e e    e e e - e    Envelope and linear counter
 either 4 or 5 steps depending on bit 6 of frame counter ($4017)
 */
 
+//Frame sequencer steps and frame IRQ window, in half APU cycles
+template <bool PAL>
+struct FrameCounterTiming;
+
+template <>
+struct FrameCounterTiming<false>
+{
+    static constexpr uint32_t steps[5] = {7457, 14913, 22371, 29829, 37281};
+    static constexpr uint32_t irq = 29828;
+};
+
+template <>
+struct FrameCounterTiming<true>
+{
+    static constexpr uint32_t steps[5] = {8313, 16627, 24939, 33253, 41565};
+    static constexpr uint32_t irq = 33252;
+};
+
+template <bool PAL>
 void APU::tick()
 {
-    apu_cycles_counter += 0.5;
-    if(!region) // NTSC mode
-    {   
-        if((apu_cycles_counter == 14914 || apu_cycles_counter == 14914.5 || apu_cycles_counter == 0) && !inhibit_flag && !sequence_mode)
-        {
-            frame_interrupt = true;
-        }
+    PROFILE_ZONE(ZONE_APU_TICK);
+    using Timing = FrameCounterTiming<PAL>;
+    apu_half_cycles++;
 
-        if(apu_cycles_counter == 3728.5 || apu_cycles_counter == 7456.5 || apu_cycles_counter == 11185.5 ||
-            apu_cycles_counter == 14914.5 || apu_cycles_counter == 18640.5)
-        {
-            tick_frame_counter();  
-        }
-    }
-    else
+    //NTSC raises the frame IRQ flag before clocking the sequencer and PAL after it, so on PAL the
+    //counter reset done by the last step also raises it
+    auto check_frame_interrupt = [this]()
     {
-        if(apu_cycles_counter == 4156.5 || apu_cycles_counter == 8313.5 || apu_cycles_counter == 12469.5 ||
-            apu_cycles_counter == 16626.5 || apu_cycles_counter == 20782.5)
-        {
-            tick_frame_counter();  
-        }
-
-        if((apu_cycles_counter == 16626 || apu_cycles_counter == 16626.5 || apu_cycles_counter == 0) && !inhibit_flag && !sequence_mode)
-        {
+        if((apu_half_cycles == Timing::irq || apu_half_cycles == Timing::irq + 1 || apu_half_cycles == 0) && !inhibit_flag && !sequence_mode)
             frame_interrupt = true;
-        }
+    };
+
+    if constexpr(!PAL)
+        check_frame_interrupt();
+
+    if(apu_half_cycles == Timing::steps[0] || apu_half_cycles == Timing::steps[1] || apu_half_cycles == Timing::steps[2] ||
+        apu_half_cycles == Timing::steps[3] || apu_half_cycles == Timing::steps[4])
+    {
+        tick_frame_counter();  
     }
 
+    if constexpr(PAL)
+        check_frame_interrupt();
+
     //Every apu cycle...
-    if(ceil(apu_cycles_counter) == apu_cycles_counter)
+    if((apu_half_cycles & 1) == 0)
         tick_timers();
     
 
-    //On every cpu cycle clock triangle's timer
+    //On every cpu cycle clock triangle's timer and the DMC
     tick_triangle_timer();
+    tick_dmc();
 
 
     delay_write_to_frame_counter--;
     if(delay_write_to_frame_counter == 0 && reset)
     {
         sequence_step = 0.0;
-        apu_cycles_counter = 0.0;
+        apu_half_cycles = 0;
         reset = false;
         if(sequence_mode)
         {
@@ -309,70 +326,87 @@ void APU::tick()
     }
 }
 
+template void APU::tick<false>();
+template void APU::tick<true>();
+
 void APU::tick_dmc()
 {
-    //DMC Memory read
+    //Memory reader: an empty buffer asks the CPU for the next byte, the CPU halts to fetch it
+    //and hands it back through dmc_dma_complete
+    if(dmc.sample_buffer_empty && dmc.bytes_remaining > 0 && !dmc.dma_pending)
+    {
+        dmc.dma_pending = true;
+        bus->request_dmc_dma(dmc.current_address);
+    }
 
-    if((dmc.sample_buffer == 0) && (dmc.bytes_remaining > 0))
+    //Output unit
+    if(dmc.timer_divider > 0)
     {
-       // bus->trigger_dmc_dma(dmc.current_address, 0); //0 : reload, 1 : load
-        //dmc.sample_buffer = 0xff;
-        if(dmc.current_address == 0xFFFF)
-            dmc.current_address = 0x8000;
+        dmc.timer_divider--;
+        return;
+    }
+    dmc.timer_divider = dmc.rate - 1;
+
+    if(!dmc.silence)
+    {
+        if(dmc.shift_register & 1)
+        {
+            if(dmc.output_level <= 125)
+                dmc.output_level += 2;
+        }
         else
-            dmc.current_address++;
-        dmc.bytes_remaining--;
-        if(dmc.bytes_remaining == 0 && dmc.loop)
         {
-            //sample restarted
-            dmc.current_address = dmc.sample_address;
-            dmc.bytes_remaining = dmc.sample_length;
+            if(dmc.output_level >= 2)
+                dmc.output_level -= 2;
         }
-        else if(dmc.bytes_remaining == 0 && dmc.IRQ)
-            dmc.interrupt_flag = true;
     }
+    dmc.shift_register >>= 1;
 
-
-    // DMC Output Unit
-    if (dmc.timer_divider == 0)
+    if(dmc.bits_remaining > 0)
+        dmc.bits_remaining--;
+    if(dmc.bits_remaining == 0)
     {
-        dmc.timer_divider = dmc.rate;
+        //New output cycle
+        dmc.bits_remaining = 8;
+        dmc.silence = dmc.sample_buffer_empty;
+        if(!dmc.sample_buffer_empty)
+        {
+            dmc.shift_register = dmc.sample_buffer;
+            dmc.sample_buffer_empty = true;
+        }
+    }
+}
+
+void APU::dmc_dma_complete(uint8_t value)
+{
+    dmc.dma_pending = false;
+    dmc.sample_buffer = value;
+    dmc.sample_buffer_empty = false;
+
+    //$4015 may have stopped the sample while the CPU was fetching
+    if(dmc.bytes_remaining == 0)
+        return;
 
-        if (!dmc.silence)
+    if(dmc.current_address == 0xFFFF)
+        dmc.current_address = 0x8000;
+    else
+        dmc.current_address++;
+    dmc.bytes_remaining--;
+
+    if(dmc.bytes_remaining == 0)
+    {
+        if(dmc.loop)
         {
-            if (dmc.shift_register & 1)
-            {
-                if (dmc.output_level <= 125)
-                    dmc.output_level += 2;
-            }
-            else
-            {
-                if (dmc.output_level >= 2)
-                    dmc.output_level -= 2;
-            }
+            //sample restarted
+            dmc.current_address = dmc.sample_address;
+            dmc.bytes_remaining = dmc.sample_length;
         }
-        
-        dmc.shift_register >>= 1;
-        dmc.bits_remaining--;
-        
-        if (dmc.bits_remaining == 0)
+        else if(dmc.IRQ)
         {
-            dmc.bits_remaining = 8;
-            if (dmc.sample_buffer == 0)
-            {
-                dmc.silence = true;
-            }
-            else
-            {
-                dmc.silence = false;
-                dmc.shift_register = dmc.sample_buffer;
-                dmc.sample_buffer = 0;
-            }
+            dmc.interrupt_flag = true;
+            bus->assert_irq(DMC_IRQ);
         }
     }
-    
-    else
-        dmc.timer_divider--; 
 }
 
 void APU::tick_frame_counter()
@@ -410,7 +444,7 @@ void APU::tick_frame_counter()
                 tick_linear_counter();
                 tick_sweep();
                 sequence_step = 0;
-                apu_cycles_counter = 0.0;
+                apu_half_cycles = 0;
             }
             break;
         case 4:
@@ -420,7 +454,7 @@ void APU::tick_frame_counter()
             tick_sweep();
                 
             sequence_step = 0;
-            apu_cycles_counter = 0.0;
+            apu_half_cycles = 0;
             break;
     }
 }
@@ -627,10 +661,6 @@ void APU::tick_sweep()
     }
 }
 
-double prev_output_hp_90 = 0;
-double prev_output_hp_440 = 0;
-double prev_output_lp_14000 = 0;
-
 double high_pass_filter(double input, double& prev_output, double cutoff_freq, double sample_rate = 44100.0) 
 {
     double alpha = 1.0 / (1.0 + (2.0 * M_PI * cutoff_freq / sample_rate));
@@ -658,6 +688,7 @@ double APU::get_output()
     float noise_sample = 0;
     float triangle_output = 0;
     float noise_output = 0;
+    float dmc_output = 0;
 
     //Calculate pulses output
     if(pulse1.sequencer_output == 1 && pulse1.target_period <= 0x7FF && pulse1.timer >= 8 && pulse1.length_counter_load > 0 && (status_register & 0x1))
@@ -695,8 +726,11 @@ double APU::get_output()
     if(noise_sample != 0)
         noise_output = noise_sample / 12241;
 
-    if((noise_output != 0) || (triangle_output != 0))
-        tnd_output = 159.79 / ((1.0 / (triangle_output + noise_output)) + 100.0);
+    if(dmc.output_level != 0)
+        dmc_output = dmc.output_level / 22638.0;
+
+    if((noise_output != 0) || (triangle_output != 0) || (dmc_output != 0))
+        tnd_output = 159.79 / ((1.0 / (triangle_output + noise_output + dmc_output)) + 100.0);
 
     
     // Apply the filters:
@@ -716,6 +750,7 @@ void APU::connect_bus(std::shared_ptr<Bus> bus)
 void APU::set_timing(bool value)
 {
     region = value;
+    dmc.rate = region ? pal_dpcm_period[dmc.rate_index] : ntsc_dpcm_period[dmc.rate_index];
 }
 
 void APU::soft_reset()
@@ -787,6 +822,9 @@ void APU::soft_reset()
     noise.shift_register = 1;
     noise.feedback = 0;
 
+    // Reset DMC state, a fetch still in flight is dropped by the CPU reset
+    dmc = DMC();
+
     // Reset APU control state
     status_register = 0;
     sequence_mode = false;
@@ -796,7 +834,7 @@ void APU::soft_reset()
     reset = false;
 
     // Reset APU cycle counter
-    apu_cycles_counter = 0.0;
+    apu_half_cycles = 0;
 
     // Reset all lookup tables and sequences
     region = 0;
@@ -0,0 +1,143 @@
+#include "BlockCache.h"
+#include <array>
+
+namespace
+{
+    struct OpcodeInfo
+    {
+        uint8_t mode;
+        uint8_t access;
+    };
+
+    //Official opcodes that can run decoded. BRK, RTI, PLP, CLI and SEI change the I flag that interrupt polls
+    //depend on and stay with the interpreter, like the unofficial opcodes
+    constexpr std::array<OpcodeInfo, 256> make_opcode_table()
+    {
+        using B = BlockCache;
+        std::array<OpcodeInfo, 256> table{};
+        for(OpcodeInfo& info : table)
+            info = {B::INTERPRET, B::NONE};
+
+        //The eight ALU groups share the cc = 01 layout
+        const uint8_t alu[8] = {0x00, 0x20, 0x40, 0x60, 0x80, 0xA0, 0xC0, 0xE0}; //ORA AND EOR ADC STA LDA CMP SBC
+        for(uint8_t base : alu)
+        {
+            uint8_t access = (base == 0x80) ? B::WRITE : B::READ;
+            table[base | 0x01] = {B::IZX, access};
+            table[base | 0x05] = {B::ZP, access};
+            if(base != 0x80)
+                table[base | 0x09] = {B::IMM, access};
+            table[base | 0x0D] = {B::ABS, access};
+            table[base | 0x11] = {B::IZY, access};
+            table[base | 0x15] = {B::ZPX, access};
+            table[base | 0x19] = {B::ABY, access};
+            table[base | 0x1D] = {B::ABX, access};
+        }
+
+        //ASL ROL LSR ROR INC DEC, the shifts also work on the accumulator
+        const uint8_t modify[6] = {0x00, 0x20, 0x40, 0x60, 0xE0, 0xC0};
+        for(int i = 0; i < 6; i++)
+        {
+            uint8_t base = modify[i];
+            table[base | 0x06] = {B::ZP, B::MODIFY};
+            table[base | 0x0E] = {B::ABS, B::MODIFY};
+            table[base | 0x16] = {B::ZPX, B::MODIFY};
+            table[base | 0x1E] = {B::ABX, B::MODIFY};
+            if(i < 4)
+                table[base | 0x0A] = {B::IMP, B::NONE};
+        }
+
+        //LDX LDY STX STY and the compares on X and Y
+        table[0xA2] = {B::IMM, B::READ}; table[0xA6] = {B::ZP, B::READ}; table[0xB6] = {B::ZPY, B::READ};
+        table[0xAE] = {B::ABS, B::READ}; table[0xBE] = {B::ABY, B::READ};
+        table[0xA0] = {B::IMM, B::READ}; table[0xA4] = {B::ZP, B::READ}; table[0xB4] = {B::ZPX, B::READ};
+        table[0xAC] = {B::ABS, B::READ}; table[0xBC] = {B::ABX, B::READ};
+        table[0x86] = {B::ZP, B::WRITE}; table[0x96] = {B::ZPY, B::WRITE}; table[0x8E] = {B::ABS, B::WRITE};
+        table[0x84] = {B::ZP, B::WRITE}; table[0x94] = {B::ZPX, B::WRITE}; table[0x8C] = {B::ABS, B::WRITE};
+        table[0xE0] = {B::IMM, B::READ}; table[0xE4] = {B::ZP, B::READ}; table[0xEC] = {B::ABS, B::READ};
+        table[0xC0] = {B::IMM, B::READ}; table[0xC4] = {B::ZP, B::READ}; table[0xCC] = {B::ABS, B::READ};
+        table[0x24] = {B::ZP, B::READ}; table[0x2C] = {B::ABS, B::READ};
+
+        //Branches
+        for(int opcode = 0x10; opcode < 0x100; opcode += 0x20)
+            table[opcode] = {B::REL, B::NONE};
+
+        //Jumps, the stack, transfers, increments and flags
+        table[0x4C] = {B::ABS, B::NONE}; table[0x6C] = {B::IND, B::NONE};
+        table[0x20] = {B::ABS, B::NONE}; table[0x60] = {B::IMP, B::NONE};
+        const uint8_t implied[] = {0x48, 0x08, 0x68, 0xAA, 0xA8, 0x8A, 0x98, 0x9A, 0xBA, 0xCA, 0x88, 0xE8, 0xC8,
+                                   0x18, 0x38, 0xB8, 0xD8, 0xF8, 0xEA};
+        for(uint8_t opcode : implied)
+            table[opcode] = {B::IMP, B::NONE};
+
+        return table;
+    }
+
+    constexpr std::array<OpcodeInfo, 256> opcode_table = make_opcode_table();
+
+    uint8_t instruction_length(uint8_t mode)
+    {
+        switch(mode)
+        {
+            case BlockCache::IMP: return 1;
+            case BlockCache::ABS: case BlockCache::ABX: case BlockCache::ABY: case BlockCache::IND: return 3;
+            default: return 2;
+        }
+    }
+
+    bool ends_block(uint8_t opcode)
+    {
+        return opcode_table[opcode].mode == BlockCache::REL
+            || opcode == 0x4C || opcode == 0x6C || opcode == 0x20 || opcode == 0x60;
+    }
+}
+
+const DecodedOp BlockCache::outside_rom = {0x00, BlockCache::INTERPRET, BlockCache::NONE, 1, 0x0000};
+
+void BlockCache::attach(const uint8_t* rom, uint32_t size)
+{
+    if(rom != this->rom || size != ops.size())
+    {
+        this->rom = rom;
+        ops.assign(rom ? size : 0, DecodedOp{0x00, UNDECODED, NONE, 0, 0x0000});
+    }
+    attached = true;
+}
+
+void BlockCache::clear()
+{
+    rom = nullptr;
+    ops.clear();
+    attached = false;
+}
+
+void BlockCache::decode_block(uint32_t offset)
+{
+    blocks_decoded++;
+    for(int count = 0; count < MAX_BLOCK_LENGTH && offset < ops.size() && ops[offset].mode == UNDECODED; count++)
+    {
+        DecodedOp& op = ops[offset];
+        op.opcode = rom[offset];
+        op.mode = opcode_table[op.opcode].mode;
+        op.access = opcode_table[op.opcode].access;
+        op.length = (op.mode == INTERPRET) ? 1 : instruction_length(op.mode);
+        op.operand = 0x0000;
+
+        //The operand bytes have to come from the same 8KB window, the next one may be mapped anywhere
+        uint32_t window_end = (offset | (0x2000 - 1)) + 1;
+        bool unknown_length = op.mode == INTERPRET;
+        if(!unknown_length && (offset + op.length > window_end || offset + op.length > ops.size()))
+            op.mode = INTERPRET;
+        else if(op.length >= 2)
+            op.operand = rom[offset + 1] | ((op.length == 3) ? rom[offset + 2] << 8 : 0);
+
+        //Absolute accesses to registers are known to need the interpreter already, the block goes on after them
+        if(op.mode == ABS && op.access != NONE && op.operand >= 0x2000
+           && (op.access != READ || op.operand < 0x6000))
+            op.mode = INTERPRET;
+
+        offset += op.length;
+        if(unknown_length || ends_block(op.opcode) || offset >= window_end)
+            break;
+    }
+}
@@ -3,6 +3,7 @@
 #include "CPU.h"
 #include "APU.h"
 #include "PPU.h"
+#include "PPULog.h"
 
 // --- MODIFICAÇÃO PARA ANDROID ---
 // Declara que a variável `controller_state` é global e está definida em outro arquivo (main.cpp).
@@ -24,7 +25,11 @@ uint8_t Bus::cpu_reads(uint16_t address)
     uint8_t data = 0x00;
 
     if (address >= 0x2000 && address < 0x4000)
+    {
         data = ppu->cpu_reads(address & 0x7);
+        if(ppu_log && ((address & 0x7) == 2 || (address & 0x7) == 7))
+            ppu_log->register_read(ppu->get_dot_clock(), address & 0x7);
+    }
     
     else if (address >= 0x4000 && address < 0x4018)
     {
@@ -86,7 +91,11 @@ uint8_t Bus::cpu_reads(uint16_t address)
 void Bus::cpu_writes(uint16_t address, uint8_t value)
 {
     if ((address >= 0x2000) && (address < 0x4000))
+    {
+        if(ppu_log)
+            ppu_log->register_write(ppu->get_dot_clock(), address & 0x7, value);
         ppu->cpu_writes((address & 0x7), value);
+    }
 
     else if ((address >= 0x4000) && (address < 0x4018))
     {
@@ -115,7 +124,11 @@ void Bus::cpu_writes(uint16_t address, uint8_t value)
     } 
 
     else if ((address >= 0x4020) && (address <= 0xFFFF))
-        cart->cpu_writes(address, value);   
+    {
+        cart->cpu_writes(address, value);
+        if(ppu_log && address >= 0x8000)
+            ppu_log->chr_banks_written(ppu->get_dot_clock(), *cart);
+    }
 }
 
 
@@ -140,6 +153,16 @@ void Bus::set_nmi(bool value)
     cpu->set_nmi(value);
 }
 
+int Bus::get_ppu_scanline()
+{
+    return ppu->get_scanline();
+}
+
+int Bus::get_ppu_dot()
+{
+    return ppu->get_dot();
+}
+
 bool Bus::is_new_instruction()
 {
     return cpu->is_new_instruction();
@@ -148,6 +171,7 @@ bool Bus::is_new_instruction()
 void Bus::soft_reset()
 {
     NMI = false;
+    IRQ_line = 0;
     shift_register_controller1 = shift_register_controller2 = 0x0000;
 }
 
@@ -195,19 +219,48 @@ uint8_t Bus::get_irq()
     return IRQ_line;
 }
 
-void Bus::set_irq_latch(uint8_t value)
+void Bus::request_dmc_dma(uint16_t address)
+{
+    cpu->request_dmc_dma(address);
+}
+
+//The DMC only reads $8000-$FFFF, so the byte comes straight from the PRG ROM page table
+void Bus::dmc_dma(uint16_t address)
 {
-    ppu->set_irq_latch(value);
+    apu->dmc_dma_complete(cart->read_prg_rom(address));
 }
 
-void Bus::set_irq_enable(bool value)
+const uint8_t* Bus::prg_rom_page(uint16_t address)
 {
-    ppu->set_irq_enable(value);
+    return cart->prg_rom_page(address);
 }
 
-void Bus::set_irq_reload()
+uint32_t Bus::prg_rom_offset(uint16_t address)
 {
-    ppu->set_irq_reload();
+    return cart->prg_rom_offset(address);
+}
+
+const uint8_t* Bus::get_prg_rom()
+{
+    return cart->get_prg_rom();
+}
+
+uint32_t Bus::get_prg_rom_size()
+{
+    return cart->get_prg_rom_size();
+}
+
+bool Bus::write_oam_page(const uint8_t* page, int dots)
+{
+    bool copied = ppu->write_oam_page(page, dots);
+    if(copied && ppu_log)
+        ppu_log->oam_page_copied(ppu->get_dot_clock(), page, dots);
+    return copied;
+}
+
+void Bus::A12_rising()
+{
+    cart->A12_rising();
 }
 
 void Bus::set_mapper(uint8_t value)
@@ -218,4 +271,11 @@ void Bus::set_mapper(uint8_t value)
 void Bus::set_mirroring_mode(MIRROR value)
 {
     ppu->set_mirroring_mode(value);
+    if(ppu_log)
+        ppu_log->mirroring_changed(ppu->get_dot_clock(), value);
+}
+
+void Bus::map_nametable(int page, uint8_t* memory)
+{
+    ppu->map_nametable(page, memory);
 }
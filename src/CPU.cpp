@@ -1,7 +1,11 @@
 #include "CPU.h"
+#include "ALU.h"
 #include "Bus.h"
+#include "Profiler.h"
 #include <sstream>
 #include <iomanip>
+#include <cstdio>
+#include <cstring>
 
 CPU::CPU()
 {
@@ -114,12 +118,31 @@ CPU::~CPU() {}
 
 void CPU::tick()
 {
+    PROFILE_ZONE(ZONE_CPU_TICK);
+    cycles++;
     get_cycle = !get_cycle;
+    //A stall freezes the idle loop replay too, the loop resumes where it was
+    if(dmc_dma_stage != DMC_DMA_IDLE && !reset_flag && dmc_dma_cycle())
+    {
+        if(probe)
+            probe->stall();
+        return;
+    }
+
+    if(idle_mode >= IDLE_RECORD && begin_idle_cycle())
+        return;
+
     if(reset_flag)
+    {
+        if(probe && n_cycles == 0)
+            report_begin(CPUProbe::RESET);
         reset();
+    }
 
     else if(oamdma_flag)
     {
+        if(probe)
+            probe->stall();
         if(halt_cycle)
             halt_cycle = false;
         else if(alignment_needed)
@@ -128,18 +151,47 @@ void CPU::tick()
             transfer_oam_bytes();  
     }   
     
+    else if(decoded_cycles) //The instruction already ran, only its polls are left
+    {
+        n_cycles++;
+        if(decoded_polls & (1 << n_cycles))
+            poll_interrupts();
+        if(n_cycles == decoded_cycles)
+        {
+            n_cycles = 0;
+            decoded_cycles = 0;
+        }
+    }
+
     else
     {
         if (n_cycles == 0)
         {
-            fetch();
-            if(Instr[opcode].cycles == 2) //2 cycles instructions poll at the end of the first cycle
-                poll_interrupts();
-            new_instruction = true;
+            if(trace && !NMI && !IRQ)
+                record_trace();
+            if(probe)
+                report_begin(NMI ? CPUProbe::NMI : IRQ ? CPUProbe::IRQ : CPUProbe::INSTRUCTION);
+            bool decodable = block_mode != BLOCKS_OFF && !NMI && !IRQ && idle_mode < IDLE_RECORD && !probe;
+            if(decodable && block_mode == BLOCKS_ON && run_decoded())
+            {
+                if(decoded_polls & 0x02)
+                    poll_interrupts();
+            }
+            else
+            {
+                if(decodable && block_mode == BLOCKS_VALIDATE)
+                    start_block_check();
+                fetch();
+                if(Instr[opcode].cycles == 2) //2 cycles instructions poll at the end of the first cycle
+                    poll_interrupts();
+                new_instruction = true;
+            }
         }
         
         else if(n_cycles < Instr[opcode].cycles)
         {
+            if(block_check.active)
+                block_check.interpreter_cycles++;
             (this->*Instr[opcode].function)();
             if(n_cycles == (Instr[opcode].cycles-1) && opcode != 0x00 && !branch_polled) // Poll interrupts during the second to last cycle. interrupts dont poll
                 poll_interrupts();                                                       //Branch instructions poll differently
@@ -151,12 +203,21 @@ void CPU::tick()
         {
             branch_polled = false;
             n_cycles = 0;
+            if(block_check.active)
+                finish_block_check();
         }   
     }
+
+    if(idle_mode >= IDLE_RECORD)
+        end_idle_cycle();
+    else if(idle_mode == IDLE_SEARCH && n_cycles == 0 && !reset_flag && !oamdma_flag
+            && PC <= instruction_address && instruction_address - PC <= IDLE_MAX_LOOP_BYTES) //Short backward jump
+        start_idle_record();
 }
 
 void CPU::fetch()
 {
+    instruction_address = PC;
     if(NMI)
         opcode = 0x00;
 
@@ -185,8 +246,223 @@ void CPU::fetch()
     n_cycles++;
 }
 
+//Runs the instruction at PC in one go from its decoded form and sets up the cycles and interrupt polls the handler
+//would have taken, by the same rules as the handlers. Returns false, with nothing changed, when the instruction has
+//to go through the interpreter: code outside PRG ROM, and any access to registers, which may have side effects or
+//depend on the exact cycle. Reads may hit RAM or cartridge memory, writes only RAM
+bool CPU::run_decoded()
+{
+    if(PC < 0x8000)
+        return false;
+    if(!block_cache.is_attached())
+        block_cache.attach(bus->get_prg_rom(), bus->get_prg_rom_size());
+    const DecodedOp& op = block_cache.lookup(bus->prg_rom_offset(PC));
+    if(op.mode == BlockCache::INTERPRET)
+        return false;
+
+    uint16_t address = op.operand;
+    bool page_crossed = false;
+    switch(op.mode)
+    {
+        case BlockCache::ZPX: address = (op.operand + X) & 0xFF; break;
+        case BlockCache::ZPY: address = (op.operand + Y) & 0xFF; break;
+        case BlockCache::ABX: address = op.operand + X; page_crossed = (address & 0xFF) < X; break;
+        case BlockCache::ABY: address = op.operand + Y; page_crossed = (address & 0xFF) < Y; break;
+        case BlockCache::IZX:
+        {
+            uint8_t pointer = op.operand + X;
+            address = memory[pointer] | (memory[(uint8_t)(pointer + 1)] << 8);
+            break;
+        }
+        case BlockCache::IZY:
+        {
+            address = (memory[op.operand] | (memory[(uint8_t)(op.operand + 1)] << 8)) + Y;
+            page_crossed = (address & 0xFF) < Y;
+            break;
+        }
+    }
+
+    if(op.access == BlockCache::READ || op.mode == BlockCache::IND)
+    {
+        if(address >= 0x2000 && address < 0x6000)
+            return false;
+    }
+    else if(op.access != BlockCache::NONE && address >= 0x2000)
+        return false;
+
+    //Indexed reads without a page crossing skip their last cycle, and with it the poll. The handlers expect
+    //page_crossing to be left set, which it only is once one of them ran, so until then they are interpreted
+    uint8_t duration = Instr[op.opcode].cycles;
+    uint8_t polls = 1 << (duration - 1);
+    if(op.access == BlockCache::READ
+       && (op.mode == BlockCache::ABX || op.mode == BlockCache::ABY || op.mode == BlockCache::IZY))
+    {
+        if(!page_crossing)
+            return false;
+        if(!page_crossed)
+        {
+            duration--;
+            polls = 0;
+        }
+    }
+
+    uint8_t value = 0;
+    if(op.mode == BlockCache::IMM)
+        value = op.operand;
+    else if(op.access == BlockCache::READ || op.access == BlockCache::MODIFY)
+        value = (address < 0x2000) ? memory[address & 0x7FF] : bus->cpu_reads(address);
+
+    instruction_address = PC;
+    PC += op.length;
+    switch(op.opcode)
+    {
+        //Loads and stores
+        case 0xA9: case 0xA5: case 0xB5: case 0xAD: case 0xBD: case 0xB9: case 0xA1: case 0xB1:
+            Accumulator = value;
+            ALU::set_nz(P, value);
+            break;
+        case 0xA2: case 0xA6: case 0xB6: case 0xAE: case 0xBE:
+            X = value;
+            ALU::set_nz(P, value);
+            break;
+        case 0xA0: case 0xA4: case 0xB4: case 0xAC: case 0xBC:
+            Y = value;
+            ALU::set_nz(P, value);
+            break;
+        case 0x85: case 0x95: case 0x8D: case 0x9D: case 0x99: case 0x81: case 0x91:
+            memory[address & 0x7FF] = Accumulator;
+            break;
+        case 0x86: case 0x96: case 0x8E:
+            memory[address & 0x7FF] = X;
+            break;
+        case 0x84: case 0x94: case 0x8C:
+            memory[address & 0x7FF] = Y;
+            break;
+
+        //Transfers, the stack and increments
+        case 0xAA: X = Accumulator; ALU::set_nz(P, X); break;
+        case 0xA8: Y = Accumulator; ALU::set_nz(P, Y); break;
+        case 0x8A: Accumulator = X; ALU::set_nz(P, Accumulator); break;
+        case 0x98: Accumulator = Y; ALU::set_nz(P, Accumulator); break;
+        case 0x9A: SP = X; break;
+        case 0xBA: X = SP; ALU::set_nz(P, X); break;
+        case 0x48: memory[0x100 + SP--] = Accumulator; break;
+        case 0x08: memory[0x100 + SP--] = P | 0x30; break;
+        case 0x68: Accumulator = memory[0x100 + ++SP]; ALU::set_nz(P, Accumulator); break;
+        case 0xCA: ALU::set_nz(P, --X); break;
+        case 0x88: ALU::set_nz(P, --Y); break;
+        case 0xE8: ALU::set_nz(P, ++X); break;
+        case 0xC8: ALU::set_nz(P, ++Y); break;
+
+        //Arithmetic and logic
+        case 0x69: case 0x65: case 0x75: case 0x6D: case 0x7D: case 0x79: case 0x61: case 0x71:
+            Accumulator = ALU::adc(P, Accumulator, value);
+            break;
+        case 0xE9: case 0xE5: case 0xF5: case 0xED: case 0xFD: case 0xF9: case 0xE1: case 0xF1:
+            Accumulator = ALU::sbc(P, Accumulator, value);
+            break;
+        case 0x29: case 0x25: case 0x35: case 0x2D: case 0x3D: case 0x39: case 0x21: case 0x31:
+            Accumulator &= value;
+            ALU::set_nz(P, Accumulator);
+            break;
+        case 0x49: case 0x45: case 0x55: case 0x4D: case 0x5D: case 0x59: case 0x41: case 0x51:
+            Accumulator ^= value;
+            ALU::set_nz(P, Accumulator);
+            break;
+        case 0x09: case 0x05: case 0x15: case 0x0D: case 0x1D: case 0x19: case 0x01: case 0x11:
+            Accumulator |= value;
+            ALU::set_nz(P, Accumulator);
+            break;
+        case 0xC9: case 0xC5: case 0xD5: case 0xCD: case 0xDD: case 0xD9: case 0xC1: case 0xD1:
+            ALU::cmp(P, Accumulator, value);
+            break;
+        case 0xE0: case 0xE4: case 0xEC: ALU::cmp(P, X, value); break;
+        case 0xC0: case 0xC4: case 0xCC: ALU::cmp(P, Y, value); break;
+        case 0x24: case 0x2C: ALU::bit(P, Accumulator, value); break;
+
+        //Shifts and read-modify-write
+        case 0x0A: Accumulator = ALU::asl(P, Accumulator); break;
+        case 0x4A: Accumulator = ALU::lsr(P, Accumulator); break;
+        case 0x2A: Accumulator = ALU::rol(P, Accumulator); break;
+        case 0x6A: Accumulator = ALU::ror(P, Accumulator); break;
+        case 0x06: case 0x16: case 0x0E: case 0x1E: memory[address & 0x7FF] = ALU::asl(P, value); break;
+        case 0x46: case 0x56: case 0x4E: case 0x5E: memory[address & 0x7FF] = ALU::lsr(P, value); break;
+        case 0x26: case 0x36: case 0x2E: case 0x3E: memory[address & 0x7FF] = ALU::rol(P, value); break;
+        case 0x66: case 0x76: case 0x6E: case 0x7E: memory[address & 0x7FF] = ALU::ror(P, value); break;
+        case 0xE6: case 0xF6: case 0xEE: case 0xFE:
+            memory[address & 0x7FF] = ++value;
+            ALU::set_nz(P, value);
+            break;
+        case 0xC6: case 0xD6: case 0xCE: case 0xDE:
+            memory[address & 0x7FF] = --value;
+            ALU::set_nz(P, value);
+            break;
+
+        //Flags
+        case 0x18: P &= ~ALU::C; break;
+        case 0x38: P |= ALU::C; break;
+        case 0xB8: P &= ~ALU::V; break;
+        case 0xD8: P &= 0xF7; break;
+        case 0xF8: P |= 0x08; break;
+        case 0xEA: break;
+
+        //Branches poll in their first cycle and again in the fourth when the target is on another page.
+        //Bits 7-6 of the opcode pick the flag (N, V, C, Z) and bit 5 the value that takes the branch
+        case 0x10: case 0x30: case 0x50: case 0x70: case 0x90: case 0xB0: case 0xD0: case 0xF0:
+        {
+            static const uint8_t flags[4] = {ALU::N, ALU::V, ALU::C, ALU::Z};
+            bool taken = ((P & flags[op.opcode >> 6]) != 0) == ((op.opcode & 0x20) != 0);
+            duration = 2;
+            polls = 0x02;
+            if(taken)
+            {
+                uint16_t target = PC + (int8_t)op.operand;
+                duration = ((target ^ PC) & 0xFF00) ? 4 : 3;
+                polls |= (duration == 4) ? 0x08 : 0x00;
+                PC = target;
+            }
+            break;
+        }
+
+        //Jumps, the indirect one keeps the 6502's page wrap of the pointer
+        case 0x4C: PC = op.operand; break;
+        case 0x6C:
+        {
+            uint16_t pointer_high = (op.operand & 0xFF00) | (uint8_t)(op.operand + 1);
+            uint8_t low = (op.operand < 0x2000) ? memory[op.operand & 0x7FF] : bus->cpu_reads(op.operand);
+            uint8_t high = (pointer_high < 0x2000) ? memory[pointer_high & 0x7FF] : bus->cpu_reads(pointer_high);
+            PC = low | (high << 8);
+            break;
+        }
+        case 0x20:
+            memory[0x100 + SP--] = (PC - 1) >> 8;
+            memory[0x100 + SP--] = (PC - 1) & 0xFF;
+            PC = op.operand;
+            break;
+        case 0x60:
+        {
+            uint8_t low = memory[0x100 + ++SP];
+            PC = (low | (memory[0x100 + ++SP] << 8)) + 1;
+            break;
+        }
+    }
+
+    opcode = op.opcode;
+    new_instruction = op.access != BlockCache::MODIFY;
+    n_cycles = 1;
+    decoded_cycles = duration;
+    decoded_polls = polls;
+    decoded_instructions++;
+    return true;
+}
+
 void CPU::write(uint16_t address, uint8_t value)
 {
+    if(probe)
+        probe->access(oamdma_flag ? CPUProbe::DMA_WRITE : CPUProbe::WRITE, address, value);
+    if(idle_mode == IDLE_RECORD) //Loops that write are never idle
+        idle_mode = IDLE_SEARCH;
+
     if(address < 0x2000)
         memory[address & 0x7FF] = value;
         
@@ -200,6 +476,14 @@ void CPU::write(uint16_t address, uint8_t value)
         else
             alignment_needed = true;
         dma_address = 0x0000 | (OAMDMA << 8);
+
+        //RAM and ROM pages are read without side effects, so the page can go to OAM at once
+        const uint8_t* page = nullptr;
+        if(dma_address < 0x2000)
+            page = &memory[dma_address & 0x7FF];
+        else if(dma_address >= 0x8000)
+            page = bus->prg_rom_page(dma_address);
+        oamdma_copied = page && bus->write_oam_page(page, OAM_DMA_MAX_DOTS);
     }  
     else
         bus->cpu_writes(address, value);
@@ -207,15 +491,38 @@ void CPU::write(uint16_t address, uint8_t value)
 
 uint8_t CPU::read(uint16_t address)
 {
+    //RAM and cartridge reads are stable while the loop doesn't write, $2002 reads are replayed for real
+    if(idle_mode == IDLE_RECORD && address >= 0x2000 && address < 0x6000)
+    {
+        if((address & 0xE007) == 0x2002)
+            idle_cycle_flags[idle_length] |= IDLE_CYCLE_VOLATILE;
+        else
+            idle_mode = IDLE_SEARCH;
+    }
+
     uint8_t value;
     if(address  < 0x2000)
         value = memory[address & 0x7FF];
     else
         value = bus->cpu_reads(address);
 
+    if(probe)
+        probe->access(oamdma_flag ? CPUProbe::DMA_READ : CPUProbe::READ, address, value);
     return value; 
 }
 
+//Read without side effects, only internal RAM and cartridge space are visible
+uint8_t CPU::peek(uint16_t address)
+{
+    uint8_t value = 0;
+    if(address < 0x2000)
+        value = memory[address & 0x7FF];
+    else if(address >= 0x6000)
+        value = bus->cpu_reads(address);
+
+    return value;
+}
+
 void CPU::connect_bus(std::shared_ptr<Bus> bus)
 {
     this->bus = bus;
@@ -223,6 +530,17 @@ void CPU::connect_bus(std::shared_ptr<Bus> bus)
 
 void CPU::transfer_oam_bytes()
 {
+    if(oamdma_copied)
+    {
+        if(!get_cycle)
+        {
+            if((dma_address & 0x00FF) == 0xFF)
+                oamdma_flag = false;
+            dma_address++;
+        }
+        return;
+    }
+
     switch(get_cycle)
     {
         case 1:
@@ -242,6 +560,38 @@ void CPU::transfer_oam_bytes()
     }
 }
 
+void CPU::request_dmc_dma(uint16_t address)
+{
+    dmc_dma_address = address;
+    dmc_dma_stage = oamdma_flag ? DMC_DMA_GET : DMC_DMA_HALT;
+}
+
+//Returns true when the DMC used the cycle. The CPU is halted right away instead of on its next read
+//cycle, so the extra controller reads the real halt can cause are not reproduced
+bool CPU::dmc_dma_cycle()
+{
+    switch(dmc_dma_stage)
+    {
+        case DMC_DMA_HALT:
+            dmc_dma_stage = DMC_DMA_DUMMY;
+            return true;
+        case DMC_DMA_DUMMY:
+            dmc_dma_stage = DMC_DMA_GET;
+            return true;
+        default:
+        {
+            if(!get_cycle) //Alignment cycle, a running OAM DMA keeps its put cycles
+                return !oamdma_flag;
+
+            dmc_dma_stage = DMC_DMA_IDLE;
+            if(oamdma_flag && !halt_cycle) //OAM DMA lost its get cycle and has to realign
+                alignment_needed = true;
+            bus->dmc_dma(dmc_dma_address);
+            return true;
+        }
+    }
+}
+
 bool CPU::is_new_instruction()
 {
     return new_instruction;
@@ -254,6 +604,11 @@ void CPU::set_nmi(bool value)
 
 void CPU::poll_interrupts()
 {
+    if(idle_mode == IDLE_RECORD)
+        idle_cycle_flags[idle_length] |= IDLE_CYCLE_POLL;
+    if(block_check.active)
+        block_check.interpreter_polls |= 1 << block_check.interpreter_cycles;
+
     if(pending_NMI)
     {
         NMI = true;
@@ -268,11 +623,7 @@ void CPU::poll_interrupts()
 
 void CPU::upd_negative_zero_flags(uint8_t byte)
 {
-    if (byte == 0x00)
-        P = P | 0x02;
-    else
-        P =  P  & 0xFD;
-    P = (P  & 0x7F) | (byte & 0x80);
+    ALU::set_nz(P, byte);
 }
 
 //Addressing modes for instructions that perform operations inside the cpu
@@ -486,41 +837,17 @@ void CPU::ie_indy()
 
 void CPU::ADC_calc()
 {
-    uint16_t calc;
-    uint8_t old;
+    Accumulator = ALU::adc(P, Accumulator, data);
+}
 
-    old = Accumulator;
-    calc = Accumulator + data + (P & 0x01); //0xFF + 0x2 + 0x1 = 258 = 0x102
-    if(calc > 0xFF)
-    {
-        Accumulator = calc & 0x00FF;
-        P |= 0x01;
-    }
-    else
-    {
-        P &= 0xFE;
-        Accumulator = uint8_t(calc);
-    }
-    if(((old & 0x80) == (data & 0x80)) && ((Accumulator & 0x80) != (data & 0x80)))
-        P |= 0x40;
-    else
-        P &= 0xBF;
+void CPU::SBC_calc()
+{
+    Accumulator = ALU::sbc(P, Accumulator, data);
 }
 
 void CPU::CMP_calc(uint8_t reg)
 {
-    uint8_t calc;
-
-    calc = reg - data;
-    if(reg >= data)               
-        P |= 0x01;
-    else
-        P &= 0xFE;
-    if(reg == data)
-        P |= 0x02;
-    else
-        P &= 0xFD;
-    P = (P  & 0x7F) | (calc & 0x80);
+    ALU::cmp(P, reg, data);
 }
 
 //Flag instructions
@@ -1497,7 +1824,6 @@ void CPU::ADC_imm()
     PC++;
     n_cycles++;
     ADC_calc();
-    upd_negative_zero_flags(Accumulator);
 }
 
 void CPU::ADC_zp()
@@ -1509,8 +1835,7 @@ void CPU::ADC_zp()
             break;
         case 2: 
             ie_zeropage<2>(); 
-            ADC_calc(); 
-            upd_negative_zero_flags(Accumulator);
+            ADC_calc();
             break;
     }
 }
@@ -1527,8 +1852,7 @@ void CPU::ADC_zpx()
             break;
         case 3: 
             ie_zpxy<3>(X); 
-            ADC_calc(); 
-            upd_negative_zero_flags(Accumulator);
+            ADC_calc();
             break;           
     }
 }
@@ -1545,8 +1869,7 @@ void CPU::ADC_abs()
             break;
         case 3: 
             ie_abs<3>(); 
-            ADC_calc(); 
-            upd_negative_zero_flags(Accumulator);
+            ADC_calc();
             break;        
     } 
 }
@@ -1567,13 +1890,11 @@ void CPU::ADC_absx()
             {
                 ADC_calc();
                 page_crossing = true;
-                upd_negative_zero_flags(Accumulator);
             }
             break; 
         case 4:
             ie_absxy<4>(X);
             ADC_calc();
-            upd_negative_zero_flags(Accumulator);
             break;      
     }        
 }
@@ -1594,13 +1915,11 @@ void CPU::ADC_absy()
             {
                 ADC_calc();
                 page_crossing = true;
-                upd_negative_zero_flags(Accumulator);
             }
             break; 
         case 4:
             ie_absxy<4>(Y);
             ADC_calc();
-            upd_negative_zero_flags(Accumulator);
             break;      
     }
 }
@@ -1624,7 +1943,6 @@ void CPU::ADC_indx()
         case 5:
             ie_indx<5>();
             ADC_calc();
-            upd_negative_zero_flags(Accumulator);
             break;
     }
 }
@@ -1648,13 +1966,11 @@ void CPU::ADC_indy()
             {
                 ADC_calc();
                 page_crossing = true;
-                upd_negative_zero_flags(Accumulator);
             }
             break; 
         case 5:
             ie_indy<5>();
             ADC_calc();
-            upd_negative_zero_flags(Accumulator);
             break; 
     }       
 }
@@ -1664,9 +1980,7 @@ void CPU::SBC_imm()
     data = read(PC);
     PC++;
     n_cycles++;
-    data = ~data; // Two's complement
-    ADC_calc();
-    upd_negative_zero_flags(Accumulator);
+    SBC_calc();
 }
 
 void CPU::SBC_zp()
@@ -1678,9 +1992,7 @@ void CPU::SBC_zp()
             break;
         case 2: 
             ie_zeropage<2>(); 
-            data = ~data; // Two's complement
-            ADC_calc(); 
-            upd_negative_zero_flags(Accumulator);
+            SBC_calc();
             break;
     }
 }
@@ -1697,9 +2009,7 @@ void CPU::SBC_zpx()
             break;
         case 3: 
             ie_zpxy<3>(X); 
-            data = ~data; // Two's complement
-            ADC_calc(); 
-            upd_negative_zero_flags(Accumulator);
+            SBC_calc();
             break;           
     }
 }
@@ -1716,9 +2026,7 @@ void CPU::SBC_abs()
             break;
         case 3: 
             ie_abs<3>(); 
-            data = ~data; // Two's complement
-            ADC_calc(); 
-            upd_negative_zero_flags(Accumulator);
+            SBC_calc();
             break;        
     } 
 }
@@ -1737,17 +2045,13 @@ void CPU::SBC_absx()
             ie_absxy<3>(X);
             if (!page_crossing)
             {
-                data = ~data; // Two's complement
-                ADC_calc();
+                SBC_calc();
                 page_crossing = true;
-                upd_negative_zero_flags(Accumulator);
             }
             break; 
         case 4:
             ie_absxy<4>(X);
-            data = ~data; // Two's complement
-            ADC_calc();
-            upd_negative_zero_flags(Accumulator);
+            SBC_calc();
             break;      
     }        
 }
@@ -1766,17 +2070,13 @@ void CPU::SBC_absy()
             ie_absxy<3>(Y);
             if (!page_crossing)
             {
-                data = ~data; // Two's complement
-                ADC_calc();
+                SBC_calc();
                 page_crossing = true;
-                upd_negative_zero_flags(Accumulator);
             }
             break; 
         case 4:
             ie_absxy<4>(Y);
-            data = ~data; // Two's complement
-            ADC_calc();
-            upd_negative_zero_flags(Accumulator);
+            SBC_calc();
             break;      
     }
 }
@@ -1799,9 +2099,7 @@ void CPU::SBC_indx()
             break;
         case 5:
             ie_indx<5>();
-            data = ~data; // Two's complement
-            ADC_calc();
-            upd_negative_zero_flags(Accumulator);
+            SBC_calc();
             break;
     }
 }
@@ -1823,17 +2121,13 @@ void CPU::SBC_indy()
             ie_indy<4>();
             if (!page_crossing)
             {
-                data = ~data; // Two's complement
-                ADC_calc();
+                SBC_calc();
                 page_crossing = true;
-                upd_negative_zero_flags(Accumulator);
             }
             break; 
         case 5:
             ie_indy<5>();
-            data = ~data; // Two's complement
-            ADC_calc();
-            upd_negative_zero_flags(Accumulator);
+            SBC_calc();
             break; 
     }       
 }
@@ -2350,12 +2644,9 @@ void CPU::ORA_indy()
 
 void CPU::ASL_imm()
 {
-    P = (P  & 0xFE) | ((Accumulator & 0x80) >> 7);
-    Accumulator <<=1;
-    Accumulator &= 0xFE;
+    Accumulator = ALU::asl(P, Accumulator);
     data = Accumulator;
     n_cycles++;
-    upd_negative_zero_flags(data);
 }
 
 void CPU::ASL_zp()
@@ -2366,12 +2657,9 @@ void CPU::ASL_zp()
         case 2: { ie_zeropage<2>(); break; }
         case 3: { write(effective_addr, data); new_instruction = false; n_cycles++; break; };
         case 4:
-            P = (P  & 0xFE) | ((data & 0x80) >> 7);
-            data <<= 1;
-            data &= 0xFE;
+            data = ALU::asl(P, data);
             write(effective_addr, data);
             n_cycles++;
-            upd_negative_zero_flags(data);
             break;
     }
 }
@@ -2385,12 +2673,9 @@ void CPU::ASL_zpx()
         case 3: { ie_zpxy<3>(X); break; }
         case 4: { write(effective_addr, data); new_instruction = false; n_cycles++; break; };
         case 5:
-            P = (P  & 0xFE) | ((data & 0x80) >> 7);
-            data <<= 1;
-            data &= 0xFE;
+            data = ALU::asl(P, data);
             write(effective_addr, data);
             n_cycles++;
-            upd_negative_zero_flags(data);
             break;               
     }
 }
@@ -2404,12 +2689,9 @@ void CPU::ASL_abs()
         case 3: { data = read(effective_addr); n_cycles++; break; };
         case 4: { write(effective_addr, data); new_instruction = false; n_cycles++; break; };
         case 5:
-            P = (P  & 0xFE) | ((data & 0x80) >> 7);
-            data <<= 1;
-            data &= 0xFE;
+            data = ALU::asl(P, data);
             write(effective_addr, data);
             n_cycles++;
-            upd_negative_zero_flags(data);
             break;
     }
 }
@@ -2430,12 +2712,9 @@ void CPU::ASL_absx()
             break;
         case 5: { write(effective_addr, data); new_instruction = false; n_cycles++; break; };
         case 6:
-            P = (P  & 0xFE) | ((data & 0x80) >> 7);
-            data <<= 1;
-            data &= 0xFE;
+            data = ALU::asl(P, data);
             write(effective_addr, data);
             n_cycles++;
-            upd_negative_zero_flags(data);
             break;           
     }
 }
@@ -2443,12 +2722,9 @@ void CPU::ASL_absx()
 
 void CPU::LSR_imm()
 {
-    P = (P & 0xFE) | (Accumulator & 0x01);
-    Accumulator >>= 1;
-    Accumulator &= 0x7F;
+    Accumulator = ALU::lsr(P, Accumulator);
     data = Accumulator;
     n_cycles++;
-    upd_negative_zero_flags(data);
 }
 
 void CPU::LSR_zp()
@@ -2459,12 +2735,9 @@ void CPU::LSR_zp()
         case 2: { ie_zeropage<2>(); break; }
         case 3: { data = read(effective_addr); n_cycles++; break; }
         case 4:
-            P = (P & 0xFE) | (data & 0x01);
-            data >>= 1;
-            data &= 0x7F;
+            data = ALU::lsr(P, data);
             write(effective_addr, data);
             n_cycles++;
-            upd_negative_zero_flags(data);
             break;
     }
 }
@@ -2478,12 +2751,9 @@ void CPU::LSR_zpx()
         case 3: { ie_zpxy<3>(X); break; }
         case 4: { data = read(effective_addr); n_cycles++; break; }
         case 5:
-            P = (P & 0xFE) | (data & 0x01);
-            data >>= 1;
-            data &= 0x7F;
+            data = ALU::lsr(P, data);
             write(effective_addr, data);
             n_cycles++;
-            upd_negative_zero_flags(data);
             break;               
     }
 }
@@ -2497,12 +2767,9 @@ void CPU::LSR_abs()
         case 3: { data = read(effective_addr); n_cycles++; break; }
         case 4: { write(effective_addr, data); new_instruction = false; n_cycles++; break; }
         case 5:
-            P = (P  & 0xFE) | (data & 0x01);
-            data >>= 1;
-            data &= 0x7F;
+            data = ALU::lsr(P, data);
             write(effective_addr, data);
             n_cycles++;
-            upd_negative_zero_flags(data);
             break;
     }
 }
@@ -2524,25 +2791,18 @@ void CPU::LSR_absx()
         case 5: { write(effective_addr, data); new_instruction = false; n_cycles++; break; };
         case 6:
             data = read(effective_addr);
-            P = (P  & 0xFE) | (data & 0x01);
-            data >>= 1;
-            data &= 0x7F;
+            data = ALU::lsr(P, data);
             write(effective_addr, data);
             n_cycles++;
-            upd_negative_zero_flags(data);
             break;           
     }
 }
 
 void CPU::ROL_imm()
 {
-    uint8_t aux = (Accumulator >> 7) & 0x01; // Get the carry bit
-    Accumulator <<= 1; // Shift left
-    Accumulator = (Accumulator & 0xFE) | (P & 0x01); // Insert carry from P
-    P = (P & 0xFE) | aux; // Update the carry in P
+    Accumulator = ALU::rol(P, Accumulator);
     data = Accumulator;
     n_cycles++;
-    upd_negative_zero_flags(data);
 }
 
 void CPU::ROL_zp()
@@ -2553,15 +2813,9 @@ void CPU::ROL_zp()
         case 2: { ie_zeropage<2>(); break; }
         case 3: { data = read(effective_addr); n_cycles++; break; }
         case 4:
-            {
-                uint8_t aux = (data >> 7) & 0x01;
-                data <<= 1;
-                data = (data & 0xFE) | (P & 0x01);
-                P = (P & 0xFE) | aux;
-                write(effective_addr, data);
-                n_cycles++;
-                upd_negative_zero_flags(data);
-            }
+            data = ALU::rol(P, data);
+            write(effective_addr, data);
+            n_cycles++;
             break;
     }
 }
@@ -2575,25 +2829,15 @@ void CPU::ROL_zpx()
         case 3: { ie_zpxy<3>(X); break; }
         case 4: { data = read(effective_addr); n_cycles++; break; }
         case 5:
-            {
-                uint8_t aux = (data >> 7) & 0x01;
-                data <<= 1;
-                data = (data & 0xFE) | (P & 0x01);
-                P = (P & 0xFE) | aux;
-                write(effective_addr, data);
-                n_cycles++;
-                upd_negative_zero_flags(data);
-            }
+            data = ALU::rol(P, data);
+            write(effective_addr, data);
+            n_cycles++;
             break;               
     }
 }
 
-
-
-
 void CPU::ROL_abs()
 {
-    uint8_t aux;
     switch(n_cycles)
     {
         case 1: { ie_abs<1>(); break; }
@@ -2601,20 +2845,15 @@ void CPU::ROL_abs()
         case 3: { data = read(effective_addr); n_cycles++; break; };
         case 4: { write(effective_addr, data); new_instruction = false; n_cycles++; break; };
         case 5:
-            aux = (data >> 7) & 0x01;
-            data <<= 1;
-            data = (data & 0xFE) | (P & 0x01);
-            P = (P  & 0xFE) | (aux & 0x01);
+            data = ALU::rol(P, data);
             write(effective_addr, data);
             n_cycles++;
-            upd_negative_zero_flags(data);
             break;
     }
 }
 
 void CPU::ROL_absx()
 {
-    uint8_t aux;
     switch(n_cycles)
     {
         case 1: { ie_absxy<1>(X); break; }
@@ -2630,26 +2869,18 @@ void CPU::ROL_absx()
         case 5: { write(effective_addr, data); new_instruction = false; n_cycles++; break; };
         case 6:
             data = read(effective_addr);
-            aux = (data >> 7) & 0x01;
-            data <<= 1;
-            data = (data & 0xFE) | (P & 0x01);
-            P = (P  & 0xFE) | (aux & 0x01);
+            data = ALU::rol(P, data);
             write(effective_addr, data);
             n_cycles++;
-            upd_negative_zero_flags(data);
             break;             
         }
 }
 
 void CPU::ROR_imm()
 {
-    uint8_t aux = (Accumulator & 0x01); // Get the carry bit
-    Accumulator >>= 1; // Shift right
-    Accumulator = (Accumulator & 0x7F) | ((P & 0x01) << 7); // Insert carry from P
-    P = (P & 0xFE) | aux; // Update the carry in P
+    Accumulator = ALU::ror(P, Accumulator);
     data = Accumulator;
     n_cycles++;
-    upd_negative_zero_flags(data);
 }
 
 void CPU::ROR_zp()
@@ -2660,15 +2891,9 @@ void CPU::ROR_zp()
         case 2: { ie_zeropage<2>(); break; }
         case 3: { data = read(effective_addr); n_cycles++; break; }
         case 4:
-            {
-                uint8_t aux = data & 0x01;
-                data >>= 1;
-                data = (data & 0x7F) | ((P & 0x01) << 7);
-                P = (P & 0xFE) | aux;
-                write(effective_addr, data);
-                n_cycles++;
-                upd_negative_zero_flags(data);
-            }
+            data = ALU::ror(P, data);
+            write(effective_addr, data);
+            n_cycles++;
             break;
     }
 }
@@ -2682,22 +2907,15 @@ void CPU::ROR_zpx()
         case 3: { ie_zpxy<3>(X); break; }
         case 4: { data = read(effective_addr); n_cycles++; break; }
         case 5:
-            {
-                uint8_t aux = data & 0x01;
-                data >>= 1;
-                data = (data & 0x7F) | ((P & 0x01) << 7);
-                P = (P & 0xFE) | aux;
-                write(effective_addr, data);
-                n_cycles++;
-                upd_negative_zero_flags(data);
-            }
+            data = ALU::ror(P, data);
+            write(effective_addr, data);
+            n_cycles++;
             break;               
     }
 }
 
 void CPU::ROR_abs()
 {
-    uint8_t aux;
     switch(n_cycles)
     {
         case 1: { ie_abs<1>(); break; }
@@ -2705,21 +2923,15 @@ void CPU::ROR_abs()
         case 3: { data = read(effective_addr); n_cycles++; break; };
         case 4: { write(effective_addr, data); new_instruction = false; n_cycles++; break; };
         case 5:
-            aux = data & 0x01;
-            data >>= 1;
-            data = (data & 0x7F) | ((P & 0x01) << 7);
-            data = data;
-            P = (P & 0xFE) | (aux & 0x01);
+            data = ALU::ror(P, data);
             write(effective_addr, data);
             n_cycles++;
-            upd_negative_zero_flags(data);
             break;
     }
 }
 
 void CPU::ROR_absx()
 {
-    uint8_t aux;
     switch(n_cycles)
     {
         case 1: { ie_absxy<1>(X); break; }
@@ -2735,14 +2947,9 @@ void CPU::ROR_absx()
         case 5: { write(effective_addr, data); new_instruction = false; n_cycles++; break; };
         case 6:
             data = read(effective_addr);
-            aux = data & 0x01;
-            data >>= 1;
-            data = (data & 0x7F) | ((P & 0x01) << 7);
-            data = data;
-            P = (P & 0xFE) | (aux & 0x01);
+            data = ALU::ror(P, data);
             write(effective_addr, data);
             n_cycles++;
-            upd_negative_zero_flags(data);
             break;            
     }
 }
@@ -3371,10 +3578,7 @@ void CPU::BIT_zp()
         case 2:
         {
             ie_zeropage<2>();
-            uint8_t aux = data & Accumulator;
-            P = (aux == 0x00) ? (P | 0x02) : (P & 0xFD);
-            P = (P & 0x7F) | (data & 0x80);
-            P = (P & 0xBF) | (data & 0x40);
+            ALU::bit(P, Accumulator, data);
             break;
         }
     }
@@ -3389,10 +3593,7 @@ void CPU::BIT_abs()
         case 3:
         {
             ie_abs<3>();
-            uint8_t aux = data & Accumulator;
-            P = (aux == 0x00) ? (P | 0x02) : (P & 0xFD);
-            P = (P & 0x7F) | (data & 0x80);
-            P = (P & 0xBF) | (data & 0x40);
+            ALU::bit(P, Accumulator, data);
             break; 
         }       
     }
@@ -3441,11 +3642,24 @@ void CPU::reset()
     }
 }
 
+//Reset button: runs the reset sequence keeping RAM contents
+void CPU::trigger_reset()
+{
+    leave_idle_loop();
+    reset_flag = true;
+    n_cycles = 0;
+    decoded_cycles = 0;
+    block_check.active = false;
+    oamdma_flag = false;
+    NMI = false;
+    IRQ = false;
+    pending_NMI = false;
+}
+
 void CPU::soft_reset()
 {
-    // Reset cycle and logging-related variables
+    // Reset cycle counter
     cycles = 0;
-    start_logging = false;
 
     // Reset opcode
     opcode = 0x00;
@@ -3461,10 +3675,13 @@ void CPU::soft_reset()
     // Reset Direct Memory Access (DMA) related variables
     OAMDMA = 0x00;
     oamdma_flag = false;
+    oamdma_copied = false;
     get_cycle = false;
     alignment_needed = false;
     dma_read = 0x00;
     dma_address = 0x0000;
+    dmc_dma_stage = DMC_DMA_IDLE;
+    dmc_dma_address = 0x0000;
 
     // Reset interrupt and control flags
     reset_flag = true;
@@ -3480,6 +3697,10 @@ void CPU::soft_reset()
 
     // Reset cycle tracking variables
     n_cycles = 0;
+    decoded_cycles = 0;
+    block_check.active = false;
+    // A new game may be loaded, the decoded code goes with the old one
+    block_cache.clear();
     offset = 0x00;
 
     // Reset temporary data variables
@@ -3491,4 +3712,351 @@ void CPU::soft_reset()
 
     // Reset internal memory without altering its size
     std::fill(std::begin(memory), std::end(memory), 0);
-}
\ No newline at end of file
+
+    // Drop any idle loop in progress, the registers above replace its state
+    if(idle_mode != IDLE_OFF)
+        idle_mode = IDLE_SEARCH;
+}
+
+bool CPU::start_trace(const std::string& filename)
+{
+    if(trace)
+        return true;
+
+    leave_idle_loop();
+    trace = std::make_unique<TraceRecorder>();
+    if(!trace->start(filename))
+    {
+        trace.reset();
+        return false;
+    }
+    return true;
+}
+
+void CPU::stop_trace()
+{
+    trace.reset();
+}
+
+bool CPU::is_tracing()
+{
+    return trace != nullptr;
+}
+
+//Registers as they are before the instruction at PC runs
+void CPU::record_trace()
+{
+    TraceRecord entry;
+    entry.cycle = cycles;
+    entry.PC = PC;
+    entry.opcode = peek(PC);
+    entry.operands[0] = peek(PC + 1);
+    entry.operands[1] = peek(PC + 2);
+    entry.A = Accumulator;
+    entry.X = X;
+    entry.Y = Y;
+    entry.P = P;
+    entry.SP = SP;
+    entry.scanline = bus->get_ppu_scanline();
+    entry.dot = bus->get_ppu_dot();
+    trace->record(entry);
+}
+
+void CPU::set_probe(CPUProbe* probe)
+{
+    leave_idle_loop();
+    this->probe = probe;
+}
+
+void CPU::report_begin(CPUProbe::Entry entry)
+{
+    CPURegisters registers;
+    registers.cycle = cycles;
+    registers.PC = PC;
+    registers.A = Accumulator;
+    registers.X = X;
+    registers.Y = Y;
+    registers.SP = SP;
+    registers.P = P;
+    probe->begin(entry, registers);
+}
+
+void CPU::set_idle_skip(bool enabled)
+{
+    leave_idle_loop();
+    idle_mode = enabled ? IDLE_SEARCH : IDLE_OFF;
+}
+
+bool CPU::get_idle_skip()
+{
+    return idle_mode != IDLE_OFF;
+}
+
+uint64_t CPU::get_idle_loops_detected()
+{
+    return idle_loops_detected;
+}
+
+uint64_t CPU::get_idle_cycles_replayed()
+{
+    return idle_cycles_replayed;
+}
+
+uint64_t CPU::get_idle_cycles_skipped()
+{
+    return idle_cycles_skipped;
+}
+
+//A replayed cycle of such a loop only moves the replay on: its interrupt polls find nothing and the DMC does not
+//halt it, so until one of those changes the cycles can be counted instead of run
+bool CPU::can_skip_idle_cycles()
+{
+    return idle_mode == IDLE_SKIP && !idle_reads_io && dmc_dma_stage == DMC_DMA_IDLE && !pending_NMI
+        && (idle_irq_masked || !bus->get_irq());
+}
+
+void CPU::skip_idle_cycles(uint32_t count)
+{
+    cycles += count;
+    get_cycle = get_cycle != (count & 1);
+    idle_index = (idle_index + count) % idle_length;
+    idle_cycles_skipped += count;
+}
+
+void CPU::save_idle_state(IdleState& state)
+{
+    state.PC = PC;
+    state.jmp_address = jmp_address;
+    state.subroutine_address = subroutine_address;
+    state.zero_page_addr = zero_page_addr;
+    state.absolute_addr = absolute_addr;
+    state.effective_addr = effective_addr;
+    state.h = h;
+    state.l = l;
+    state.Accumulator = Accumulator;
+    state.X = X;
+    state.Y = Y;
+    state.SP = SP;
+    state.P = P;
+    state.opcode = opcode;
+    state.n_cycles = n_cycles;
+    state.data = data;
+    state.high_byte = high_byte;
+    state.low_byte = low_byte;
+    state.offset = offset;
+    state.page_crossing = page_crossing;
+    state.branch_polled = branch_polled;
+    state.new_instruction = new_instruction;
+}
+
+void CPU::load_idle_state(const IdleState& state)
+{
+    PC = state.PC;
+    jmp_address = state.jmp_address;
+    subroutine_address = state.subroutine_address;
+    zero_page_addr = state.zero_page_addr;
+    absolute_addr = state.absolute_addr;
+    effective_addr = state.effective_addr;
+    h = state.h;
+    l = state.l;
+    Accumulator = state.Accumulator;
+    X = state.X;
+    Y = state.Y;
+    SP = state.SP;
+    P = state.P;
+    opcode = state.opcode;
+    n_cycles = state.n_cycles;
+    data = state.data;
+    high_byte = state.high_byte;
+    low_byte = state.low_byte;
+    offset = state.offset;
+    page_crossing = state.page_crossing;
+    branch_polled = state.branch_polled;
+    new_instruction = state.new_instruction;
+}
+
+bool CPU::same_idle_state(const IdleState& state)
+{
+    return PC == state.PC && jmp_address == state.jmp_address && subroutine_address == state.subroutine_address
+        && zero_page_addr == state.zero_page_addr && absolute_addr == state.absolute_addr
+        && effective_addr == state.effective_addr && h == state.h && l == state.l
+        && Accumulator == state.Accumulator && X == state.X && Y == state.Y && SP == state.SP && P == state.P
+        && opcode == state.opcode && n_cycles == state.n_cycles && data == state.data
+        && high_byte == state.high_byte && low_byte == state.low_byte && offset == state.offset
+        && page_crossing == state.page_crossing && branch_polled == state.branch_polled
+        && new_instruction == state.new_instruction;
+}
+
+void CPU::start_idle_record()
+{
+    if(NMI || IRQ || trace || probe) //Every instruction has to reach the trace and the probe
+        return;
+
+    idle_loop_address = PC;
+    idle_length = 0;
+    idle_record_tries = 0;
+    idle_mode = IDLE_RECORD;
+}
+
+//Returns true when the cycle was replayed and the normal tick must be skipped
+bool CPU::begin_idle_cycle()
+{
+    if(idle_mode == IDLE_RECORD)
+    {
+        save_idle_state(idle_states[idle_length]);
+        idle_cycle_flags[idle_length] = 0;
+        return false;
+    }
+
+    uint8_t flags = idle_cycle_flags[idle_index];
+    if(flags & IDLE_CYCLE_VOLATILE) //Run it for real from the recorded state, end_idle_cycle checks the outcome
+    {
+        load_idle_state(idle_states[idle_index]);
+        return false;
+    }
+
+    idle_index = (idle_index + 1 == idle_length) ? 0 : idle_index + 1;
+    idle_cycles_replayed++;
+
+    //Polls only depend on the I flag, the loop is left as soon as an interrupt is taken
+    if((flags & IDLE_CYCLE_POLL) && (pending_NMI || (bus->get_irq() && !(idle_states[idle_index].P & 0x4))))
+    {
+        leave_idle_loop();
+        poll_interrupts();
+    }
+
+    return true;
+}
+
+void CPU::end_idle_cycle()
+{
+    if(idle_mode == IDLE_RECORD)
+    {
+        idle_length++;
+        if(NMI || IRQ || idle_length == IDLE_MAX_LOOP_CYCLES)
+            idle_mode = IDLE_SEARCH;
+
+        else if(n_cycles == 0 && PC == idle_loop_address)
+        {
+            if(same_idle_state(idle_states[0]))
+            {
+                idle_mode = IDLE_SKIP;
+                idle_index = 0;
+                idle_loops_detected++;
+                idle_reads_io = false;
+                idle_irq_masked = true;
+                for(int i = 0; i < idle_length; i++)
+                {
+                    idle_reads_io |= (idle_cycle_flags[i] & IDLE_CYCLE_VOLATILE) != 0;
+                    idle_irq_masked &= (idle_states[i].P & 0x4) != 0;
+                }
+            }
+            else if(++idle_record_tries == IDLE_MAX_RECORD_TRIES)
+                idle_mode = IDLE_SEARCH;
+            else
+                idle_length = 0; //Flags read inside the loop may only settle after the first iteration
+        }
+    }
+
+    else
+    {
+        idle_index = (idle_index + 1 == idle_length) ? 0 : idle_index + 1;
+        if(NMI || IRQ || !same_idle_state(idle_states[idle_index]))
+            idle_mode = IDLE_SEARCH;
+    }
+}
+
+//Materializes the replayed state back into the registers
+void CPU::leave_idle_loop()
+{
+    if(idle_mode == IDLE_SKIP)
+        load_idle_state(idle_states[idle_index]);
+    if(idle_mode != IDLE_OFF)
+        idle_mode = IDLE_SEARCH;
+}
+void CPU::set_block_mode(BlockMode mode)
+{
+    block_mode = mode;
+    block_check.active = false;
+}
+
+BlockMode CPU::get_block_mode()
+{
+    return block_mode;
+}
+
+uint64_t CPU::get_decoded_instructions()
+{
+    return decoded_instructions;
+}
+
+uint64_t CPU::get_block_mismatches()
+{
+    return block_mismatches;
+}
+
+//The first instruction where the decoded and the interpreted run disagreed, empty if there was none
+std::string CPU::get_block_mismatch_report()
+{
+    return block_mismatch_report;
+}
+
+//Runs the instruction decoded, keeps the outcome and rolls everything back so the interpreter runs it from the same
+//state. The interpreter's outcome is the one that stays
+void CPU::start_block_check()
+{
+    uint8_t saved_memory[0x800];
+    std::memcpy(saved_memory, memory, sizeof(memory));
+    uint8_t saved_A = Accumulator, saved_X = X, saved_Y = Y, saved_SP = SP, saved_P = P;
+    uint16_t saved_PC = PC;
+    if(!run_decoded())
+        return;
+
+    block_check.active = true;
+    block_check.address = saved_PC;
+    block_check.opcode = opcode;
+    block_check.Accumulator = Accumulator;
+    block_check.X = X;
+    block_check.Y = Y;
+    block_check.SP = SP;
+    block_check.P = P;
+    block_check.PC = PC;
+    block_check.cycles = decoded_cycles;
+    block_check.polls = decoded_polls;
+    std::memcpy(block_check.memory, memory, sizeof(memory));
+    block_check.interpreter_cycles = 1; //The fetch about to run
+    block_check.interpreter_polls = 0;
+
+    std::memcpy(memory, saved_memory, sizeof(memory));
+    Accumulator = saved_A;
+    X = saved_X;
+    Y = saved_Y;
+    SP = saved_SP;
+    P = saved_P;
+    PC = saved_PC;
+    n_cycles = 0;
+    decoded_cycles = 0;
+}
+
+void CPU::finish_block_check()
+{
+    block_check.active = false;
+    bool same_memory = std::memcmp(block_check.memory, memory, sizeof(memory)) == 0;
+    if(same_memory && block_check.Accumulator == Accumulator && block_check.X == X && block_check.Y == Y
+       && block_check.SP == SP && block_check.P == P && block_check.PC == PC
+       && block_check.cycles == block_check.interpreter_cycles && block_check.polls == block_check.interpreter_polls)
+        return;
+
+    if(block_mismatches++ == 0)
+    {
+        char report[256];
+        std::snprintf(report, sizeof(report),
+                      "$%04X opcode %02X decoded A:%02X X:%02X Y:%02X P:%02X SP:%02X PC:%04X cycles %d polls %02X%s, "
+                      "interpreted A:%02X X:%02X Y:%02X P:%02X SP:%02X PC:%04X cycles %d polls %02X",
+                      block_check.address, block_check.opcode, block_check.Accumulator, block_check.X, block_check.Y,
+                      block_check.P, block_check.SP, block_check.PC, block_check.cycles, block_check.polls,
+                      same_memory ? "" : " RAM differs", Accumulator, X, Y, P, SP, PC,
+                      block_check.interpreter_cycles, block_check.interpreter_polls);
+        block_mismatch_report = report;
+    }
+}
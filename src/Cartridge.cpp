@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <filesystem>
 #include "Cartridge.h"
 #include "Bus.h"
 #include "NROM.h"
@@ -6,14 +8,39 @@
 #include "SxROM.h"
 #include "AxROM.h"
 #include "TxROM.h"
+#include "Profiler.h"
+#include "Crc32.h"
+#include "RomDatabase.h"
 
 const int PRG_ROM_BANK_SIZE = 0x4000;
 const int CHR_ROM_BANK_SIZE = 0x2000;
 
+//NES 2.0 ROM size: a plain count of units, or with MSB nibble 0xF a 2^E * (2M+1) byte count from the LSB byte EEEEEEMM
+static size_t rom_size(uint8_t lsb, uint8_t msb, size_t unit)
+{
+    if(msb != 0x0F)
+        return ((msb << 8) | lsb) * unit;
+    if((lsb >> 2) >= 40)
+        return SIZE_MAX;
+    return ((size_t)1 << (lsb >> 2)) * ((lsb & 0x03) * 2 + 1);
+}
+
+//NES 2.0 RAM size: 0 for none, otherwise 64 << shift bytes
+static size_t ram_size(uint8_t shift)
+{
+    return shift ? (size_t)64 << shift : 0;
+}
+
+static size_t next_power_of_two(size_t value)
+{
+    size_t power = 1;
+    while(power < value)
+        power <<= 1;
+    return power;
+}
+
 Cartridge::Cartridge() : mapper(nullptr) 
 { 
-    CHR_RAM.resize(0x2000);
-    PRG_RAM.resize(0x8000);
 } 
 
 Cartridge::~Cartridge() { }
@@ -21,10 +48,9 @@ Cartridge::~Cartridge() { }
 bool Cartridge::load_game(const std::string filename, std::string& log)
 {
     bool ok = true;
-    std::ifstream file(filename, std::ios::binary | std::ios::in);
-    if (!file.is_open())
+    rom = RomImage::open(filename, log);
+    if(!rom)
     {
-        log = std::string("Error: Could not open file ") + filename;
         ok = false;
         return ok;
     }
@@ -32,12 +58,13 @@ bool Cartridge::load_game(const std::string filename, std::string& log)
     try
     {
         // Read header
-        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+        if (rom->size() < sizeof(header))
         {
             log =   std::string("Error: Failed to read header in ") + filename;
             ok = false;
             return ok;
         }
+        std::copy(rom->data(), rom->data() + sizeof(header), reinterpret_cast<uint8_t*>(&header));
 
         // Check format
         bool iNESFormat=false;
@@ -48,11 +75,12 @@ bool Cartridge::load_game(const std::string filename, std::string& log)
         if (iNESFormat==true && (header.flag7 & 0x0C)==0x08)
             NES20Format=true;
 
-        if(NES20Format)
+        //Old iNES dumps with text over bytes 7-15 ("DiskDude!") show it in bytes 12-15, which iNES 1.0 leaves zero.
+        //The whole tail of such a header is junk and read as zero
+        if(!NES20Format && (header.timing != 0 || header.misc[0] != 0 || header.misc[1] != 0 || header.misc[2] != 0))
         {
-            log =   std::string("Error: NES2.0 format not supported") + filename;
-            ok = false;
-            return ok;            
+            uint8_t* bytes = reinterpret_cast<uint8_t*>(&header);
+            std::fill(bytes + 7, bytes + sizeof(header), 0);
         }
 
         // Set mirror mode and ROM bank counts
@@ -63,15 +91,6 @@ bool Cartridge::load_game(const std::string filename, std::string& log)
             mirror_mode = MIRROR::FOUR_SCREEN;
         }
 
-        bus->set_mirroring_mode(mirror_mode);
-        
-        n_prg_rom_banks = header.prg_rom_lsb;
-        n_chr_rom_banks = header.chr_rom_lsb;
-
-        //Allocate memory
-        PRG_ROM.resize(n_prg_rom_banks * PRG_ROM_BANK_SIZE);
-        CHR_ROM.resize(n_chr_rom_banks * CHR_ROM_BANK_SIZE);
-
         //Ignore trainer if present
         if (header.flag6 & 0x4)
         {
@@ -80,51 +99,115 @@ bool Cartridge::load_game(const std::string filename, std::string& log)
             return ok;
         }
 
-        // Read PRG-ROM
-        if (!file.read(reinterpret_cast<char*>(PRG_ROM.data()), PRG_ROM.size()))
+        size_t prg_ram_size;
+        size_t chr_ram_size;
+        if(NES20Format)
+        {
+            prg_rom_size = rom_size(header.prg_rom_lsb, header.prg_chr_rom_size & 0x0F, PRG_ROM_BANK_SIZE);
+            chr_rom_size = rom_size(header.chr_rom_lsb, header.prg_chr_rom_size >> 4, CHR_ROM_BANK_SIZE);
+            prg_ram_size = ram_size(header.prg_ram_shift & 0x0F) + ram_size(header.prg_ram_shift >> 4);
+            chr_ram_size = ram_size(header.chr_ram_shift & 0x0F) + ram_size(header.chr_ram_shift >> 4);
+            submapper = header.mapper >> 4;
+            timing = header.timing & 0x03;
+        }
+        else
+        {
+            //iNES 1.0: bytes 8 and 9 (PRG-RAM units, TV system) are left unset by most dumps and set to garbage by
+            //some, so the cartridge gets 8KB of PRG-RAM and NTSC unless the ROM database says otherwise.
+            //CHR-RAM is 8KB when there is no CHR-ROM
+            prg_rom_size = header.prg_rom_lsb * PRG_ROM_BANK_SIZE;
+            chr_rom_size = header.chr_rom_lsb * CHR_ROM_BANK_SIZE;
+            prg_ram_size = 0x2000;
+            chr_ram_size = (chr_rom_size == 0) ? CHR_ROM_BANK_SIZE : 0;
+            submapper = 0;
+            timing = 0;
+        }
+
+        // Calculate mapper ID
+        //Only NES 2.0 has mapper bits in byte 8
+        mapper_id = (header.flag6 & 0xF0) >> 4;
+        if(NES20Format)
+            mapper_id |= (header.flag7 & 0xF0) | ((header.mapper & 0x0F) << 8);
+        else
+            mapper_id |= header.flag7 & 0xF0;
+        bool battery_backed = header.flag6 & 0x02;
+
+        // PRG-ROM
+        if (prg_rom_size == 0 || prg_rom_size > rom->size() - sizeof(header))
         {
             log =  std::string("Error: Failed to read PRG-ROM in ") + filename;
             ok = false;
             return ok;
         }
-        
-        // Read CHR-ROM
-        if (n_chr_rom_banks > 0) 
+        PRG_ROM = rom->data() + sizeof(header);
+
+        // CHR-ROM, right after PRG-ROM
+        if (chr_rom_size > 0) 
         {
-            std::streampos current_pos = file.tellg();
-            file.seekg(0, std::ios::end);
-            std::streamsize remaining_size = file.tellg() - current_pos;
-            file.seekg(current_pos, std::ios::beg);
-            CHR_ROM.resize(static_cast<size_t>(remaining_size));
-
-            // Read the remaining data
-            if (!file.read(reinterpret_cast<char*>(CHR_ROM.data()), remaining_size)) 
+            if (chr_rom_size > rom->size() - sizeof(header) - prg_rom_size)
             {
                 log = std::string("Error: Failed to read CHR-ROM in ") + filename;
                 ok = false;
                 return ok;
             }
+            CHR_ROM = PRG_ROM + prg_rom_size;
         }
 
-        // Calculate mapper ID and initialize mapper
-        mapper_id = (((header.flag6 & 0xF0) >> 4) | (header.flag7 & 0xF0) | ((header.mapper & 0x0F) << 8));
+        //Known dumps with a wrong header are corrected from the ROM database. The key covers PRG and CHR only, so
+        //bytes appended after CHR (titles, padding) don't hide a dump from its entry
+        rom_crc = crc32(PRG_ROM, prg_rom_size + chr_rom_size);
+        if(const RomDatabaseEntry* entry = RomDatabase::find(rom_crc, filename))
+        {
+            if(entry->mapper >= 0)
+                mapper_id = entry->mapper;
+            if(entry->submapper >= 0)
+                submapper = entry->submapper;
+            if(entry->mirroring >= 0)
+            {
+                mirror_mode = static_cast<MIRROR>(entry->mirroring);
+                alternative_layout = (mirror_mode == MIRROR::FOUR_SCREEN);
+            }
+            if(entry->timing >= 0)
+                timing = entry->timing;
+            if(entry->battery >= 0)
+                battery_backed = entry->battery;
+            if(entry->prg_ram_size >= 0)
+                prg_ram_size = entry->prg_ram_size;
+            if(entry->chr_ram_size >= 0)
+                chr_ram_size = entry->chr_ram_size;
+        }
+
+        //RAM is sized from the header, rounded up to a power of two so mapped addresses mirror with a mask.
+        //A CHR-ROM board gets no CHR-RAM, the CHR-RAM size of a board that also has CHR-ROM is ignored
+        prg_ram_mask = (prg_ram_size > 0) ? next_power_of_two(prg_ram_size) - 1 : 0;
+        PRG_RAM.resize((prg_ram_size > 0) ? prg_ram_mask + 1 : 0);
+        if(chr_rom_size == 0)
+        {
+            chr_mask = next_power_of_two(std::max<size_t>(chr_ram_size, 1)) - 1;
+            CHR_RAM.assign(chr_mask + 1, 0);
+        }
+        else
+        {
+            chr_mask = 0xFFFFFFFF;
+            CHR_RAM.clear();
+        }
+
+        //The PPU never writes CHR-ROM, so sharing it across instances is safe
+        CHR = (chr_rom_size == 0) ? CHR_RAM.data() : const_cast<uint8_t*>(CHR_ROM);
+
+        // Initialize mapper
+        bus->set_mirroring_mode(mirror_mode);
         bus->set_mapper(mapper_id);
 
-        switch (mapper_id)
+        if(!create_mapper())
         {
-            case 0: mapper = std::make_unique<NROM>(n_prg_rom_banks, n_chr_rom_banks,  shared_from_this()); break;
-            case 2: mapper = std::make_unique<UxROM>(n_prg_rom_banks, n_chr_rom_banks, shared_from_this()); break;
-            case 3: mapper = std::make_unique<CNROM>(n_prg_rom_banks, n_chr_rom_banks, shared_from_this()); break;
-            case 4: mapper = std::make_unique<TxROM>(n_prg_rom_banks, n_chr_rom_banks, shared_from_this()); break;
-            case 1: mapper = std::make_unique<SxROM>(n_prg_rom_banks, n_chr_rom_banks, shared_from_this()); break;
-            case 7: mapper = std::make_unique<AxROM>(n_prg_rom_banks, n_chr_rom_banks, shared_from_this()); break;
-            case 71: mapper = std::make_unique<UxROM>(n_prg_rom_banks, n_chr_rom_banks, shared_from_this()); break;
-            default:
-                log = std::string("Error: Unsupported mapper ID ") + std::to_string((int)mapper_id);
-                ok =  false;
-                return ok;
+            log = std::string("Error: Unsupported mapper ID ") + std::to_string((int)mapper_id);
+            ok =  false;
+            return ok;
         }
 
+        if(battery_backed)
+            open_battery(filename);
     }
     catch (const std::exception& e)
     {
@@ -138,43 +221,114 @@ bool Cartridge::load_game(const std::string filename, std::string& log)
     return ok;
 }
 
-uint8_t Cartridge::ppu_reads(uint16_t address)
+void Cartridge::open_battery(const std::string& filename)
 {
-    uint8_t data;
+    battery = SaveFile::open(std::filesystem::path(filename).replace_extension(".sav").string(), PRG_RAM.size());
+    if(!battery)
+        return;
+    for(uint32_t address = 0; address < battery->size(); address++)
+        PRG_RAM.write(address, battery->read(address));
+}
 
-    if(n_chr_rom_banks == 0)
-        data = CHR_RAM[mapper->ppu_reads(address)];
-       
-    else
-        data = CHR_ROM[mapper->ppu_reads(address)];
-          
-    return data;
+void Cartridge::close_battery()
+{
+    battery = nullptr;
+}
+
+bool Cartridge::create_mapper()
+{
+    uint32_t chr_size = (chr_rom_size == 0) ? CHR_RAM.size() : chr_rom_size;
+    switch (mapper_id)
+    {
+        case 0: mapper = std::make_unique<NROM>(prg_rom_size, chr_size,  shared_from_this()); break;
+        case 2: mapper = std::make_unique<UxROM>(prg_rom_size, chr_size, shared_from_this()); break;
+        case 3: mapper = std::make_unique<CNROM>(prg_rom_size, chr_size, shared_from_this()); break;
+        case 4: mapper = std::make_unique<TxROM>(prg_rom_size, chr_size, shared_from_this()); break;
+        case 1: mapper = std::make_unique<SxROM>(prg_rom_size, chr_size, shared_from_this()); break;
+        case 7: mapper = std::make_unique<AxROM>(prg_rom_size, chr_size, shared_from_this()); break;
+        case 71: mapper = std::make_unique<UxROM>(prg_rom_size, chr_size, shared_from_this()); break;
+        default: return false;
+    }
+    return true;
+}
+
+void Cartridge::copy_state(const Cartridge& other)
+{
+    //A copy never writes the save file, even when it already held this game from an earlier clone
+    battery = nullptr;
+
+    //Another game, or none yet: take over the other cartridge's ROM image and build a matching mapper.
+    //Cloning between cartridges of the same game skips this and does not allocate
+    if(rom != other.rom || mapper_id != other.mapper_id || !mapper)
+    {
+        rom = other.rom;
+        header = other.header;
+        alternative_layout = other.alternative_layout;
+        prg_rom_size = other.prg_rom_size;
+        chr_rom_size = other.chr_rom_size;
+        mapper_id = other.mapper_id;
+        mirror_mode = other.mirror_mode;
+        PRG_ROM = other.PRG_ROM;
+        CHR_ROM = other.CHR_ROM;
+        submapper = other.submapper;
+        timing = other.timing;
+        rom_crc = other.rom_crc;
+        prg_ram_mask = other.prg_ram_mask;
+        chr_mask = other.chr_mask;
+        CHR_RAM.resize(other.CHR_RAM.size());
+        CHR = (chr_rom_size == 0) ? CHR_RAM.data() : const_cast<uint8_t*>(CHR_ROM);
+        mapper = nullptr;
+        if(other.mapper)
+            create_mapper();
+    }
+
+    PRG_RAM.share(other.PRG_RAM);
+    std::copy(other.CHR_RAM.begin(), other.CHR_RAM.end(), CHR_RAM.begin());
+    if(mapper)
+        mapper->copy_state(*other.mapper);
+}
+
+uint8_t Cartridge::ppu_reads(uint16_t address)
+{
+    PROFILE_ZONE(ZONE_MAPPER);
+    return CHR[mapper->chr_address(address) & chr_mask];
 }
 
 void Cartridge::ppu_writes(uint16_t address, uint8_t value)
 {
-    if(n_chr_rom_banks == 0)
-        CHR_RAM[mapper->ppu_reads(address)] = value;
+    PROFILE_ZONE(ZONE_MAPPER);
+    if(chr_rom_size == 0)
+        CHR_RAM[mapper->chr_address(address) & chr_mask] = value;
 }
 
 uint8_t Cartridge::cpu_reads(uint16_t address)
 {
-    uint8_t data;
+    PROFILE_ZONE(ZONE_MAPPER);
+    //Open bus is approximated as 0: $4020-$5FFF, which no emulated board maps, and $6000-$7FFF without PRG-RAM
+    uint8_t data = 0;
 
     if(address >= 0x6000 && address < 0x8000)
-        data = PRG_RAM[mapper->cpu_reads(address) & 0x7FFF];
-    
+    {
+        if(PRG_RAM.size() > 0)
+            data = PRG_RAM.read(mapper->prg_ram_address(address) & prg_ram_mask);
+    }
     else if(address >= 0x8000 && address <= 0xFFFF)
     {
-        data = PRG_ROM[mapper->cpu_reads(address)];
+        data = read_prg_rom(address);
     }
     return data;
 }
 
 void Cartridge::cpu_writes(uint16_t address, uint8_t value)
 {
-    if(address >= 0x6000 && address < 0x8000)
-        PRG_RAM[mapper->cpu_reads(address) & 0x7FFF] = value;
+    PROFILE_ZONE(ZONE_MAPPER);
+    if(address >= 0x6000 && address < 0x8000 && PRG_RAM.size() > 0)
+    {
+        uint32_t ram_address = mapper->prg_ram_address(address) & prg_ram_mask;
+        PRG_RAM.write(ram_address, value);
+        if(battery)
+            battery->write(ram_address, value);
+    }
 
     if(address >= 0x8000 && address <= 0xFFFF)
         mapper->cpu_writes(address, value);  
@@ -185,24 +339,27 @@ void Cartridge::set_mirroring_mode(MIRROR value)
     bus->set_mirroring_mode(value);
 }
 
+void Cartridge::map_nametable(int page, uint8_t* memory)
+{
+    bus->map_nametable(page, memory);
+}
+
 bool Cartridge::is_new_instruction() 
 { 
     return bus->is_new_instruction();
 }
 
-void Cartridge::set_irq_latch(uint8_t value)
+void Cartridge::set_irq(bool asserted)
 {
-    bus->set_irq_latch(value);
-}
-
-void Cartridge::set_irq_enable(bool value)
-{
-    bus->set_irq_enable(value);
+    if(asserted)
+        bus->assert_irq(MMC3);
+    else
+        bus->ack_irq(MMC3);
 }
 
-void Cartridge::set_irq_reload()
+void Cartridge::A12_rising()
 {
-    bus->set_irq_reload();
+    mapper->A12_rising();
 }
 
 void Cartridge::connect_bus(std::shared_ptr<Bus> bus)
@@ -212,10 +369,19 @@ void Cartridge::connect_bus(std::shared_ptr<Bus> bus)
 
 void Cartridge::soft_reset()
 {
-    CHR_RAM.clear();
+    close_battery();
+    //RAM is zeroed, not emptied, a game loaded afterwards still needs it
+    std::fill(CHR_RAM.begin(), CHR_RAM.end(), 0);
     PRG_RAM.clear();
-    CHR_ROM.clear();
-    PRG_ROM.clear();
+    PRG_ROM = nullptr;
+    CHR_ROM = nullptr;
+    CHR = nullptr;
+    rom = nullptr;
     mapper = nullptr;
     header = Header{};
+    submapper = 0;
+    timing = 0;
+    rom_crc = 0;
+    prg_rom_size = 0;
+    chr_rom_size = 0;
 }
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "Compositor.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace Compositor
+{
+    //Sprite 0 hit never happens at x = 255
+    const int SPRITE_ZERO_LAST_X = 254;
+
+    int compose_line_scalar(const uint8_t* bg_color, const uint8_t* bg_pixel, const uint8_t* sprite_color,
+                            const uint8_t* sprite_flags, const uint32_t* palette, uint32_t* out)
+    {
+        int sprite_zero_x = -1;
+        for(int x = 0; x < LINE_WIDTH; x++)
+        {
+            uint8_t flags = sprite_flags[x];
+            bool bg_opaque = bg_pixel[x] != 0;
+            bool sprite_visible = (flags & SPRITE_OPAQUE) && (!(flags & SPRITE_BEHIND) || !bg_opaque);
+
+            out[x] = palette[(sprite_visible ? sprite_color[x] : bg_color[x]) & 0x3F];
+
+            if(sprite_zero_x < 0 && (flags & SPRITE_ZERO) && bg_opaque && x <= SPRITE_ZERO_LAST_X)
+                sprite_zero_x = x;
+        }
+        return sprite_zero_x;
+    }
+
+#ifdef __SSE2__
+    //Priority is resolved 16 pixels at a time, SSE2 has no gather so the color lookup stays scalar
+    int compose_line_sse2(const uint8_t* bg_color, const uint8_t* bg_pixel, const uint8_t* sprite_color,
+                          const uint8_t* sprite_flags, const uint32_t* palette, uint32_t* out)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i behind_bit = _mm_set1_epi8(SPRITE_BEHIND);
+        const __m128i zero_bit = _mm_set1_epi8(SPRITE_ZERO);
+        const __m128i index_mask = _mm_set1_epi8(0x3F);
+        alignas(16) uint8_t index[LINE_WIDTH];
+        int sprite_zero_x = -1;
+
+        for(int x = 0; x < LINE_WIDTH; x += 16)
+        {
+            __m128i bg = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bg_color + x));
+            __m128i pixel = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bg_pixel + x));
+            __m128i sprite = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sprite_color + x));
+            __m128i flags = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sprite_flags + x));
+
+            __m128i bg_transparent = _mm_cmpeq_epi8(pixel, zero);
+            __m128i opaque = _mm_cmplt_epi8(flags, zero); //SPRITE_OPAQUE is the sign bit
+            __m128i in_front = _mm_cmpeq_epi8(_mm_and_si128(flags, behind_bit), zero);
+            __m128i visible = _mm_and_si128(opaque, _mm_or_si128(in_front, bg_transparent));
+
+            __m128i merged = _mm_or_si128(_mm_and_si128(visible, sprite), _mm_andnot_si128(visible, bg));
+            _mm_store_si128(reinterpret_cast<__m128i*>(index + x), _mm_and_si128(merged, index_mask));
+
+            if(sprite_zero_x < 0)
+            {
+                __m128i hit = _mm_andnot_si128(bg_transparent, _mm_cmpeq_epi8(_mm_and_si128(flags, zero_bit), zero_bit));
+                int hit_bits = _mm_movemask_epi8(hit);
+                if(hit_bits)
+                    sprite_zero_x = x + __builtin_ctz(hit_bits);
+            }
+        }
+
+        for(int x = 0; x < LINE_WIDTH; x++)
+            out[x] = palette[index[x]];
+
+        return sprite_zero_x <= SPRITE_ZERO_LAST_X ? sprite_zero_x : -1;
+    }
+#endif
+
+#ifdef __AVX2__
+    //32 pixels at a time, the colors are fetched with 8 wide gathers
+    int compose_line_avx2(const uint8_t* bg_color, const uint8_t* bg_pixel, const uint8_t* sprite_color,
+                          const uint8_t* sprite_flags, const uint32_t* palette, uint32_t* out)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i behind_bit = _mm256_set1_epi8(SPRITE_BEHIND);
+        const __m256i zero_bit = _mm256_set1_epi8(SPRITE_ZERO);
+        const __m256i index_mask = _mm256_set1_epi8(0x3F);
+        const int* table = reinterpret_cast<const int*>(palette);
+        int sprite_zero_x = -1;
+
+        for(int x = 0; x < LINE_WIDTH; x += 32)
+        {
+            __m256i bg = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bg_color + x));
+            __m256i pixel = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bg_pixel + x));
+            __m256i sprite = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sprite_color + x));
+            __m256i flags = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sprite_flags + x));
+
+            __m256i bg_transparent = _mm256_cmpeq_epi8(pixel, zero);
+            __m256i opaque = _mm256_cmpgt_epi8(zero, flags); //SPRITE_OPAQUE is the sign bit
+            __m256i in_front = _mm256_cmpeq_epi8(_mm256_and_si256(flags, behind_bit), zero);
+            __m256i visible = _mm256_and_si256(opaque, _mm256_or_si256(in_front, bg_transparent));
+
+            __m256i index = _mm256_and_si256(_mm256_blendv_epi8(bg, sprite, visible), index_mask);
+
+            __m128i low = _mm256_castsi256_si128(index);
+            __m128i high = _mm256_extracti128_si256(index, 1);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), _mm256_i32gather_epi32(table, _mm256_cvtepu8_epi32(low), 4));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x + 8), _mm256_i32gather_epi32(table, _mm256_cvtepu8_epi32(_mm_srli_si128(low, 8)), 4));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x + 16), _mm256_i32gather_epi32(table, _mm256_cvtepu8_epi32(high), 4));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x + 24), _mm256_i32gather_epi32(table, _mm256_cvtepu8_epi32(_mm_srli_si128(high, 8)), 4));
+
+            if(sprite_zero_x < 0)
+            {
+                __m256i hit = _mm256_andnot_si256(bg_transparent, _mm256_cmpeq_epi8(_mm256_and_si256(flags, zero_bit), zero_bit));
+                uint32_t hit_bits = (uint32_t)_mm256_movemask_epi8(hit);
+                if(hit_bits)
+                    sprite_zero_x = x + __builtin_ctz(hit_bits);
+            }
+        }
+
+        return sprite_zero_x <= SPRITE_ZERO_LAST_X ? sprite_zero_x : -1;
+    }
+#endif
+
+    int compose_line(const uint8_t* bg_color, const uint8_t* bg_pixel, const uint8_t* sprite_color,
+                     const uint8_t* sprite_flags, const uint32_t* palette, uint32_t* out)
+    {
+#if defined(__AVX2__)
+        return compose_line_avx2(bg_color, bg_pixel, sprite_color, sprite_flags, palette, out);
+#elif defined(__SSE2__)
+        return compose_line_sse2(bg_color, bg_pixel, sprite_color, sprite_flags, palette, out);
+#else
+        return compose_line_scalar(bg_color, bg_pixel, sprite_color, sprite_flags, palette, out);
+#endif
+    }
+
+    const char* backend()
+    {
+#if defined(__AVX2__)
+        return "AVX2";
+#elif defined(__SSE2__)
+        return "SSE2";
+#else
+        return "scalar";
+#endif
+    }
+}
@@ -0,0 +1,48 @@
+#include "Crc32.h"
+#include <array>
+#include <cstring>
+
+namespace
+{
+    const uint32_t POLYNOMIAL = 0xEDB88320;
+
+    //table[0] is the classic byte table, table[k][b] is the CRC of byte b followed by k zero bytes
+    constexpr std::array<std::array<uint32_t, 256>, 8> make_tables()
+    {
+        std::array<std::array<uint32_t, 256>, 8> table{};
+        for(uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t crc = i;
+            for(int bit = 0; bit < 8; bit++)
+                crc = (crc >> 1) ^ ((crc & 1) ? POLYNOMIAL : 0);
+            table[0][i] = crc;
+        }
+        for(int k = 1; k < 8; k++)
+            for(uint32_t i = 0; i < 256; i++)
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+        return table;
+    }
+
+    constexpr std::array<std::array<uint32_t, 256>, 8> table = make_tables();
+}
+
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc)
+{
+    crc = ~crc;
+    //Slicing reads the input as little endian words, which every target of this emulator is
+    while(size >= 8)
+    {
+        uint32_t low;
+        uint32_t high;
+        std::memcpy(&low, data, 4);
+        std::memcpy(&high, data + 4, 4);
+        low ^= crc;
+        crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+              table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^ table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+        data += 8;
+        size -= 8;
+    }
+    while(size--)
+        crc = (crc >> 8) ^ table[0][(crc ^ *data++) & 0xFF];
+    return ~crc;
+}
@@ -0,0 +1,365 @@
+#include "MediaCapture.h"
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    const size_t WAV_HEADER_SIZE = 44;
+
+    void put_u16(uint8_t* out, uint16_t value)
+    {
+        out[0] = value & 0xFF;
+        out[1] = value >> 8;
+    }
+
+    void put_u32(uint8_t* out, uint32_t value)
+    {
+        for(int i = 0; i < 4; i++)
+            out[i] = (value >> (i * 8)) & 0xFF;
+    }
+}
+
+MediaCapture::MediaCapture()
+{
+}
+
+MediaCapture::~MediaCapture()
+{
+    stop();
+}
+
+bool MediaCapture::start(const std::string& base_filename, VideoFormat format, uint32_t rate_numerator,
+                         uint32_t rate_denominator, uint32_t sample_rate)
+{
+    if(recording)
+        return true;
+
+    video = std::fopen((base_filename + (format == Y4M ? ".y4m" : ".rgba")).c_str(), "wb");
+    audio = std::fopen((base_filename + ".wav").c_str(), "wb");
+    if(!video || !audio)
+    {
+        if(video)
+            std::fclose(video);
+        if(audio)
+            std::fclose(audio);
+        video = audio = nullptr;
+        return false;
+    }
+
+    this->format = format;
+    if(format == Y4M)
+        std::fprintf(video, "YUV4MPEG2 W%d H%d F%u:%u Ip A1:1 C420jpeg\n", WIDTH, HEIGHT, rate_numerator, rate_denominator);
+    audio_bytes = 0;
+    write_wav_header(sample_rate);
+
+    if(pool.empty())
+    {
+        for(int i = 0; i < POOL_FRAMES; i++)
+        {
+            pool.push_back(std::make_unique<Slot>());
+            pool.back()->pixels.resize(WIDTH * HEIGHT);
+        }
+    }
+    free_slots.clear();
+    for(std::unique_ptr<Slot>& slot : pool)
+        free_slots.push_back(slot.get());
+    ready_slots.clear();
+
+    staged_samples.clear();
+    staged_silence = 0;
+    staged_repeats = 0;
+    frames_written = 0;
+    frames_dropped = 0;
+    failed = false;
+
+    //Frames repeated before the first one is drawn are black
+    std::vector<uint32_t> black(WIDTH * HEIGHT, 0x000000FF);
+    frame_bytes.resize(format == Y4M ? WIDTH * HEIGHT * 3 / 2 : WIDTH * HEIGHT * 4);
+    convert_frame(black.data());
+
+    stopping = false;
+    recording = true;
+    writer = std::thread(&MediaCapture::write_loop, this);
+    return true;
+}
+
+void MediaCapture::stop()
+{
+    if(!recording)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_ready.notify_one();
+    writer.join();
+
+    //Frames dropped after the last one handed over, written here with their audio now that the writer is gone.
+    //Audio of a frame that never ended is left out
+    if(staged_repeats > 0 && !failed)
+    {
+        Slot tail;
+        tail.repeats = staged_repeats - 1;
+        tail.samples.swap(staged_samples);
+        tail.silence = staged_silence;
+        write_slot(tail);
+    }
+
+    uint8_t size[4];
+    put_u32(size, 36 + audio_bytes);
+    std::fseek(audio, 4, SEEK_SET);
+    std::fwrite(size, 1, 4, audio);
+    put_u32(size, audio_bytes);
+    std::fseek(audio, 40, SEEK_SET);
+    std::fwrite(size, 1, 4, audio);
+
+    std::fclose(video);
+    std::fclose(audio);
+    video = audio = nullptr;
+    recording = false;
+}
+
+void MediaCapture::end_frame(const std::vector<uint32_t>* screen)
+{
+    Slot* slot = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!free_slots.empty())
+        {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        }
+    }
+    if(!slot)
+    {
+        staged_repeats++;
+        frames_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    slot->has_pixels = screen != nullptr;
+    if(screen)
+        std::copy_n(screen->data(), WIDTH * HEIGHT, slot->pixels.data());
+    slot->repeats = staged_repeats;
+    slot->samples.swap(staged_samples);
+    slot->silence = staged_silence;
+    staged_samples.clear();
+    staged_silence = 0;
+    staged_repeats = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ready_slots.push_back(slot);
+    }
+    work_ready.notify_one();
+}
+
+void MediaCapture::write_loop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true)
+    {
+        work_ready.wait(lock, [this] { return !ready_slots.empty() || stopping; });
+        //Everything handed over before stop is written
+        if(ready_slots.empty())
+            return;
+
+        Slot* slot = ready_slots.front();
+        ready_slots.pop_front();
+        lock.unlock();
+        if(!failed.load(std::memory_order_relaxed))
+            write_slot(*slot);
+        lock.lock();
+        free_slots.push_back(slot);
+    }
+}
+
+void MediaCapture::write_slot(Slot& slot)
+{
+    for(uint32_t i = 0; i < slot.repeats; i++)
+        write_frame();
+
+    if(slot.has_pixels)
+        convert_frame(slot.pixels.data());
+    write_frame();
+
+    bool ok = std::fwrite(slot.samples.data(), sizeof(int16_t), slot.samples.size(), audio) == slot.samples.size();
+    audio_bytes += slot.samples.size() * sizeof(int16_t);
+    if(slot.silence)
+    {
+        silence_buffer.resize(std::max<size_t>(silence_buffer.size(), slot.silence));
+        ok = ok && std::fwrite(silence_buffer.data(), sizeof(int16_t), slot.silence, audio) == slot.silence;
+        audio_bytes += slot.silence * sizeof(int16_t);
+    }
+    if(!ok)
+        failed = true;
+}
+
+void MediaCapture::convert_frame(const uint32_t* pixels)
+{
+    if(format == Y4M)
+    {
+        uint8_t* y = frame_bytes.data();
+        YUV::rgba_to_yuv420(pixels, WIDTH, HEIGHT, y, y + WIDTH * HEIGHT, y + WIDTH * HEIGHT * 5 / 4);
+    }
+    else
+        std::copy_n(reinterpret_cast<const uint8_t*>(pixels), frame_bytes.size(), frame_bytes.data());
+}
+
+void MediaCapture::write_frame()
+{
+    static const char FRAME_HEADER[] = "FRAME\n";
+    bool ok = true;
+    if(format == Y4M)
+        ok = std::fwrite(FRAME_HEADER, 1, sizeof(FRAME_HEADER) - 1, video) == sizeof(FRAME_HEADER) - 1;
+    ok = ok && std::fwrite(frame_bytes.data(), 1, frame_bytes.size(), video) == frame_bytes.size();
+    if(ok)
+        frames_written.fetch_add(1, std::memory_order_relaxed);
+    else
+        failed = true;
+}
+
+//16 bit PCM, mono. The two sizes are filled in by stop
+void MediaCapture::write_wav_header(uint32_t sample_rate)
+{
+    uint8_t header[WAV_HEADER_SIZE] = {};
+    std::copy_n("RIFF", 4, header);
+    std::copy_n("WAVEfmt ", 8, header + 8);
+    put_u32(header + 16, 16);
+    put_u16(header + 20, 1);
+    put_u16(header + 22, 1);
+    put_u32(header + 24, sample_rate);
+    put_u32(header + 28, sample_rate * sizeof(int16_t));
+    put_u16(header + 32, sizeof(int16_t));
+    put_u16(header + 34, 16);
+    std::copy_n("data", 4, header + 36);
+    std::fwrite(header, 1, WAV_HEADER_SIZE, audio);
+}
+
+namespace YUV
+{
+    //BT.601 studio range in 8 bit fixed point. Chroma takes the sum of 4 pixels, so it shifts by 2 more
+    const int Y_R = 66, Y_G = 129, Y_B = 25, Y_OFFSET = (16 << 8) + 128;
+    const int U_R = -38, U_G = -74, U_B = 112;
+    const int V_R = 112, V_G = -94, V_B = -18;
+    const int C_OFFSET = (128 << 10) + 512;
+
+    void rgba_to_yuv420_scalar(const uint32_t* rgba, int width, int height, uint8_t* y, uint8_t* u, uint8_t* v)
+    {
+        for(int i = 0; i < width * height; i++)
+        {
+            uint32_t pixel = rgba[i];
+            int r = pixel >> 24, g = (pixel >> 16) & 0xFF, b = (pixel >> 8) & 0xFF;
+            y[i] = (Y_R * r + Y_G * g + Y_B * b + Y_OFFSET) >> 8;
+        }
+
+        for(int row = 0; row < height; row += 2)
+        {
+            const uint32_t* top = rgba + row * width;
+            const uint32_t* bottom = top + width;
+            for(int x = 0; x < width; x += 2)
+            {
+                int r = 0, g = 0, b = 0;
+                for(uint32_t pixel : {top[x], top[x + 1], bottom[x], bottom[x + 1]})
+                {
+                    r += pixel >> 24;
+                    g += (pixel >> 16) & 0xFF;
+                    b += (pixel >> 8) & 0xFF;
+                }
+                int index = (row / 2) * (width / 2) + x / 2;
+                u[index] = (U_R * r + U_G * g + U_B * b + C_OFFSET) >> 10;
+                v[index] = (V_R * r + V_G * g + V_B * b + C_OFFSET) >> 10;
+            }
+        }
+    }
+
+#ifdef __SSE2__
+    //Two 16 bit coefficients per 32 bit lane, for _mm_madd_epi16
+    static __m128i coefficient_pair(int16_t low, int16_t high)
+    {
+        return _mm_set1_epi32(static_cast<uint16_t>(low) | (static_cast<uint32_t>(static_cast<uint16_t>(high)) << 16));
+    }
+
+    //A 0xRRGGBBAA word shifted right by 8 in each 16 bit half is the pair (B, R), masked with 0x00FF00FF the pair
+    //(A, G). One multiply-add of each against its coefficients gives the weighted sum of a pixel in a 32 bit lane
+    void rgba_to_yuv420_sse2(const uint32_t* rgba, int width, int height, uint8_t* y, uint8_t* u, uint8_t* v)
+    {
+        const __m128i low_bytes = _mm_set1_epi32(0x00FF00FF);
+        const __m128i y_br = coefficient_pair(Y_B, Y_R), y_ag = coefficient_pair(0, Y_G);
+        const __m128i u_br = coefficient_pair(U_B, U_R), u_ag = coefficient_pair(0, U_G);
+        const __m128i v_br = coefficient_pair(V_B, V_R), v_ag = coefficient_pair(0, V_G);
+        const __m128i y_offset = _mm_set1_epi32(Y_OFFSET);
+        const __m128i c_offset = _mm_set1_epi32(C_OFFSET);
+
+        for(int i = 0; i < width * height; i += 16)
+        {
+            __m128i luma[4];
+            for(int k = 0; k < 4; k++)
+            {
+                __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + i + k * 4));
+                __m128i br = _mm_srli_epi16(pixels, 8);
+                __m128i ag = _mm_and_si128(pixels, low_bytes);
+                __m128i sum = _mm_add_epi32(_mm_madd_epi16(br, y_br), _mm_madd_epi16(ag, y_ag));
+                luma[k] = _mm_srli_epi32(_mm_add_epi32(sum, y_offset), 8);
+            }
+            __m128i packed = _mm_packus_epi16(_mm_packs_epi32(luma[0], luma[1]), _mm_packs_epi32(luma[2], luma[3]));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(y + i), packed);
+        }
+
+        for(int row = 0; row < height; row += 2)
+        {
+            const uint32_t* top = rgba + row * width;
+            const uint32_t* bottom = top + width;
+            for(int x = 0; x < width; x += 16)
+            {
+                //Each 2x2 block summed into lanes 0 and 2 of a group of 4 pixels, then 4 blocks gathered per vector
+                __m128i br_blocks[4], ag_blocks[4];
+                for(int k = 0; k < 4; k++)
+                {
+                    __m128i upper = _mm_loadu_si128(reinterpret_cast<const __m128i*>(top + x + k * 4));
+                    __m128i lower = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom + x + k * 4));
+                    __m128i br = _mm_add_epi16(_mm_srli_epi16(upper, 8), _mm_srli_epi16(lower, 8));
+                    __m128i ag = _mm_add_epi16(_mm_and_si128(upper, low_bytes), _mm_and_si128(lower, low_bytes));
+                    br_blocks[k] = _mm_add_epi16(br, _mm_shuffle_epi32(br, _MM_SHUFFLE(2, 3, 0, 1)));
+                    ag_blocks[k] = _mm_add_epi16(ag, _mm_shuffle_epi32(ag, _MM_SHUFFLE(2, 3, 0, 1)));
+                }
+
+                __m128i u_sums[2], v_sums[2];
+                for(int half = 0; half < 2; half++)
+                {
+                    __m128i br = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(br_blocks[half * 2]),
+                                                                 _mm_castsi128_ps(br_blocks[half * 2 + 1]), _MM_SHUFFLE(2, 0, 2, 0)));
+                    __m128i ag = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(ag_blocks[half * 2]),
+                                                                 _mm_castsi128_ps(ag_blocks[half * 2 + 1]), _MM_SHUFFLE(2, 0, 2, 0)));
+                    __m128i u_sum = _mm_add_epi32(_mm_madd_epi16(br, u_br), _mm_madd_epi16(ag, u_ag));
+                    __m128i v_sum = _mm_add_epi32(_mm_madd_epi16(br, v_br), _mm_madd_epi16(ag, v_ag));
+                    u_sums[half] = _mm_srai_epi32(_mm_add_epi32(u_sum, c_offset), 10);
+                    v_sums[half] = _mm_srai_epi32(_mm_add_epi32(v_sum, c_offset), 10);
+                }
+
+                int index = (row / 2) * (width / 2) + x / 2;
+                __m128i u_packed = _mm_packs_epi32(u_sums[0], u_sums[1]);
+                __m128i v_packed = _mm_packs_epi32(v_sums[0], v_sums[1]);
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(u + index), _mm_packus_epi16(u_packed, u_packed));
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(v + index), _mm_packus_epi16(v_packed, v_packed));
+            }
+        }
+    }
+#endif
+
+    void rgba_to_yuv420(const uint32_t* rgba, int width, int height, uint8_t* y, uint8_t* u, uint8_t* v)
+    {
+#ifdef __SSE2__
+        if(width % 16 == 0)
+        {
+            rgba_to_yuv420_sse2(rgba, width, height, y, u, v);
+            return;
+        }
+#endif
+        rgba_to_yuv420_scalar(rgba, width, height, y, u, v);
+    }
+}
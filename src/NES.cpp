@@ -1,17 +1,27 @@
 // Standard Library Headers
+#include <algorithm>
 #include <filesystem>
 #include "NES.h"
+#include "Profiler.h"
 
 // Clock Rates
-const double MASTER_CLOCK_NTSC = 236250000.0 / 11.0;
-const double MASTER_CLOCK_PAL = 26601712.5;
-const double CPU_CLOCK_NTSC = MASTER_CLOCK_NTSC / 12.0;
-const double CPU_CLOCK_PAL = MASTER_CLOCK_PAL / 16.0;
-const double SAMPLE_RATE = 44100.0;
+constexpr double MASTER_CLOCK_NTSC = 236250000.0 / 11.0;
+constexpr double MASTER_CLOCK_PAL = 26601712.5;
+constexpr double CPU_CLOCK_NTSC = MASTER_CLOCK_NTSC / 12.0;
+constexpr double CPU_CLOCK_PAL = MASTER_CLOCK_PAL / 16.0;
+constexpr double SAMPLE_RATE = 44100.0;
+
+// Frame rates as fractions, master clock / (master clocks per dot * dots per frame). NTSC frames average
+// 341 * 262 - 0.5 dots with the odd frame skip
+constexpr uint32_t FRAME_RATE_NTSC[2] = {39375000, 655171};
+constexpr uint32_t FRAME_RATE_PAL[2] = {10636685, 212784};
 
 // APU Ratios
-const double apu_ratio_NTSC = CPU_CLOCK_NTSC / SAMPLE_RATE;
-const double apu_ratio_PAL = CPU_CLOCK_PAL / SAMPLE_RATE;
+constexpr double apu_ratio_NTSC = CPU_CLOCK_NTSC / SAMPLE_RATE;
+constexpr double apu_ratio_PAL = CPU_CLOCK_PAL / SAMPLE_RATE;
+
+// PAL runs 16 PPU dots every 5 CPU cycles (3.2 per cycle): 3, 3, 3, 3, 4
+constexpr uint8_t PAL_CADENCE_LENGTH = 5;
 
 NES::NES()
 {
@@ -27,6 +37,12 @@ NES::NES()
     apu->connect_bus(bus);
 }
 
+//The components reference each other through the bus and outlive the NES, so the save file is closed here
+NES::~NES()
+{
+    cart->close_battery();
+}
+
 bool NES::load_game(std::string filename)
 {
     reset_flag = true;
@@ -36,7 +52,15 @@ bool NES::load_game(std::string filename)
         old_game_filename = filename;           
         reset();
         if(cart->load_game(filename, log))
-            game_loaded = true; 
+        {
+            game_loaded = true;
+            //Dendy runs 3 dots per CPU cycle on a 312 line frame, neither of the timings here. It is run as NTSC,
+            //which keeps the CPU / PPU ratio, and the region says so
+            uint8_t timing = cart->get_timing();
+            set_region(timing == 1);
+            if(timing == 3)
+                region_info = "NTSC (Dendy timing not emulated)";
+        }
         if(std::filesystem::is_regular_file(log))
         {
             log = std::filesystem::path(log).stem().string();
@@ -54,49 +78,128 @@ bool NES::load_game(std::string filename)
 
 void NES::run_frame()
 {
+    PROFILE_ZONE(ZONE_FRAME);
     current_frame = ppu->get_frame();
 
-    while (current_frame == ppu->get_frame() && !pause && !reset_flag) 
-    {          
-        cpu->tick();
-        apu->tick();
+    //The whole visible frame is drawn inside this call, so the decision can be taken per frame
+    bool render = render_interval > 0 && frames_since_render == 0;
+    if(render_interval > 0)
+        frames_since_render = (frames_since_render + 1) % render_interval;
 
-        apu_cycle_accumulator += 1;
-        double apu_ratio = region ? apu_ratio_PAL : apu_ratio_NTSC;
-        if (apu_cycle_accumulator >= apu_ratio)
-        {
-            double alpha = apu_cycle_accumulator - apu_ratio;
-            double previous_sample = last_sample;
-            double current_sample = apu->get_output();
-            
-            // Linear interpolation to fill holes in audio
-            double interpolated_sample = (previous_sample * (1.0 - alpha)) +( current_sample * alpha);
-            {
-                audio_buffer[*write_pos] = interpolated_sample * 32767;
-                *write_pos = (*write_pos+1) & (buffer_size - 1);
-            }
+    //The zapper needs the frame being emulated, other threads would draw it too late
+    bool use_turbo = turbo && !zapper_connected;
+    bool pipelined = pipeline && !zapper_connected && !use_turbo;
+    if(pipelined && !pipeline_running)
+    {
+        ppu_log.begin(*cart);
+        pipeline->start(*ppu, *cart);
+        pipeline_running = true;
+    }
+    else if(!pipelined && pipeline_running)
+        stop_pipeline();
+
+    //A turbo frame starts from a copy of the PPU, so it has to begin where the timing only PPU fetches everything
+    //again before drawing
+    bool turbo_frame = use_turbo && render && at_frame_start && turbo->begin_frame(*ppu, *cart);
+    if(turbo_frame)
+        ppu_log.begin(*cart);
+    bus->set_ppu_log((pipeline_running || turbo_frame) ? &ppu_log : nullptr);
+    ppu->set_render_output(render && !pipelined && !use_turbo);
+    uint32_t start_dot = ppu->get_dot_clock();
 
-            last_sample = current_sample;
-            apu_cycle_accumulator -= apu_ratio;
+    if(region)
+        run_frame_loop<true>();
+    else
+        run_frame_loop<false>();
+
+    bool frame_complete = current_frame != ppu->get_frame();
+    at_frame_start = frame_complete || (at_frame_start && ppu->get_dot_clock() == start_dot);
+    frame_source = SERIAL_PPU;
+    if(pipelined)
+    {
+        pipeline->submit(ppu_log, ppu->get_dot_clock(), frame_complete, render);
+        frame_source = PIPELINE;
+    }
+    else if(use_turbo)
+    {
+        if(turbo_frame && frame_complete)
+            turbo->end_frame(ppu_log, ppu->get_dot_clock());
+        else if(turbo_frame)
+            turbo->cancel_frame();
+        turbo_frame_collected = turbo->collect();
+        frame_source = TURBO;
+    }
+
+    //A frame cut short by pause or reset goes on in the next call, its samples are kept until it ends.
+    //The pipelined PPU hands its frames over one frame late, the video trails the audio by as much
+    if(capture && frame_complete)
+        capture->end_frame(is_frame_rendered() ? &get_screen() : nullptr);
+}
+
+template <bool PAL>
+void NES::tick_apu_and_ppu()
+{
+    constexpr double apu_ratio = PAL ? apu_ratio_PAL : apu_ratio_NTSC;
+    apu->tick<PAL>();
+
+    apu_cycle_accumulator += 1;
+    if (apu_cycle_accumulator >= apu_ratio)
+    {
+        PROFILE_ZONE(ZONE_AUDIO_RESAMPLE);
+        double alpha = apu_cycle_accumulator - apu_ratio;
+        double previous_sample = last_sample;
+        double current_sample = apu->get_output();
+        
+        // Linear interpolation to fill holes in audio
+        double interpolated_sample = (previous_sample * (1.0 - alpha)) +( current_sample * alpha);
+        int16_t sample = interpolated_sample * 32767;
+        if(audio_buffer)
+        {
+            audio_buffer[*write_pos] = sample;
+            *write_pos = (*write_pos+1) & (buffer_size - 1);
         }
+        if(capture)
+            capture->add_sample(sample);
+
+        last_sample = current_sample;
+        apu_cycle_accumulator -= apu_ratio;
+    }
 
-        //Depending on the region, after every cpu tick, the ppu will tick either 3 or 3.2 times
-        if (!region)  // NTSC
+    //After every cpu tick the ppu ticks 3 times, PAL adds a fourth tick every 5 cycles
+    ppu->tick<PAL>();
+    ppu->tick<PAL>();
+    ppu->tick<PAL>();
+    if constexpr(PAL)
+    {
+        pal_cadence++;
+        if(pal_cadence == PAL_CADENCE_LENGTH)
         {
-            ppu->tick();
-            ppu->tick();
-            ppu->tick();
-        } 
+            ppu->tick<PAL>();
+            pal_cadence = 0;
+        }
+    }
+}
 
-        else // PAL
+template <bool PAL>
+void NES::run_frame_loop()
+{
+    while (current_frame == ppu->get_frame() && !pause && !reset_flag) 
+    {          
+        //Idle loop cycles that read nothing the other chips change are not run, only counted
+        if(cpu->can_skip_idle_cycles())
         {
-            ppu_accumulator += 3.2;
-            while (ppu_accumulator >= 1.0)
+            uint32_t skipped = 0;
+            do
             {
-                ppu->tick();
-                ppu_accumulator -= 1.0;
-            }
-        }     
+                tick_apu_and_ppu<PAL>();
+                skipped++;
+            } while(current_frame == ppu->get_frame() && cpu->can_skip_idle_cycles());
+            cpu->skip_idle_cycles(skipped);
+            continue;
+        }
+
+        cpu->tick();
+        tick_apu_and_ppu<PAL>();
     }
 }
 
@@ -108,10 +211,16 @@ void NES::change_pause(SDL_AudioDeviceID audio_device)
 
 void NES::change_timing()
 {
-    region = !region;
+    set_region(!region);
+}
+
+void NES::set_region(bool pal)
+{
+    stop_pipeline();
+    region = pal;
     region_info = (region) ? "PAL" : "NTSC";
     ppu->set_ppu_timing(region);
-    apu->set_timing(region);                       
+    apu->set_timing(region);
 }
 
 bool NES::is_game_loaded()
@@ -131,13 +240,15 @@ std::shared_ptr<CPU> NES::get_cpu()
 
 void NES::reset()
 {
+    stop_pipeline();
     cpu->soft_reset();
     ppu->soft_reset();
     cart->soft_reset();
     bus->soft_reset();
     apu->soft_reset();
     game_loaded = false;
-    ppu_accumulator = 0;
+    pal_cadence = 0;
+    at_frame_start = true;
     pause = false;
     log = "";
     region = 0;
@@ -145,6 +256,11 @@ void NES::reset()
     
 }
 
+void NES::press_reset()
+{
+    cpu->trigger_reset();
+}
+
 void NES::reload_game()
 {
     reset_flag = true;
@@ -190,10 +306,239 @@ std::string NES::get_info()
     return info;
 }
 
+void NES::clone_into(NES& target)
+{
+    target.stop_pipeline();
+    target.cart->copy_state(*cart);
+    target.cpu->copy_state(*cpu);
+    target.ppu->copy_state(*ppu);
+    target.apu->copy_state(*apu);
+    target.bus->copy_state(*bus);
+
+    target.current_frame = current_frame;
+    target.pal_cadence = pal_cadence;
+    target.at_frame_start = at_frame_start;
+    target.region = region;
+    target.pause = pause;
+    target.game_loaded = game_loaded;
+    target.zapper_connected = zapper_connected;
+    target.apu_cycle_accumulator = apu_cycle_accumulator;
+    target.last_sample = last_sample;
+    target.old_game_filename = old_game_filename;
+    target.game_title = game_title;
+    target.region_info = region_info;
+}
+
+std::unique_ptr<NES> NESPool::clone(NES& source)
+{
+    std::unique_ptr<NES> nes;
+    if(free_machines.empty())
+        nes = std::make_unique<NES>();
+    else
+    {
+        nes = std::move(free_machines.back());
+        free_machines.pop_back();
+    }
+    source.clone_into(*nes);
+    return nes;
+}
+
+void NESPool::release(std::unique_ptr<NES> nes)
+{
+    if(nes)
+        free_machines.push_back(std::move(nes));
+}
+
 bool NES::set_audio_buffer(int16_t *buffer, int BUFFER_SIZE, uint16_t *WRITE_POS)
 {
     audio_buffer = buffer;
     buffer_size = BUFFER_SIZE;
     write_pos = WRITE_POS;
     return true;
-}
\ No newline at end of file
+}
+
+uint8_t NES::peek(uint16_t address)
+{
+    return cpu->peek(address);
+}
+
+void NES::set_render_interval(int interval)
+{
+    interval = (interval < 0) ? 0 : interval;
+    if(interval != render_interval)
+    {
+        render_interval = interval;
+        frames_since_render = 0;
+    }
+}
+
+bool NES::is_frame_rendered()
+{
+    switch(frame_source)
+    {
+        case PIPELINE: return pipeline->is_frame_ready();
+        case TURBO: return turbo_frame_collected;
+        default: return ppu->get_render_output();
+    }
+}
+
+std::vector<uint32_t>& NES::get_screen()
+{
+    switch(frame_source)
+    {
+        case PIPELINE: return pipeline->get_frame();
+        case TURBO: return turbo->get_frame();
+        default: return ppu->get_screen();
+    }
+}
+
+bool NES::start_trace(std::string filename)
+{
+    return cpu->start_trace(filename);
+}
+
+void NES::stop_trace()
+{
+    cpu->stop_trace();
+}
+
+bool NES::is_tracing()
+{
+    return cpu->is_tracing();
+}
+
+bool NES::start_capture(std::string base_filename, MediaCapture::VideoFormat format)
+{
+    if(!capture)
+        capture = std::make_unique<MediaCapture>();
+    const uint32_t* rate = region ? FRAME_RATE_PAL : FRAME_RATE_NTSC;
+    if(!capture->start(base_filename, format, rate[0], rate[1], static_cast<uint32_t>(SAMPLE_RATE)))
+    {
+        capture.reset();
+        return false;
+    }
+    return true;
+}
+
+void NES::stop_capture()
+{
+    capture.reset();
+}
+
+bool NES::is_capturing()
+{
+    return capture != nullptr;
+}
+
+uint64_t NES::get_capture_frames_dropped()
+{
+    return capture ? capture->get_frames_dropped() : 0;
+}
+
+void NES::set_idle_skip(bool enabled)
+{
+    cpu->set_idle_skip(enabled);
+}
+
+bool NES::get_idle_skip()
+{
+    return cpu->get_idle_skip();
+}
+
+uint64_t NES::get_idle_loops_detected()
+{
+    return cpu->get_idle_loops_detected();
+}
+
+uint64_t NES::get_idle_cycles_replayed()
+{
+    return cpu->get_idle_cycles_replayed();
+}
+
+uint64_t NES::get_idle_cycles_skipped()
+{
+    return cpu->get_idle_cycles_skipped();
+}
+
+void NES::set_block_mode(BlockMode mode)
+{
+    cpu->set_block_mode(mode);
+}
+
+BlockMode NES::get_block_mode()
+{
+    return cpu->get_block_mode();
+}
+
+uint64_t NES::get_decoded_instructions()
+{
+    return cpu->get_decoded_instructions();
+}
+
+uint64_t NES::get_block_mismatches()
+{
+    return cpu->get_block_mismatches();
+}
+
+std::string NES::get_block_mismatch_report()
+{
+    return cpu->get_block_mismatch_report();
+}
+
+void NES::set_cpu_probe(CPUProbe* probe)
+{
+    cpu->set_probe(probe);
+}
+
+void NES::set_pipelined_ppu(bool enabled)
+{
+    if(enabled == (pipeline != nullptr))
+        return;
+    stop_pipeline();
+    pipeline = enabled ? std::make_unique<PPUPipeline>() : nullptr;
+}
+
+bool NES::get_pipelined_ppu()
+{
+    return pipeline != nullptr;
+}
+
+void NES::set_turbo_render(int workers)
+{
+    workers = std::max(workers, 0);
+    if(workers == get_turbo_render())
+        return;
+    //The frames it drew are gone with it
+    if(frame_source == TURBO)
+        frame_source = SERIAL_PPU;
+    turbo = (workers > 0) ? std::make_unique<TurboRenderer>(workers) : nullptr;
+}
+
+int NES::get_turbo_render()
+{
+    return turbo ? turbo->get_workers() : 0;
+}
+
+void NES::finish_frame()
+{
+    if(frame_source == PIPELINE)
+        pipeline->wait();
+    else if(frame_source == TURBO)
+    {
+        turbo->wait();
+        if(turbo->collect())
+            turbo_frame_collected = true;
+    }
+}
+
+//Back to the serial PPU. The next run_frame starts the pipeline over from the machine's state at that point
+void NES::stop_pipeline()
+{
+    if(!pipeline_running)
+        return;
+    pipeline->wait();
+    bus->set_ppu_log(nullptr);
+    pipeline_running = false;
+    if(frame_source == PIPELINE)
+        frame_source = SERIAL_PPU;
+}
@@ -1,31 +1,40 @@
 #include <iostream>
 #include <cstdint>
+#include <cstring>
 #include "PPU.h"
 #include "Bus.h"
+#include "Profiler.h"
+#include "Compositor.h"
 #include <sstream>
 #include <iomanip>
 
-PPU::PPU() : w(false) ,cycles(0), scanline(0)
+//Dots A12 must stay low before a rising edge reaches the mapper
+const uint32_t A12_FILTER_DOTS = 10;
+
+PPU::PPU()
 {
+    w = false;
+    cycles = 0;
+    scanline = 0;
     odd = false;
     frame = false;
     screen = std::vector<uint32_t>( 256*240 );
-    scanline_buffer = std::vector<uint8_t>( 256 );
-    pattern_buffer = std::vector<uint32_t>( 128*128 );
-    nametable_buffer = std::vector<uint32_t>( 256 * 240 );
-    sprite_buffer = std::vector<uint32_t>(64 * 64);
     ppu_timing = 0;
     pre_render_scanline = 261;
     secondary_oam_index = 0;
     i = 0;
     mapper = 0;
+    update_nametable_pages();
 }
 
 PPU::~PPU() {}
 
 
+template <bool PAL>
 void PPU::tick()
 {
+    constexpr int PRE_RENDER_SCANLINE = PAL ? 311 : 261;
+    PROFILE_ZONE(ZONE_PPU_TICK);
     //Delay for toggling rendering, important for Battletoads
     if((is_rendering_enabled != ((PPUMASK >> 3) & 0x3)))
     {
@@ -39,21 +48,28 @@ void PPU::tick()
 
     if(is_rendering_enabled)
     {
-        if((scanline < 240) || (scanline == pre_render_scanline))
+        if((scanline < 240) || (scanline == PRE_RENDER_SCANLINE))
         {
             //Render background
             if(((cycles > 0) && (cycles < 257)) || ((cycles > 320) && (cycles < 337)))
             {
-                if((scanline != pre_render_scanline) && (cycles < 257) && (PPUMASK & 0x8))
+                //Without pixel output the tiles only feed the sprite 0 hit test, so they are only fetched for lines
+                //with sprite 0. The bus addresses are still put out for the MMC3 A12 counter
+                bool fetch = render_output || ((cycles < 257) ? sprite_0_current_scanline : sprite_0_next_scanline);
+                if((scanline != PRE_RENDER_SCANLINE) && (cycles < 257) && (PPUMASK & 0x8) && needs_background_pixel())
                     draw_background_pixel();
-                shift_bits(); 
+                if(fetch)
+                    shift_bits(); 
 
                 switch(cycles & 0x7)
                 {
                     case 0:
                     {
-                        bg_msb = read(PPU_BUS);
-                        load_shifters();
+                        if(fetch)
+                        {
+                            bg_msb = read(PPU_BUS);
+                            load_shifters();
+                        }
                         increment_hori_v(); 
                         if(cycles == 256)
                             increment_vert_v();       
@@ -67,7 +83,8 @@ void PPU::tick()
                     
                     case 2:
                     {
-                        nametable_id = read(PPU_BUS);
+                        if(fetch)
+                            nametable_id = read(PPU_BUS);
                         break;
                     }
 
@@ -79,7 +96,8 @@ void PPU::tick()
 
                     case 4:
                     {
-                        attribute = read(PPU_BUS);
+                        if(fetch)
+                            attribute = read(PPU_BUS);
                         break;
                     }
 
@@ -91,7 +109,8 @@ void PPU::tick()
 
                     case 6:
                     {
-                        bg_lsb = read(PPU_BUS);
+                        if(fetch)
+                            bg_lsb = read(PPU_BUS);
                         break;
                     }
 
@@ -107,12 +126,17 @@ void PPU::tick()
             if((cycles == 257))
                 v = (v & ~(0x41F)) | (t & 0x41F);  
 
-            if(((cycles >= 280) && ((cycles < 305))) && (scanline == pre_render_scanline))
+            if(((cycles >= 280) && ((cycles < 305))) && (scanline == PRE_RENDER_SCANLINE))
                 v = (v & ~(0x7BE0)) | (t & 0x7BE0);
 
             //Sprite evaluation for next scanline
-            if((scanline != pre_render_scanline) && (cycles > 64) && ( cycles < 257))
-                sprite_evaluation();
+            if((scanline != PRE_RENDER_SCANLINE) && (cycles > 64) && ( cycles < 257))
+            {
+                if(cycles == 65)
+                    sprite_evaluation();
+                else if(cycles == sprite_overflow_dot)
+                    PPUSTATUS |= 0x20;
+            }
             
             //Sprite fetches
             if((cycles > 256) && (cycles < 321))
@@ -182,9 +206,6 @@ void PPU::tick()
                 }            
             }
 
-            //Drawing sprites
-            if((is_rendering_enabled & 0x2)  && cycles == 256 && scanline != pre_render_scanline && scanline != 0)
-                draw_sprite_pixel();
             //Clearing OAMADDR
             if( (cycles >= 257) && (cycles <= 320) )
                 OAMADDR = 0;
@@ -202,11 +223,15 @@ void PPU::tick()
     }
 
     //When background is disabled draw the ext color
-    if(((is_rendering_enabled & 1) == 0) && (scanline < 240) && cycles > 0 && cycles < 257)
+    if(((is_rendering_enabled & 1) == 0) && (scanline < 240) && cycles > 0 && cycles < 257 && needs_background_pixel())
         draw_background_pixel();
+
+    //Line finished, merge the sprites in and write it out. Only composition happens here so it can be skipped when not rendering
+    if((scanline < 240) && (cycles == 256) && render_output)
+        draw_scanline();
     
     //Clear vblank, sprite overflow and sprite 0 flag
-    if((scanline == pre_render_scanline) && (cycles == 1))
+    if((scanline == PRE_RENDER_SCANLINE) && (cycles == 1))
         PPUSTATUS &= 0x1F;
     
     //Set vblank flag and fire NMI
@@ -217,13 +242,24 @@ void PPU::tick()
         if((PPUCTRL & 0x80) && (PPUSTATUS & 0x80))
             bus->set_nmi(true);
         frame = !frame;   
+        if(debug_view_frames.load(std::memory_order_relaxed) > 0)
+        {
+            take_debug_snapshot();
+            debug_view_frames.fetch_sub(1, std::memory_order_relaxed);
+        }
     } 
 
     if((PPUSTATUS & 0x80) || !is_rendering_enabled)
         PPU_BUS = v;
     
+    //A12 only changes a few times per line, the edge filter works from the time it went low
     if(mapper == 4)
-        detect_filtered_A12();
+    {
+        bool A12 = PPU_BUS & 0x1000;
+        if(A12 != prev_A12)
+            A12_changed(A12);
+    }
+    dot_clock++;
     cycles++;
     if(cycles == 341)
     {
@@ -234,10 +270,10 @@ void PPU::tick()
         sprite_0_current_scanline = sprite_0_next_scanline;
         supress = false;
         
-        if(scanline == (pre_render_scanline+1))
+        if(scanline == (PRE_RENDER_SCANLINE+1))
         {
             scanline = 0;
-            if( is_rendering_enabled && odd && (ppu_timing == 0))
+            if(!PAL && is_rendering_enabled && odd)
                 cycles = 1;
             odd ^= 1;
         }
@@ -246,6 +282,9 @@ void PPU::tick()
     }
 }
 
+template void PPU::tick<false>();
+template void PPU::tick<true>();
+
 uint8_t PPU::read(uint16_t address)
 {
     uint8_t data;
@@ -259,48 +298,8 @@ uint8_t PPU::read(uint16_t address)
 
     else if((address >= 0x2000) && (address < 0x3F00))
     {
-        if(address >= 0x3000)
-            address -= 0x1000;
-
-        if (mirroring_mode == MIRROR::FOUR_SCREEN)
-        {
-            if (address >= 0x2000 && address < 0x2400)
-                data = nametable[address & 0x3FF];
-            else if (address >= 0x2400 && address < 0x2800)
-                data = nametable[0x400 + (address & 0x3FF)];
-            else if (address >= 0x2800 && address < 0x2C00)
-                data = nametable[0x800 + (address & 0x3FF)];
-            else if (address >= 0x2C00 && address < 0x3000) // Changed upper bound for consistency
-                data = nametable[0xC00 + (address & 0x3FF)];
-        }
-            
-        else if(mirroring_mode == MIRROR::HORIZONTAL)
-        {
-            if((address >= 0x2000) && (address < 0x2800))
-                data = nametable[address & 0x3FF]; 
-            
-            else if((address >= 0x2800) && (address < 0x3000))          
-                data = nametable[0x400 + (address & 0x3FF)];                  
-        }
-        
-        else if(mirroring_mode == MIRROR::VERTICAL)
-        {
-            if( (address >= 0x2000) && (address < 0x2400))
-                data = nametable[address & 0x3FF];
-            else if((address >= 0x2800) && (address < 0x2C00))
-                data = nametable[address & 0x3FF];
-            else if((address >= 0x2400) && (address < 0x2800))
-                data = nametable[0x400 + (address & 0x3FF)];
-            else if (address >= 0x2C00 && address <= 0x2FFF)
-                data = nametable[0x400 + (address & 0x3FF)];       
-        }
-     
-
-        else if(mirroring_mode == MIRROR::ONE_SCREEN_LOWER)
-            data = nametable[address & 0x3FF];        
-
-        else if(mirroring_mode == MIRROR::ONE_SCREEN_UPPER)
-            data = nametable[0x400 + (address & 0x3FF)];      
+        //$3000-$3EFF mirrors $2000-$2EFF, the page index wraps around on its own
+        data = nametable_pages[(address >> 10) & 0x3][address & 0x3FF];
     } 
 
     else if( (address >= 0x3F00) && (address <= 0x3FFF) )
@@ -325,47 +324,7 @@ void PPU::write(uint16_t address, uint8_t value)
 
     else if((address >= 0x2000) && (address < 0x3F00))
     {
-        if(address >= 0x3000)
-            address -= 0x1000;
-
-        if(mirroring_mode == MIRROR::FOUR_SCREEN)
-        {
-            if (address >= 0x2000 && address < 0x2400)
-                nametable[address & 0x3FF] = value;
-            else if (address >= 0x2400 && address < 0x2800)
-                nametable[0x400 + (address & 0x3FF)] = value;
-            else if (address >= 0x2800 && address < 0x2C00)
-                nametable[0x800 + (address & 0x3FF)] = value;
-            else if (address >= 0x2C00 && address < 0x3000)
-                nametable[0xC00 + (address & 0x3FF)] = value;
-        }
-
-        else if(mirroring_mode == MIRROR::HORIZONTAL)
-        {
-            if((address >= 0x2000) && (address < 0x2800))            
-                nametable[address & 0x3FF] = value;            
-
-            else if((address >= 0x2800) && (address < 0x3000))           
-                nametable[0x400 + (address & 0x3FF)] = value;                   
-        }
-        
-        else if(mirroring_mode == MIRROR::VERTICAL)
-        {
-            if((address >= 0x2000) && (address < 0x2400))
-                nametable[address & 0x3FF] = value;
-            else if((address) >= 0x2800 && (address < 0x2C00))
-                nametable[address & 0x3FF] = value;
-            else if((address >= 0x2400) && (address < 0x2800))
-                nametable[0x400 + (address & 0x3FF)] = value;
-            else if (address >= 0x2C00 && address <= 0x2FFF)
-                nametable[0x400 + (address & 0x3FF)] = value;
-        } 
-
-        else if(mirroring_mode == MIRROR::ONE_SCREEN_LOWER)
-            nametable[address & 0x3FF] = value;        
-
-        else if(mirroring_mode == MIRROR::ONE_SCREEN_UPPER)
-            nametable[0x400 + (address & 0x3FF)] = value; 
+        nametable_pages[(address >> 10) & 0x3][address & 0x3FF] = value;
     }  
 
     else if( (address >= 0x3F00) && (address <= 0x3FFF) )
@@ -517,102 +476,64 @@ void PPU::cpu_writes(uint16_t address, uint8_t value)
     } 
 }
 
-void PPU::sprite_evaluation()
+//OAM DMA fast path: copies a whole page into OAM when the PPU won't evaluate sprites or move OAMADDR in
+//the next dots dots, so the result is the same as 256 $2004 writes. Returns false when it has to be byte by byte
+bool PPU::write_oam_page(const uint8_t* page, int dots)
 {
-    //Cycle 65 resetting useful variables
-    if(cycles == 65)
-    {
-        n = 0;
-        m = 0;
-        overflow_n = false;
-        oam_writes = true;
-        sprites_found = 0;
-        secondary_oam_pos = 0;
-        in_range = false;
-        sprite_0_next_scanline = false;
-    }
+    bool rendering = is_rendering_enabled || (PPUMASK & 0x18);
+    bool idle_scanlines = (scanline >= 240) && (scanline < pre_render_scanline);
+    if(rendering && !(idle_scanlines && ((pre_render_scanline - scanline) * 341 - cycles > dots)))
+        return false;
+
+    int first = 0x100 - OAMADDR;
+    std::memcpy(&OAM[OAMADDR], page, first);
+    std::memcpy(OAM, page + first, OAMADDR);
+    open_bus = page[0xFF];
+    return true;
+}
 
-    //in odd cycles only read
-    if(cycles & 0x1)
-    {
-        oam_data = OAM[(4*n) + m];
-    }
+void PPU::sprite_evaluation()
+{
+    //The whole evaluation for the next scanline runs in one pass at dot 65. Only the overflow flag can be
+    //observed by the CPU while it happens, so the dot where hardware raises it is kept and applied by tick
+    int sprite_size = ((PPUCTRL & 0x20) > 0) ? 16 : 8;
+    int secondary_oam_pos = 0;
+    int dot = 64;
+    int n = 0;
 
+    sprite_0_next_scanline = false;
+    sprite_overflow_dot = 0;
 
-    //Even cycle
-    else
+    //Every sprite takes 2 dots, 6 more to copy it when it is in range
+    for(; (n < 64) && (secondary_oam_pos < 0x20); n++)
     {
-        //if less than 8 sprites were found and n hasn't overflowed...
-        if(oam_writes && !overflow_n)
+        uint8_t y_coord = OAM[(4*n)];
+        dot += 2;
+        secondary_oam[secondary_oam_pos] = y_coord;
+        if((scanline >= y_coord) && (scanline < (y_coord + sprite_size)))
         {
-            y_coord = oam_data;
-            secondary_oam[secondary_oam_pos] = oam_data;
-            //If is in the range copy the remaining 3 bytes into secondary oam
-            int sprite_size = ((PPUCTRL & 0x20) > 0) ? 16 : 8;
-            if ((scanline >= y_coord) && (scanline < (y_coord + sprite_size)))
-            {
-                if(n == 0)
-                    sprite_0_next_scanline = true;
-                secondary_oam[secondary_oam_pos + 1] = OAM[(4*n) + 1];
-                secondary_oam[secondary_oam_pos + 2] = OAM[(4*n) + 2];
-                secondary_oam[secondary_oam_pos + 3] = OAM[(4*n) + 3];
-                sprites_found++;
-                secondary_oam_pos += 4;
-            }
-            //increase n and secondary_oam_pos
-            n++;
-            if(n == 64)
-            {
-                n = 0;
-                overflow_n = true;
-            }
-
-            //if there have already been found 8 sprites stop writes
-            if (sprites_found == 8)
-                oam_writes = false;
+            if(n == 0)
+                sprite_0_next_scanline = true;
+            secondary_oam[secondary_oam_pos + 1] = OAM[(4*n) + 1];
+            secondary_oam[secondary_oam_pos + 2] = OAM[(4*n) + 2];
+            secondary_oam[secondary_oam_pos + 3] = OAM[(4*n) + 3];
+            secondary_oam_pos += 4;
+            dot += 6;
         }
+    }
 
-        else if(overflow_n)
+    //Secondary OAM full: the hardware increments m together with n when a sprite is out of range,
+    //so the byte taken as Y walks diagonally through OAM
+    for(int m = 0; n < 64; n++, m = (m + 1) & 0x3)
+    {
+        uint8_t y_coord = OAM[(4*n) + m];
+        dot += 2;
+        if(dot > 256)
+            break;
+        if((scanline >= y_coord) && (scanline < (y_coord + sprite_size)))
         {
-            n++;
-        }
-        
-        //Secondary OAM full, read from secondary oam
-        else if(!oam_writes)
-        {
-            oam_data = secondary_oam[secondary_oam_pos + m];
-
-            if(m == 0)
-            {
-                int sprite_size = ((PPUCTRL & 0x20) > 0) ? 16 : 8;
-                if( (scanline >= oam_data) && (scanline < (oam_data + sprite_size)))
-                {
-                    PPUSTATUS |= 0x20;
-                    in_range = true;
-                }
-            }
-
-            else if(in_range)
-            {
-                oam_data = OAM[(4*n) + m];
-                if(m == 4)
-                {
-                    m = 0;
-                    n++;
-                    in_range = false;
-                }
-            }
-
-            else
-            {
-                n++;
-                if(n == 64)
-                {
-                    n = 0;
-                    overflow_n = true;
-                }
-            }
-            m++;
+            sprite_overflow_dot = dot;
+            break;
         }
     }
 }
@@ -725,78 +646,61 @@ void PPU::load_shifters()
 }
 
 //Drawing data to screen
-void PPU::draw_sprite_pixel()
+void PPU::compose_sprite_line()
 {
-    uint8_t pixel;
-    uint8_t sprite_lsb;
-    uint8_t sprite_msb;
+    //The first opaque sprite pixel wins even when it is behind the background, so priority is resolved here once
+    std::fill(std::begin(sprite_line), std::end(sprite_line), 0);
+    int first_x = (PPUMASK & 0x4) ? 0 : 8;
 
     for(int i = 0; i < 8; i++)
     {
         uint8_t sprite_y_coord = scanline_sprite_buffer[(i * 6)];
         uint8_t tile_id = scanline_sprite_buffer[(i * 6) + 1];
         uint8_t attribute_sprite = scanline_sprite_buffer[(i * 6) + 2];
-        uint8_t sprite_0_x_coord = scanline_sprite_buffer[(i * 6) + 3];
+        uint8_t sprite_x_coord = scanline_sprite_buffer[(i * 6) + 3];
 
-        if((tile_id != 0xFF || attribute_sprite != 0xFF || sprite_0_x_coord != 0xFF) && sprite_y_coord < 0xEF)
-        {
-            
-            sprite_lsb = scanline_sprite_buffer[(i * 6) + 4];
-            sprite_msb = scanline_sprite_buffer[(i * 6) + 5]; 
+        if((tile_id == 0xFF && attribute_sprite == 0xFF && sprite_x_coord == 0xFF) || sprite_y_coord >= 0xEF)
+            continue;
 
-            uint8_t palette_sprite = attribute_sprite & 0x3;
-            bool flip_horizontally = attribute_sprite & 0x40;
+        uint8_t sprite_lsb = scanline_sprite_buffer[(i * 6) + 4];
+        uint8_t sprite_msb = scanline_sprite_buffer[(i * 6) + 5];
+        if((sprite_lsb | sprite_msb) == 0)
+            continue;
 
-            for(int j = 0; j < 8; j++)
-            {
-                if(flip_horizontally)
-                {
-                    pixel = (sprite_lsb & 0x1) | ((sprite_msb & 0x1) << 1);
-                    sprite_lsb >>= 1;
-                    sprite_msb >>= 1;
-                }
-                else
-                {
-                    pixel = ((sprite_lsb & 0x80) >> 7) | ((sprite_msb & 0x80) >> 6);
-                    sprite_lsb <<= 1;
-                    sprite_msb <<= 1;
-                }
-
-                uint32_t color = get_palette_color(palette_sprite, pixel | 0x10);
-                uint32_t x = sprite_0_x_coord + j;
-                uint32_t screen_index = scanline * 256 + x;
+        uint8_t palette_sprite = attribute_sprite & 0x3;
+        bool flip_horizontally = attribute_sprite & 0x40;
+        uint8_t flags = Compositor::SPRITE_OPAQUE | (attribute_sprite & Compositor::SPRITE_BEHIND);
+        if((i == 0) && sprite_0_current_scanline)
+            flags |= Compositor::SPRITE_ZERO;
 
-                if( !(!(PPUMASK & 0x4) && (x < 8)))
-                {
-                    if((scanline_buffer[x] & 0x4) == 0)
-                    {
-                        if(scanline_buffer[x] == 0x00 && pixel == 0x00)         
-                            screen[screen_index] = system_palette[get_palette_color(0, 0)];
-                        
-                        else if(scanline_buffer[x] == 0x00 && pixel != 0x00)
-                        {
-                            screen[screen_index] = system_palette[color];
-                            scanline_buffer[x] |= 0x4;
-                        }
+        for(int j = 0; j < 8; j++)
+        {
+            int x = sprite_x_coord + j;
+            if(x > 255)
+                break;
 
-                        else if(pixel == 0x00 && (scanline_buffer[x] != 0x00));
+            int bit = flip_horizontally ? j : 7 - j;
+            uint8_t pixel = ((sprite_lsb >> bit) & 0x1) | (((sprite_msb >> bit) & 0x1) << 1);
+            if(pixel == 0 || x < first_x || sprite_line[x])
+                continue;
 
-                        else if( (scanline_buffer[x] != 0x00) && (pixel != 0x00) && !(attribute_sprite & 0x20) )
-                        {
-                            screen[screen_index] = system_palette[color];
-                            scanline_buffer[x] |= 0x4;
-                        }
-                        
-                        else if( (scanline_buffer[x] != 0x00) && (pixel != 0x00) && (attribute_sprite & 0x20) )  
-                            scanline_buffer[x] |= 0x4;
-                        
-                    }                   
-                }                 
-            }
+            sprite_line[x] = flags;
+            sprite_line_color[x] = get_palette_color(palette_sprite, pixel | 0x10) & 0x3F;
         }
     }
 }
 
+void PPU::draw_scanline()
+{
+    if((is_rendering_enabled & 0x2) && (scanline != 0))
+        compose_sprite_line();
+    else
+        std::fill(std::begin(sprite_line), std::end(sprite_line), 0);
+
+    //Sprite 0 hit is set dot by dot by check_sprite_0_hit, the position found here is not needed
+    Compositor::compose_line(bg_color, scanline_buffer, sprite_line_color, sprite_line, system_palette, &screen[scanline * 256]);
+}
+
 void PPU::draw_background_pixel()
 {
     // Combine bit shift and masking operations to reduce complexity
@@ -810,44 +714,56 @@ void PPU::draw_background_pixel()
     uint8_t pixel = pixel0 | (pixel1 << 1);
     uint8_t palette_index = final_palette_bit_0 | (final_palette_bit_1 << 1);
 
-    // Update screen2 and screen arrays
-    uint32_t index = scanline * 256 + (cycles - 1);
+    //Colors are only looked up here, draw_scanline writes the line to the screen at dot 256
+    int x = cycles - 1;
 
     //if background is enabled in the leftmost 8 pixels...
     if( !(!(PPUMASK & 0x2) && ((cycles-1) < 8)) )
     {
         if(is_rendering_enabled & 0x1) //if background rendering is enabled
         {
-            screen[index] = system_palette[get_palette_color(palette_index, pixel)];
-            scanline_buffer[cycles - 1] = pixel;
+            if(render_output)
+                bg_color[x] = get_palette_color(palette_index, pixel) & 0x3F;
+            scanline_buffer[x] = pixel;
         }
-        else if(!is_rendering_enabled) //When rendering is disabled show backdrop color
+        else //When background rendering is disabled show backdrop color
         {
-            screen[index] = system_palette[get_palette_color(0, 0)]; //Normally draw backdrop color but...
+            if(render_output)
+            {
+                bg_color[x] = get_palette_color(0, 0) & 0x3F; //Normally draw backdrop color but...
 
-            if(!is_rendering_enabled && (v >= 0x3F00) && (v <= 0x3FFF))
-                    screen[index] = system_palette[read(v)];     
+                if(!is_rendering_enabled && (v >= 0x3F00) && (v <= 0x3FFF))
+                        bg_color[x] = read(v) & 0x3F;
+            }
             
-            scanline_buffer[cycles - 1] = 0x00;            
+            scanline_buffer[x] = 0x00;
         }
     }
     
     else
     {
-        screen[index] = system_palette[get_palette_color(0, 0)];
-        scanline_buffer[cycles - 1] = 0x00;
+        if(render_output)
+            bg_color[x] = get_palette_color(0, 0) & 0x3F;
+        scanline_buffer[x] = 0x00;
     }
     
     if(sprite_0_current_scanline && ((PPUMASK & 0x18) == 0x18))
     {
         uint8_t sprite_0_x_coord = scanline_sprite_buffer[3];
-        if ( ((cycles - 1 ) - sprite_0_x_coord >= 0) && ((cycles - 1) - sprite_0_x_coord < 8) )
+        if ( (x - sprite_0_x_coord >= 0) && (x - sprite_0_x_coord < 8) )
             check_sprite_0_hit();
     }
 
         
 }
 
+//Without pixel output a background pixel only feeds the sprite 0 hit test, and sprite evaluation on the line
+//before already told whether sprite 0 is on this one
+bool PPU::needs_background_pixel()
+{
+    return render_output || (sprite_0_current_scanline && ((PPUMASK & 0x18) == 0x18));
+}
+
 uint32_t PPU::get_palette_color(uint8_t palette_x, uint8_t pixel)
 {
     uint32_t data;
@@ -857,93 +773,145 @@ uint32_t PPU::get_palette_color(uint8_t palette_x, uint8_t pixel)
     return data;
 }
 
-std::vector<uint32_t> PPU::get_pattern_table(int m)
+void PPU::take_debug_snapshot()
+{
+    std::unique_lock<std::mutex> lock(debug_mutex, std::try_to_lock);
+    if(!lock.owns_lock())
+        return;
+
+    for(int address = 0; address < 0x2000; address++)
+        debug_snapshot.chr[address] = bus->ppu_reads(address);
+    for(int page = 0; page < 4; page++)
+        std::copy(nametable_pages[page], nametable_pages[page] + 0x400, debug_snapshot.nametables + page * 0x400);
+    std::copy(std::begin(frame_palette), std::end(frame_palette), std::begin(debug_snapshot.palette));
+    std::copy(std::begin(OAM), std::end(OAM), std::begin(debug_snapshot.oam));
+    debug_snapshot.ppuctrl = PPUCTRL;
+    debug_snapshot.valid = true;
+}
+
+void PPU::close_debug_views()
+{
+    debug_view_frames.store(0, std::memory_order_relaxed);
+    //Reopened views wait for a fresh snapshot rather than show this one
+    std::lock_guard<std::mutex> lock(debug_mutex);
+    debug_snapshot.valid = false;
+}
+
+//Tile key: 16 bytes of CHR followed by the 4 colors
+const int DEBUG_TILE_KEY_SIZE = 16 + 4 * sizeof(uint32_t);
+
+int PPU::draw_debug_tile(DebugViewCache& cache, int tile, const uint8_t* chr, const uint32_t colors[4], uint32_t* pixels, int pitch)
+{
+    uint8_t* key = &cache.tile_keys[tile * DEBUG_TILE_KEY_SIZE];
+    if(std::equal(chr, chr + 16, key) && std::equal(colors, colors + 4, reinterpret_cast<uint32_t*>(key + 16)))
+        return 0;
+    std::copy(chr, chr + 16, key);
+    std::copy(colors, colors + 4, reinterpret_cast<uint32_t*>(key + 16));
+
+    for(int i = 0; i < 8; i++)
+    {
+        uint8_t LSB = chr[i];
+        uint8_t MSB = chr[i + 8];
+        for(int j = 0; j < 8; j++)
+        {
+            uint8_t pixel = ((LSB & 0x80) >> 7) | (((MSB & 0x80) >> 6));
+            LSB <<= 1;
+            MSB <<= 1;
+            pixels[(i * pitch) + j] = colors[pixel];
+        }
+    }
+    return 1;
+}
+
+//Same lookup as get_palette_color, on the snapshot palette
+static uint32_t snapshot_color(const DebugSnapshot& snapshot, const uint32_t* system_palette, uint8_t palette_x, uint8_t pixel)
 {
-    uint32_t palette_pt[4] = {0x000000FF, 0xFFFFFFFF, 0x00FFFFFF, 0x0000FFFF};
+    uint8_t index = (pixel & 0x3) ? (pixel | (palette_x << 2)) & 0x1F : 0;
+    return system_palette[snapshot.palette[index] & 0x3F];
+}
+
+int PPU::render_pattern_table(int table, uint32_t* pixels, DebugViewCache& cache)
+{
+    debug_view_frames.store(DEBUG_VIEW_TIMEOUT_FRAMES, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(debug_mutex);
+    if(!debug_snapshot.valid)
+        return 0;
+
+    //The tile cache is keyed on the CHR and colors drawn, a new or resized cache matches nothing
+    if(cache.tile_keys.size() != 256 * DEBUG_TILE_KEY_SIZE)
+        cache.tile_keys.assign(256 * DEBUG_TILE_KEY_SIZE, 0xA5);
+
+    const uint32_t palette_pt[4] = {0x000000FF, 0xFFFFFFFF, 0x00FFFFFF, 0x0000FFFF};
+    int redrawn = 0;
     for(int y = 0; y < 16; y++)
     {
         for(int x = 0; x < 16; x++)
         {
-            for(int i = 0; i < 8; i++)
-            {
-                uint8_t LSB = bus->ppu_reads(m*0x1000 + y*256 + x * 16 + i);
-                uint8_t MSB = bus->ppu_reads(m*0x1000 + y*256 + x * 16 + i + 8);
-                for(int j = 0; j < 8; j++)
-                {
-                    uint8_t pixel = ((LSB & 0x80) >> 7) | (((MSB & 0x80) >> 6));
-                    LSB <<= 1;
-                    MSB <<= 1;
-                    pattern_buffer[(((y * 8) + i) * 128) + ((x * 8) + j)] = palette_pt[pixel];
-                }
-            }
+            const uint8_t* chr = &debug_snapshot.chr[(table & 0x1) * 0x1000 + y * 256 + x * 16];
+            redrawn += draw_debug_tile(cache, y * 16 + x, chr, palette_pt, &pixels[(y * 8 * 128) + (x * 8)], 128);
         }
     }
-
-    return pattern_buffer;
+    return redrawn;
 }
 
-std::vector<uint32_t> PPU::get_sprite()
+int PPU::render_sprites(uint32_t* pixels, DebugViewCache& cache)
 {
-    uint8_t tile_id;
-    uint8_t palette_sprite;
+    debug_view_frames.store(DEBUG_VIEW_TIMEOUT_FRAMES, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(debug_mutex);
+    if(!debug_snapshot.valid)
+        return 0;
+
+    if(cache.tile_keys.size() != 64 * DEBUG_TILE_KEY_SIZE)
+        cache.tile_keys.assign(64 * DEBUG_TILE_KEY_SIZE, 0xA5);
+
+    int pattern_table = ((debug_snapshot.ppuctrl & 0x8) > 0) * 0x1000;
+    int redrawn = 0;
     for(int y = 0; y < 8; y++)
     {
         for(int x = 0; x < 8; x++)
         {
-            tile_id = OAM[ (((y*8) + x) * 4) + 1 ];
-            palette_sprite = OAM[ (((y*8) + x) * 4) + 2 ] & 0x3;
-            for(int i = 0; i < 8; i++)
-            {                                 //Pattern table                  //Tile id                     //Fine y
-                uint8_t LSB = bus->ppu_reads(((PPUCTRL & 0x8) > 0) * 0x1000 + (tile_id * 16) + i);
-                uint8_t MSB = bus->ppu_reads(((PPUCTRL & 0x8) > 0) * 0x1000 + (tile_id * 16) + i + 8); // +8 bit plane
-                for(int j = 0; j < 8; j++)
-                {
-                    uint8_t pixel = ((LSB & 0x80) >> 7) | (((MSB & 0x80) >> 6));
-                    LSB <<= 1;
-                    MSB <<= 1;
-                    sprite_buffer[(((y * 8) + i) * 64) + ((x * 8) + j)] = system_palette[get_palette_color(palette_sprite, pixel + 0x10)];
-                }
-            }
+            uint8_t tile_id = debug_snapshot.oam[(((y * 8) + x) * 4) + 1];
+            uint8_t palette_sprite = debug_snapshot.oam[(((y * 8) + x) * 4) + 2] & 0x3;
+            uint32_t colors[4];
+            for(int pixel = 0; pixel < 4; pixel++)
+                colors[pixel] = snapshot_color(debug_snapshot, system_palette, palette_sprite + 4, pixel);
+
+            const uint8_t* chr = &debug_snapshot.chr[pattern_table + tile_id * 16];
+            redrawn += draw_debug_tile(cache, y * 8 + x, chr, colors, &pixels[(y * 8 * 64) + (x * 8)], 64);
         }
-    } 
-
-    return sprite_buffer;                  
-} 
+    }
+    return redrawn;
+}
 
-std::vector<uint32_t> PPU::get_nametable(int m)
+int PPU::render_nametable(int table, uint32_t* pixels, DebugViewCache& cache)
 {
-    uint8_t nametable_id;
+    debug_view_frames.store(DEBUG_VIEW_TIMEOUT_FRAMES, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(debug_mutex);
+    if(!debug_snapshot.valid)
+        return 0;
+
+    if(cache.tile_keys.size() != 960 * DEBUG_TILE_KEY_SIZE)
+        cache.tile_keys.assign(960 * DEBUG_TILE_KEY_SIZE, 0xA5);
+
+    const uint8_t* page = &debug_snapshot.nametables[(table & 0x3) * 0x400];
+    int pattern_table = 0x1000 * ((debug_snapshot.ppuctrl & 0x10) > 0);
+    int redrawn = 0;
     for(int i = 0; i < 30; i++)
     {
-        for(int j = 0; j < 32 ; j++)
+        for(int j = 0; j < 32; j++)
         {
-            nametable_id = nametable[(m*0x400) + i*32 + j];
-            uint8_t attribute2 = read(0x23C0 + (mirroring_mode > 0 ? 0x400 : 0x800)*m + j/4 + (i/4)*8);
-            uint8_t x = ((j & 0x3) & 0x2) >> 1;
-            uint8_t y = ((i & 0x3) & 0x2) >> 1;
-
-
-            for(int k = 0; k < 8; k++)
-            {
-                uint8_t LSB = bus->ppu_reads(0x1000 * ((PPUCTRL & 0x10) > 0) + (nametable_id * 16) + k);
-                uint8_t MSB = bus->ppu_reads(0x1000 * ((PPUCTRL & 0x10) > 0) + (nametable_id * 16) + k + 8);
-                uint8_t paleta = ((attribute2 >> ((x * 2) + (y * 4))) & 0x01) > 0 ? 0xFF : 0x00;
-                uint8_t paleta0 = ((attribute2 >> ((x * 2) + (y * 4) + 1)) & 0x01) > 0 ? 0xFF : 0x00;
-
-                for(int z = 0; z < 8; z++)
-                {
-                    uint8_t pixel3 = ((LSB & 0x80) >> 7) | (((MSB & 0x80) >> 6));
-                    uint8_t paleta1 = ((paleta & 0x80) >> 7) | (((paleta0 & 0x80) >> 6));
-                    nametable_buffer[(((i*8) + k) * 256 ) + ((j * 8) + z)] = system_palette[get_palette_color(paleta1, pixel3)];
-                    LSB <<= 1;
-                    MSB <<= 1;
-                    paleta <<= 1;
-                    paleta0 <<= 1;
-                }
-            }           
+            uint8_t nametable_id = page[i * 32 + j];
+            uint8_t attribute_byte = page[0x3C0 + (j / 4) + (i / 4) * 8];
+            uint8_t palette_x = (attribute_byte >> (((j & 0x2) ? 2 : 0) + ((i & 0x2) ? 4 : 0))) & 0x3;
+            uint32_t colors[4];
+            for(int pixel = 0; pixel < 4; pixel++)
+                colors[pixel] = snapshot_color(debug_snapshot, system_palette, palette_x, pixel);
+
+            const uint8_t* chr = &debug_snapshot.chr[pattern_table + nametable_id * 16];
+            redrawn += draw_debug_tile(cache, i * 32 + j, chr, colors, &pixels[(i * 8 * 256) + (j * 8)], 256);
         }
     }
-    return nametable_buffer;
+    return redrawn;
 }
 
 void PPU::set_ppu_timing(uint8_t value)
@@ -1012,21 +980,11 @@ void PPU::soft_reset()
 
     // Clear screen buffers
     std::fill(screen.begin(), screen.end(), 0);
-    std::fill(scanline_buffer.begin(), scanline_buffer.end(), 0);
-    std::fill(pattern_buffer.begin(), pattern_buffer.end(), 0);
-    std::fill(nametable_buffer.begin(), nametable_buffer.end(), 0);
-    std::fill(sprite_buffer.begin(), sprite_buffer.end(), 0);
+    std::fill(std::begin(scanline_buffer), std::end(scanline_buffer), 0);
 
     // Reset sprite evaluation variables
-    n = 0;
-    m = 0;
-    oam_data = 0;
-    y_coord = 0;
-    oam_writes = false;
-    secondary_oam_pos = 0;
-    sprites_found = 0;
-    overflow_n = false;
-    in_range = false;
+    sprite_overflow_dot = 0;
+    std::fill(std::begin(sprite_line), std::end(sprite_line), 0);
     secondary_oam_index = 0;
     i = 0;
 
@@ -1045,11 +1003,6 @@ void PPU::soft_reset()
     open_bus = 0;
     supress = false;
     ppu_timing = 0;
-
-    sc.irq_counter = 0;
-    sc.irq_enable = false;
-    sc.irq_latch = 0;
-    sc.irq_reload = false;
 }
 
 //Functions useful for zapper
@@ -1080,40 +1033,56 @@ void PPU::set_zapper(bool zapper)
 
 bool PPU::get_frame() { return frame; }
 
-void PPU::clock_scanline_counter()
+void PPU::set_mirroring_mode(MIRROR value)
 {
-    if ((sc.irq_counter == 0) || sc.irq_reload) 
-    {     
-        sc.irq_counter = sc.irq_latch; // Reload the counter
-        sc.irq_reload = false;
+    if(mirroring_mode != MIRROR::FOUR_SCREEN)
+        mirroring_mode = value;
+    update_nametable_pages();
+}
+
+//Points the four 1KB nametable pages at the PPU VRAM according to the mirroring mode
+void PPU::update_nametable_pages()
+{
+    //Page of VRAM used by $2000, $2400, $2800 and $2C00
+    int layout[4];
+    switch(mirroring_mode)
+    {
+        case MIRROR::HORIZONTAL:       layout[0] = 0; layout[1] = 0; layout[2] = 1; layout[3] = 1; break;
+        case MIRROR::VERTICAL:         layout[0] = 0; layout[1] = 1; layout[2] = 0; layout[3] = 1; break;
+        case MIRROR::ONE_SCREEN_LOWER: layout[0] = 0; layout[1] = 0; layout[2] = 0; layout[3] = 0; break;
+        case MIRROR::ONE_SCREEN_UPPER: layout[0] = 1; layout[1] = 1; layout[2] = 1; layout[3] = 1; break;
+        default:                       layout[0] = 0; layout[1] = 1; layout[2] = 2; layout[3] = 3; break;
     }
-    else
-        sc.irq_counter--;
 
-    if (sc.irq_enable && sc.irq_counter == 0)
-        bus->assert_irq(MMC3);  
+    for(int page = 0; page < 4; page++)
+        nametable_pages[page] = &nametable[layout[page] * 0x400];
 }
 
+void PPU::map_nametable(int page, uint8_t* memory)
+{
+    nametable_pages[page & 0x3] = memory;
+}
 
-void PPU::detect_filtered_A12()
+void PPU::copy_state(const PPU& other)
 {
-    bool current_a12 = PPU_BUS & 0x1000;
-    if(!current_a12)
-        ppu_cycles++;
- 
-    else
+    static_cast<PPUState&>(*this) = other;
+
+    //Pages on the other PPU's VRAM move to ours, pages on mapper memory stay as this cartridge mapped them
+    for(int page = 0; page < 4; page++)
     {
-        if(!prev_A12 && ppu_cycles >= 10)
-            clock_scanline_counter();
-        ppu_cycles = 0;
+        const uint8_t* memory = other.nametable_pages[page];
+        if(memory >= other.nametable && memory < other.nametable + sizeof(nametable))
+            nametable_pages[page] = nametable + (memory - other.nametable);
     }
-
-    prev_A12 = current_a12;
 }
 
-void PPU::set_irq_enable(bool value)
+//MMC3 counts a rising edge only after A12 was low for a while, which passes one edge per scanline
+//while rendering and ignores the 8 dot toggling of mixed pattern table fetches
+void PPU::A12_changed(bool A12)
 {
-    sc.irq_enable = value;
-    if(!sc.irq_enable)
-        bus->ack_irq(MMC3);
+    if(A12 && (dot_clock - A12_low_since) >= A12_FILTER_DOTS)
+        bus->A12_rising();
+    if(!A12)
+        A12_low_since = dot_clock;
+    prev_A12 = A12;
 }
\ No newline at end of file
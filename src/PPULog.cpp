@@ -0,0 +1,98 @@
+#include <algorithm>
+#include "PPULog.h"
+#include "PPU.h"
+#include "CPU.h"
+#include "APU.h"
+#include "Bus.h"
+#include "Cartridge.h"
+
+void PPULog::begin(const Cartridge& cart)
+{
+    clear();
+    cart.get_chr_layout(last_chr_layout);
+}
+
+void PPULog::clear()
+{
+    events.clear();
+    chr_layouts.clear();
+    oam_pages.clear();
+}
+
+void PPULog::swap_entries(PPULog& other)
+{
+    events.swap(other.events);
+    chr_layouts.swap(other.chr_layouts);
+    oam_pages.swap(other.oam_pages);
+}
+
+void PPULog::chr_banks_written(uint32_t dot, const Cartridge& cart)
+{
+    uint32_t layout[8];
+    cart.get_chr_layout(layout);
+    if(std::equal(layout, layout + 8, last_chr_layout))
+        return;
+
+    events.push_back({dot, static_cast<uint32_t>(chr_layouts.size()), CHR_LAYOUT, 0, 0, 0});
+    chr_layouts.insert(chr_layouts.end(), layout, layout + 8);
+    std::copy(layout, layout + 8, last_chr_layout);
+}
+
+void PPULog::oam_page_copied(uint32_t dot, const uint8_t* page, int dots)
+{
+    events.push_back({dot, static_cast<uint32_t>(oam_pages.size()), OAM_PAGE, 0, 0, static_cast<uint16_t>(dots)});
+    oam_pages.insert(oam_pages.end(), page, page + 0x100);
+}
+
+PPUFollower::PPUFollower()
+{
+    cpu = std::make_shared<CPU>();
+    ppu = std::make_shared<PPU>();
+    cart = std::make_shared<Cartridge>();
+    apu = std::make_shared<APU>();
+    bus = std::make_shared<Bus>(ppu, cart, apu, cpu);
+
+    cpu->connect_bus(bus);
+    cart->connect_bus(bus);
+    ppu->connect_bus(bus);
+    apu->connect_bus(bus);
+}
+
+void PPUFollower::start(const PPU& ppu, const Cartridge& cart)
+{
+    this->cart->copy_state(cart);
+    this->ppu->copy_state(ppu);
+    //The MMC3 counter lives on the emulation thread, the copy has no use for A12
+    this->ppu->set_mapper(0);
+}
+
+void PPUFollower::replay(const PPULog& log, uint32_t end_dot, bool render)
+{
+    ppu->set_render_output(render);
+    for(const PPULog::Event& event : log.events)
+    {
+        advance(event.dot);
+        switch(event.kind)
+        {
+            case PPULog::WRITE: ppu->cpu_writes(event.reg, event.value); break;
+            case PPULog::READ: ppu->cpu_reads(event.reg); break;
+            case PPULog::CHR_LAYOUT: cart->set_chr_layout(&log.chr_layouts[event.offset]); break;
+            case PPULog::MIRRORING: ppu->set_mirroring_mode(static_cast<MIRROR>(event.value)); break;
+            //Both PPUs are in the same state, so the copy is taken here as well
+            case PPULog::OAM_PAGE: ppu->write_oam_page(&log.oam_pages[event.offset], event.dots); break;
+        }
+    }
+    advance(end_dot);
+}
+
+std::vector<uint32_t>& PPUFollower::get_screen()
+{
+    return ppu->get_screen();
+}
+
+//Dot clocks wrap, the distance decides
+void PPUFollower::advance(uint32_t dot)
+{
+    while(static_cast<int32_t>(dot - ppu->get_dot_clock()) > 0)
+        ppu->tick();
+}
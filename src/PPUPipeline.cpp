@@ -0,0 +1,77 @@
+#include "PPUPipeline.h"
+
+PPUPipeline::PPUPipeline()
+{
+    frame = std::vector<uint32_t>(256 * 240);
+    worker = std::thread(&PPUPipeline::run, this);
+}
+
+PPUPipeline::~PPUPipeline()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    work_ready.notify_one();
+    worker.join();
+}
+
+void PPUPipeline::start(const PPU& ppu, const Cartridge& cart)
+{
+    follower.start(ppu, cart);
+    pending.clear();
+    frame_drawn = false;
+    frame_ready = false;
+}
+
+void PPUPipeline::submit(PPULog& log, uint32_t end_dot, bool frame_complete, bool render)
+{
+    frame_ready = false;
+    wait();
+
+    //The entries go back and forth between the two logs, so their storage is reused
+    pending.clear();
+    pending.swap_entries(log);
+    this->end_dot = end_dot;
+    this->frame_complete = frame_complete;
+    this->render = render;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        busy = true;
+    }
+    work_ready.notify_one();
+}
+
+void PPUPipeline::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    work_done.wait(lock, [this] { return !busy; });
+
+    //The renderer draws the next frame over the screen it is given back, every visible line is written again
+    if(frame_drawn)
+    {
+        std::swap(frame, follower.get_screen());
+        frame_drawn = false;
+        frame_ready = true;
+    }
+}
+
+void PPUPipeline::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true)
+    {
+        work_ready.wait(lock, [this] { return busy || quit; });
+        if(quit)
+            return;
+
+        lock.unlock();
+        follower.replay(pending, end_dot, render);
+        lock.lock();
+
+        if(frame_complete && render)
+            frame_drawn = true;
+        busy = false;
+        work_done.notify_one();
+    }
+}
@@ -0,0 +1,85 @@
+#include "PagedRam.h"
+#include <algorithm>
+#include <mutex>
+
+namespace
+{
+    std::mutex free_pages_mutex;
+    std::vector<void*> free_pages;
+}
+
+PagedRam::Page* PagedRam::allocate_page()
+{
+    Page* page = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(free_pages_mutex);
+        if(!free_pages.empty())
+        {
+            page = static_cast<Page*>(free_pages.back());
+            free_pages.pop_back();
+        }
+    }
+    if(!page)
+        page = new Page;
+    page->references.store(1, std::memory_order_relaxed);
+    return page;
+}
+
+void PagedRam::release_page(Page* page)
+{
+    if(page->references.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+    std::lock_guard<std::mutex> lock(free_pages_mutex);
+    free_pages.push_back(page);
+}
+
+PagedRam::Page* PagedRam::unshare(Page* page)
+{
+    Page* copy = allocate_page();
+    std::copy(std::begin(page->data), std::end(page->data), std::begin(copy->data));
+    release_page(page);
+    return copy;
+}
+
+PagedRam::~PagedRam()
+{
+    for(Page* page : pages)
+        release_page(page);
+}
+
+void PagedRam::resize(size_t size)
+{
+    size_t count = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    while(pages.size() > count)
+    {
+        release_page(pages.back());
+        pages.pop_back();
+    }
+    while(pages.size() < count)
+    {
+        Page* page = allocate_page();
+        std::fill(std::begin(page->data), std::end(page->data), 0);
+        pages.push_back(page);
+    }
+}
+
+void PagedRam::clear()
+{
+    for(Page*& page : pages)
+    {
+        if(page->references.load(std::memory_order_acquire) != 1)
+            page = unshare(page);
+        std::fill(std::begin(page->data), std::end(page->data), 0);
+    }
+}
+
+void PagedRam::share(const PagedRam& other)
+{
+    if(&other == this)
+        return;
+    for(Page* page : other.pages)
+        page->references.fetch_add(1, std::memory_order_relaxed);
+    for(Page* page : pages)
+        release_page(page);
+    pages.assign(other.pages.begin(), other.pages.end());
+}
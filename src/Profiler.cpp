@@ -0,0 +1,190 @@
+#include "Profiler.h"
+
+#ifdef CALASCIO_PROFILE
+
+#include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Profiler
+{
+    const char* zone_names[ZONE_COUNT] = {"CPU tick", "PPU tick", "APU tick", "Mapper", "Audio resample", "Frame"};
+
+    //Totals seen at the previous export, to turn the running counters into per second deltas
+    struct ZoneTotals
+    {
+        uint64_t calls = 0;
+        uint64_t ticks = 0;
+        uint64_t histogram[HISTOGRAM_BUCKETS] = {};
+    };
+
+    std::mutex registry_mutex;
+    std::vector<std::unique_ptr<ThreadStats>> registry; //Never shrinks, stats of finished threads keep counting in the totals
+
+    std::mutex report_mutex;
+    Report last_report;
+    bool report_ready = false;
+
+    std::mutex export_mutex;
+    std::condition_variable export_wakeup;
+    std::thread export_thread;
+    bool exporting = false;
+
+    ThreadStats* register_thread()
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registry.push_back(std::make_unique<ThreadStats>());
+        return registry.back().get();
+    }
+
+    ThreadStats& thread_stats()
+    {
+        thread_local ThreadStats* stats = register_thread();
+        return *stats;
+    }
+
+    void collect(ZoneTotals totals[ZONE_COUNT])
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for(auto& thread : registry)
+        {
+            for(int zone = 0; zone < ZONE_COUNT; zone++)
+            {
+                ZoneStats& stats = thread->zones[zone];
+                totals[zone].calls += stats.calls.load(std::memory_order_relaxed);
+                totals[zone].ticks += stats.ticks.load(std::memory_order_relaxed);
+                for(int i = 0; i < HISTOGRAM_BUCKETS; i++)
+                    totals[zone].histogram[i] += stats.histogram[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    //Upper bound of the bucket holding the given fraction of the samples
+    double percentile_ns(const uint64_t histogram[HISTOGRAM_BUCKETS], uint64_t calls, double fraction, double ns_per_tick)
+    {
+        uint64_t target = (uint64_t)(calls * fraction);
+        uint64_t seen = 0;
+        for(int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        {
+            seen += histogram[i];
+            if(seen > target)
+                return (double)(2ull << i) * ns_per_tick;
+        }
+        return 0;
+    }
+
+    void write_trace_events(std::ofstream& trace, const Report& report, bool& first_event)
+    {
+        for(const ZoneReport& zone : report.zones)
+        {
+            trace << (first_event ? "" : ",\n");
+            trace << "{\"name\":\"" << zone.name << "\",\"ph\":\"C\",\"pid\":1,\"ts\":" << report.timestamp_us
+                  << ",\"args\":{\"ms_per_s\":" << zone.total_ms << ",\"calls\":" << zone.calls
+                  << ",\"mean_ns\":" << zone.mean_ns << ",\"p50_ns\":" << zone.p50_ns << ",\"p99_ns\":" << zone.p99_ns << "}}";
+            first_event = false;
+        }
+        trace.flush();
+    }
+
+    void export_loop(std::string filename)
+    {
+        //Chrome's trace viewer accepts an unterminated array, the closing bracket is written on stop
+        std::ofstream trace(filename, std::ios::trunc);
+        trace << "[\n";
+        bool first_event = true;
+
+        auto start_time = std::chrono::steady_clock::now();
+        auto previous_time = start_time;
+        uint64_t previous_ticks = now_ticks();
+        ZoneTotals previous[ZONE_COUNT];
+        collect(previous);
+
+        std::unique_lock<std::mutex> lock(export_mutex);
+        while(exporting)
+        {
+            export_wakeup.wait_for(lock, std::chrono::seconds(1));
+
+            auto current_time = std::chrono::steady_clock::now();
+            uint64_t current_ticks = now_ticks();
+            double elapsed_ns = std::chrono::duration<double, std::nano>(current_time - previous_time).count();
+            double ns_per_tick = (current_ticks > previous_ticks) ? elapsed_ns / (current_ticks - previous_ticks) : 1.0;
+            double seconds = elapsed_ns / 1e9;
+            if(seconds <= 0)
+                continue;
+
+            ZoneTotals current[ZONE_COUNT];
+            collect(current);
+
+            Report report;
+            report.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(current_time - start_time).count();
+            for(int zone = 0; zone < ZONE_COUNT; zone++)
+            {
+                uint64_t histogram[HISTOGRAM_BUCKETS];
+                for(int i = 0; i < HISTOGRAM_BUCKETS; i++)
+                    histogram[i] = current[zone].histogram[i] - previous[zone].histogram[i];
+
+                uint64_t calls = current[zone].calls - previous[zone].calls;
+                double total_ns = (current[zone].ticks - previous[zone].ticks) * ns_per_tick;
+
+                ZoneReport& out = report.zones[zone];
+                out.name = zone_names[zone];
+                out.calls = (uint64_t)(calls / seconds);
+                out.total_ms = total_ns / 1e6 / seconds;
+                out.mean_ns = calls ? total_ns / calls : 0;
+                out.p50_ns = percentile_ns(histogram, calls, 0.50, ns_per_tick);
+                out.p99_ns = percentile_ns(histogram, calls, 0.99, ns_per_tick);
+            }
+
+            std::copy(std::begin(current), std::end(current), std::begin(previous));
+            previous_time = current_time;
+            previous_ticks = current_ticks;
+
+            {
+                std::lock_guard<std::mutex> report_lock(report_mutex);
+                last_report = report;
+                report_ready = true;
+            }
+
+            lock.unlock();
+            write_trace_events(trace, report, first_event);
+            lock.lock();
+        }
+
+        trace << "\n]\n";
+    }
+
+    void start_export(const std::string& filename)
+    {
+        std::lock_guard<std::mutex> lock(export_mutex);
+        if(exporting)
+            return;
+        exporting = true;
+        export_thread = std::thread(export_loop, filename);
+    }
+
+    void stop_export()
+    {
+        {
+            std::lock_guard<std::mutex> lock(export_mutex);
+            if(!exporting)
+                return;
+            exporting = false;
+        }
+        export_wakeup.notify_all();
+        export_thread.join();
+    }
+
+    bool get_report(Report& report)
+    {
+        std::lock_guard<std::mutex> lock(report_mutex);
+        if(report_ready)
+            report = last_report;
+        return report_ready;
+    }
+}
+
+#endif
@@ -0,0 +1,146 @@
+#include "RomDatabase.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    //Entries compiled into the emulator, in the override file format. Only add dumps whose CRC and correct
+    //board were checked against a real cartridge or a trusted database, a wrong entry overrides a good header
+    const char* const BUILTIN_DATABASE = "";
+
+    int parse_mirroring(const std::string& value)
+    {
+        if(value == "h") return 0;
+        if(value == "v") return 1;
+        if(value == "1l") return 2;
+        if(value == "1u") return 3;
+        if(value == "4") return 4;
+        return -1;
+    }
+
+    int parse_timing(const std::string& value)
+    {
+        if(value == "ntsc") return 0;
+        if(value == "pal") return 1;
+        if(value == "multi") return 2;
+        if(value == "dendy") return 3;
+        return -1;
+    }
+
+    //Malformed lines and fields are skipped, a bad entry must never keep a game from loading
+    void parse(std::istream& input, std::vector<RomDatabaseEntry>& entries)
+    {
+        std::string line;
+        while(std::getline(input, line))
+        {
+            line = line.substr(0, line.find('#'));
+            std::istringstream fields(line);
+            std::string crc;
+            if(!(fields >> crc))
+                continue;
+
+            RomDatabaseEntry entry;
+            try
+            {
+                entry.crc = std::stoul(crc, nullptr, 16);
+            }
+            catch(const std::exception&)
+            {
+                continue;
+            }
+
+            std::string field;
+            while(fields >> field)
+            {
+                size_t equals = field.find('=');
+                if(equals == std::string::npos)
+                    continue;
+                std::string key = field.substr(0, equals);
+                std::string value = field.substr(equals + 1);
+                try
+                {
+                    if(key == "mapper") entry.mapper = std::stoi(value);
+                    else if(key == "submapper") entry.submapper = std::stoi(value);
+                    else if(key == "mirroring") entry.mirroring = parse_mirroring(value);
+                    else if(key == "timing") entry.timing = parse_timing(value);
+                    else if(key == "battery") entry.battery = std::stoi(value) != 0;
+                    else if(key == "prg_ram") entry.prg_ram_size = std::stoi(value);
+                    else if(key == "chr_ram") entry.chr_ram_size = std::stoi(value);
+                }
+                catch(const std::exception&)
+                {
+                }
+            }
+            entries.push_back(entry);
+        }
+    }
+
+    //Stable sort keeps input order within a CRC, the last entry for a CRC wins
+    std::vector<RomDatabaseEntry> sort_entries(std::vector<RomDatabaseEntry> entries)
+    {
+        std::stable_sort(entries.begin(), entries.end(), [](const RomDatabaseEntry& a, const RomDatabaseEntry& b) { return a.crc < b.crc; });
+        std::vector<RomDatabaseEntry> unique;
+        for(const RomDatabaseEntry& entry : entries)
+        {
+            if(!unique.empty() && unique.back().crc == entry.crc)
+                unique.back() = entry;
+            else
+                unique.push_back(entry);
+        }
+        return unique;
+    }
+
+    std::vector<RomDatabaseEntry> load_builtin()
+    {
+        std::vector<RomDatabaseEntry> entries;
+        std::istringstream builtin(BUILTIN_DATABASE);
+        parse(builtin, entries);
+        return sort_entries(std::move(entries));
+    }
+
+    std::vector<RomDatabaseEntry> load_file(const std::filesystem::path& path)
+    {
+        std::vector<RomDatabaseEntry> entries;
+        std::ifstream file(path);
+        if(file.is_open())
+            parse(file, entries);
+        return sort_entries(std::move(entries));
+    }
+
+    const RomDatabaseEntry* search(const std::vector<RomDatabaseEntry>& entries, uint32_t crc)
+    {
+        auto entry = std::lower_bound(entries.begin(), entries.end(), crc, [](const RomDatabaseEntry& a, uint32_t crc) { return a.crc < crc; });
+        if(entry == entries.end() || entry->crc != crc)
+            return nullptr;
+        return &*entry;
+    }
+}
+
+const RomDatabaseEntry* RomDatabase::find(uint32_t crc, const std::string& rom_filename)
+{
+    static const std::vector<RomDatabaseEntry> builtin = load_builtin();
+    //One table per ROM directory, machines load games from several threads in test_runner. Map nodes never move,
+    //so the entries handed out stay valid
+    static std::mutex mutex;
+    static std::map<std::string, std::vector<RomDatabaseEntry>> overrides;
+
+    std::string directory = std::filesystem::path(rom_filename).parent_path().string();
+    const std::vector<RomDatabaseEntry>* local;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = overrides.find(directory);
+        if(found == overrides.end())
+            found = overrides.emplace(directory, load_file(std::filesystem::path(directory) / OVERRIDE_FILE)).first;
+        local = &found->second;
+    }
+
+    if(const RomDatabaseEntry* entry = search(*local, crc))
+        return entry;
+    return search(builtin, crc);
+}
@@ -0,0 +1,112 @@
+#include "RomImage.h"
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace
+{
+    //Size and modification time tell a file that changed on disk from the one already mapped
+    struct RegistryEntry
+    {
+        std::weak_ptr<RomImage> image;
+        long long size;
+        long long modified;
+    };
+
+    std::mutex registry_mutex;
+    std::map<std::string, RegistryEntry> registry;
+}
+
+std::shared_ptr<RomImage> RomImage::open(const std::string& filename, std::string& error)
+{
+    struct stat info;
+    if(stat(filename.c_str(), &info) != 0)
+    {
+        error = std::string("Error: Could not open file ") + filename;
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    auto entry = registry.find(filename);
+    if(entry != registry.end())
+    {
+        std::shared_ptr<RomImage> image = entry->second.image.lock();
+        if(image && entry->second.size == (long long)info.st_size && entry->second.modified == (long long)info.st_mtime)
+            return image;
+    }
+
+    std::shared_ptr<RomImage> image(new RomImage());
+    if(!image->map(filename, error))
+        return nullptr;
+
+    for(auto it = registry.begin(); it != registry.end();)
+    {
+        if(it->second.image.expired())
+            it = registry.erase(it);
+        else
+            ++it;
+    }
+    registry[filename] = RegistryEntry{image, (long long)info.st_size, (long long)info.st_mtime};
+    return image;
+}
+
+bool RomImage::map(const std::string& filename, std::string& error)
+{
+    //Only Windows maps the file, see RomImage.h
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file != INVALID_HANDLE_VALUE)
+    {
+        LARGE_INTEGER file_size;
+        if(GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+        {
+            HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if(mapping)
+            {
+                void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                if(view)
+                {
+                    bytes = static_cast<const uint8_t*>(view);
+                    length = (size_t)file_size.QuadPart;
+                    mapping_handle = mapping;
+                    mapped = true;
+                }
+                else
+                    CloseHandle(mapping);
+            }
+        }
+        //The view keeps the file open on its own
+        CloseHandle(file);
+    }
+#endif
+
+    if(mapped)
+        return true;
+
+    std::ifstream file_stream(filename, std::ios::binary | std::ios::in);
+    if(!file_stream.is_open())
+    {
+        error = std::string("Error: Could not open file ") + filename;
+        return false;
+    }
+    fallback.assign(std::istreambuf_iterator<char>(file_stream), std::istreambuf_iterator<char>());
+    bytes = fallback.data();
+    length = fallback.size();
+    return true;
+}
+
+RomImage::~RomImage()
+{
+#ifdef _WIN32
+    if(!mapped)
+        return;
+    UnmapViewOfFile(bytes);
+    CloseHandle(mapping_handle);
+#endif
+}
@@ -0,0 +1,91 @@
+#include "SaveFile.h"
+#include <algorithm>
+#include <chrono>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+std::unique_ptr<SaveFile> SaveFile::open(const std::string& filename, size_t size)
+{
+    std::FILE* file = std::fopen(filename.c_str(), "r+b");
+    if(!file)
+        file = std::fopen(filename.c_str(), "w+b");
+    if(!file)
+        return nullptr;
+
+    std::unique_ptr<SaveFile> save(new SaveFile());
+    save->file = file;
+    save->contents = std::vector<std::atomic<uint8_t>>(size);
+    save->dirty = std::vector<std::atomic<uint64_t>>((size / PAGE_SIZE + 63) / 64);
+    save->page_buffer.resize(PAGE_SIZE);
+
+    std::vector<uint8_t> existing(size, 0);
+    size_t loaded = std::fread(existing.data(), 1, size, file);
+    for(size_t i = 0; i < size; i++)
+        save->contents[i].store(existing[i], std::memory_order_relaxed);
+
+    //A new or short file is written out in full on the first flush
+    for(size_t page = loaded / PAGE_SIZE; page < (size + PAGE_SIZE - 1) / PAGE_SIZE; page++)
+        save->dirty[page / 64].fetch_or(1ull << (page % 64), std::memory_order_relaxed);
+
+    save->flusher = std::thread(&SaveFile::flush_loop, save.get());
+    return save;
+}
+
+SaveFile::~SaveFile()
+{
+    {
+        std::lock_guard<std::mutex> lock(stop_mutex);
+        stopping = true;
+    }
+    stop_signal.notify_one();
+    flusher.join();
+    flush();
+    std::fclose(file);
+}
+
+void SaveFile::flush_loop()
+{
+    std::unique_lock<std::mutex> lock(stop_mutex);
+    while(!stop_signal.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL_MS), [this] { return stopping; }))
+    {
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
+
+void SaveFile::flush()
+{
+    bool written = false;
+    for(size_t word = 0; word < dirty.size(); word++)
+    {
+        //Clearing the bits before copying means a write racing with the copy marks its page dirty again
+        uint64_t pages = dirty[word].exchange(0, std::memory_order_acquire);
+        while(pages)
+        {
+            int bit = __builtin_ctzll(pages);
+            pages &= pages - 1;
+            size_t offset = (word * 64 + bit) * PAGE_SIZE;
+            size_t length = std::min<size_t>(PAGE_SIZE, contents.size() - offset);
+            for(size_t i = 0; i < length; i++)
+                page_buffer[i] = contents[offset + i].load(std::memory_order_relaxed);
+
+            std::fseek(file, (long)offset, SEEK_SET);
+            std::fwrite(page_buffer.data(), 1, length, file);
+            written = true;
+        }
+    }
+
+    if(!written)
+        return;
+    std::fflush(file);
+#ifdef _WIN32
+    _commit(_fileno(file));
+#else
+    fsync(fileno(file));
+#endif
+}
@@ -1,7 +1,7 @@
 #include "SxROM.h"
 #include "Cartridge.h"
 
-SxROM::SxROM(int n_prg_rom_banks, int n_chr_rom_banks, std::shared_ptr<Cartridge> cart) : Mapper(n_prg_rom_banks, n_chr_rom_banks, cart)
+SxROM::SxROM(uint32_t prg_rom_size, uint32_t chr_size, std::shared_ptr<Cartridge> cart) : Mapper(prg_rom_size, chr_size, cart)
 {
     n_write = 0;
     shift_register = 0x10;
@@ -12,81 +12,7 @@ SxROM::SxROM(int n_prg_rom_banks, int n_chr_rom_banks, std::shared_ptr<Cartridge
     prg_bank = 0;
     control = 0;
     mirroring_mode = MIRROR::HORIZONTAL;
-}
-
-uint32_t SxROM::cpu_reads(uint16_t address)
-{
-    uint32_t mapped_addr;
-
-    //PRG RAM
-    if(address >= 0x6000 && address < 0x8000)
-        mapped_addr = address & (PRG_ROM_BANK_SIZE_8KB-1);
-    
-    //PRG ROM
-    else if(address >= 0x8000 && address <= 0xFFFF)
-    {
-        switch(prg_rom_mode)
-        {
-            case 0:
-            case 1:
-                mapped_addr = (((prg_bank & 0x1E)) * PRG_ROM_BANK_SIZE_16KB) + (address & (PRG_ROM_BANK_SIZE_32KB-1));;
-                break; 
-            case 2:
-                if(address < 0xC000) 
-                    mapped_addr = address & (PRG_ROM_BANK_SIZE_16KB-1);
-                else 
-                    mapped_addr = ((prg_bank & 0xF) * PRG_ROM_BANK_SIZE_16KB) + (address & (PRG_ROM_BANK_SIZE_16KB-1));
-                break;
-
-            case 3:
-                if(address < 0xC000) 
-                    mapped_addr = ((prg_bank & 0xF) * PRG_ROM_BANK_SIZE_16KB) + (address & (PRG_ROM_BANK_SIZE_16KB-1));
-                else 
-                    mapped_addr = ((n_prg_rom_banks - 1) * PRG_ROM_BANK_SIZE_16KB) + (address & (PRG_ROM_BANK_SIZE_16KB-1));
-                break;
-        }     
-    }
-
-    return mapped_addr; 
-}
-
-uint32_t SxROM::ppu_reads(uint16_t address)
-{
-    uint32_t mapped_addr = 0;
-
-    //CHR ROM
-    if(n_chr_rom_banks != 0)
-    {
-        if(chr_rom_mode)
-        {
-            if(address >= 0x0000 && address < 0x1000)
-                mapped_addr = (chr_bank_0 * CHR_ROM_BANK_SIZE_4KB) + (address & (CHR_ROM_BANK_SIZE_4KB-1));
-
-            else if(address >= 0x1000 && address < 0x2000)
-                mapped_addr = (chr_bank_1 * CHR_ROM_BANK_SIZE_4KB) + (address & (CHR_ROM_BANK_SIZE_4KB-1));         
-        }
-        else
-        {
-            if(address >= 0x0000 && address < 0x2000)
-                mapped_addr = ( ((chr_bank_0 & 0xFE)) * CHR_ROM_BANK_SIZE_4KB) + (address & (CHR_ROM_BANK_SIZE_8KB-1));
-        }
-    }
-    //CHR RAM
-    else
-    {
-        if(chr_rom_mode)
-        {
-            if(address >= 0x0000 && address < 0x1000)
-                mapped_addr = ((chr_bank_0 & 0x1) * CHR_ROM_BANK_SIZE_4KB) + (address & (CHR_ROM_BANK_SIZE_4KB-1));
-
-            else if(address >= 0x1000 && address < 0x2000)
-                mapped_addr = ((chr_bank_1 & 0x1) * CHR_ROM_BANK_SIZE_4KB) + (address & (CHR_ROM_BANK_SIZE_4KB-1));             
-        }
-        else
-            mapped_addr = address & (CHR_ROM_BANK_SIZE_8KB-1);
-    }
-    
-    return mapped_addr;
+    update_banks();
 }
 
 void SxROM::cpu_writes(uint16_t address, uint8_t value)
@@ -116,12 +42,15 @@ void SxROM::cpu_writes(uint16_t address, uint8_t value)
                         break;
                     case 1:
                         chr_bank_0 = shift_register & 0x1F;
+                        update_banks();
                         break;
                     case 2:
                         chr_bank_1 = shift_register & 0x1F;
+                        update_banks();
                         break;
                     case 3:
-                        prg_bank = ((shift_register & 0x0F) & (n_prg_rom_banks-1));
+                        prg_bank = shift_register & 0x0F;
+                        update_banks();
                         break;                  
                 }  
                 n_write = 0; // Reset write count
@@ -154,4 +83,32 @@ void SxROM::update_state()
             break;
     }
     cart->set_mirroring_mode(mirroring_mode);
+    update_banks();
+}
+
+void SxROM::update_banks()
+{
+    switch(prg_rom_mode)
+    {
+        case 0:
+        case 1:
+            map_prg<32>(0, prg_bank >> 1);
+            break;
+        case 2:
+            map_prg<16>(0, 0);
+            map_prg<16>(1, prg_bank);
+            break;
+        case 3:
+            map_prg<16>(0, prg_bank);
+            map_prg<16>(1, -1);
+            break;
+    }
+
+    if(chr_rom_mode)
+    {
+        map_chr<4>(0, chr_bank_0);
+        map_chr<4>(1, chr_bank_1);
+    }
+    else
+        map_chr<8>(0, chr_bank_0 >> 1);
 }
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include "TraceRecorder.h"
+#include <chrono>
+#include <cstring>
+
+TraceRecorder::TraceRecorder()
+{
+}
+
+TraceRecorder::~TraceRecorder()
+{
+    stop();
+}
+
+bool TraceRecorder::start(const std::string& filename)
+{
+    if(recording)
+        return true;
+
+    file.open(filename, std::ios::binary | std::ios::trunc);
+    if(!file.is_open())
+        return false;
+
+    uint8_t header[2] = {TRACE_VERSION, sizeof(TraceRecord)};
+    file.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+    ring.resize(RING_SIZE);
+    head = 0;
+    tail = 0;
+    records_written = 0;
+    running = true;
+    recording = true;
+    writer = std::thread(&TraceRecorder::write_loop, this);
+    return true;
+}
+
+void TraceRecorder::stop()
+{
+    if(!recording)
+        return;
+
+    running = false;
+    writer.join();
+    file.close();
+    recording = false;
+}
+
+void TraceRecorder::write_loop()
+{
+    TraceRecord previous;
+    std::memset(&previous, 0, sizeof(previous));
+    std::vector<uint8_t> output;
+    output.reserve(FLUSH_SIZE + TRACE_MASK_BYTES + sizeof(TraceRecord));
+
+    while(true)
+    {
+        //Read the stop flag first so everything pushed before stop() is drained
+        bool stopping = !running.load(std::memory_order_acquire);
+        size_t position = tail.load(std::memory_order_relaxed);
+        size_t end = head.load(std::memory_order_acquire);
+        size_t begin = position;
+
+        for(; position != end; position++)
+        {
+            const TraceRecord& entry = ring[position & (RING_SIZE - 1)];
+            const uint8_t* current_bytes = reinterpret_cast<const uint8_t*>(&entry);
+            const uint8_t* previous_bytes = reinterpret_cast<const uint8_t*>(&previous);
+
+            size_t mask_position = output.size();
+            output.resize(mask_position + TRACE_MASK_BYTES, 0);
+            for(size_t i = 0; i < sizeof(TraceRecord); i++)
+            {
+                if(current_bytes[i] != previous_bytes[i])
+                {
+                    output[mask_position + i / 8] |= 1 << (i % 8);
+                    output.push_back(current_bytes[i]);
+                }
+            }
+
+            previous = entry;
+            if(output.size() >= FLUSH_SIZE)
+            {
+                tail.store(position + 1, std::memory_order_release);
+                file.write(reinterpret_cast<const char*>(output.data()), output.size());
+                output.clear();
+            }
+        }
+        tail.store(end, std::memory_order_release);
+        records_written.store(records_written.load(std::memory_order_relaxed) + (end - begin), std::memory_order_relaxed);
+
+        if(stopping)
+            break;
+        if(position == head.load(std::memory_order_acquire))
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    file.write(reinterpret_cast<const char*>(output.data()), output.size());
+}
@@ -0,0 +1,116 @@
+#include <algorithm>
+#include "TurboRenderer.h"
+
+TurboRenderer::TurboRenderer(int workers)
+{
+    frame = std::vector<uint32_t>(256 * 240);
+    newest = std::vector<uint32_t>(256 * 240);
+    for(int i = 0; i < std::max(workers, 1); i++)
+    {
+        this->workers.push_back(std::make_unique<Worker>());
+        Worker& worker = *this->workers.back();
+        worker.thread = std::thread(&TurboRenderer::run, this, std::ref(worker));
+    }
+}
+
+TurboRenderer::~TurboRenderer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    work_ready.notify_all();
+    for(std::unique_ptr<Worker>& worker : workers)
+        worker->thread.join();
+}
+
+bool TurboRenderer::begin_frame(const PPU& ppu, const Cartridge& cart)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(std::unique_ptr<Worker>& worker : workers)
+        {
+            if(worker->state == IDLE)
+            {
+                worker->state = CLAIMED;
+                claimed = worker.get();
+                break;
+            }
+        }
+    }
+    if(!claimed)
+        return false;
+
+    //A claimed worker waits for its frame, its machine is the emulation thread's to fill until then
+    claimed->follower.start(ppu, cart);
+    return true;
+}
+
+void TurboRenderer::end_frame(PPULog& log, uint32_t end_dot)
+{
+    claimed->log.clear();
+    claimed->log.swap_entries(log);
+    claimed->end_dot = end_dot;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        claimed->sequence = next_sequence++;
+        claimed->state = DRAWING;
+    }
+    claimed = nullptr;
+    work_ready.notify_all();
+}
+
+void TurboRenderer::cancel_frame()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    claimed->state = IDLE;
+    claimed = nullptr;
+}
+
+void TurboRenderer::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    work_done.wait(lock, [this]
+    {
+        for(std::unique_ptr<Worker>& worker : workers)
+            if(worker->state == DRAWING)
+                return false;
+        return true;
+    });
+}
+
+bool TurboRenderer::collect()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if(newest_taken)
+        return false;
+    std::swap(frame, newest);
+    newest_taken = true;
+    return true;
+}
+
+void TurboRenderer::run(Worker& worker)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true)
+    {
+        work_ready.wait(lock, [this, &worker] { return worker.state == DRAWING || quit; });
+        if(quit)
+            return;
+
+        lock.unlock();
+        worker.follower.replay(worker.log, worker.end_dot, true);
+        lock.lock();
+
+        //Workers finish out of order, a frame older than the one kept is dropped. The screen given back to
+        //the worker is drawn over completely by its next frame
+        if(worker.sequence > newest_sequence)
+        {
+            std::swap(newest, worker.follower.get_screen());
+            newest_sequence = worker.sequence;
+            newest_taken = false;
+        }
+        worker.state = IDLE;
+        work_done.notify_all();
+    }
+}
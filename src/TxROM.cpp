@@ -1,7 +1,7 @@
 #include "TxROM.h"
 #include "Cartridge.h"
 
-TxROM::TxROM(int n_prg_rom_banks, int n_chr_rom_banks, std::shared_ptr<Cartridge> cart) : Mapper(n_prg_rom_banks * 2, n_chr_rom_banks, cart)
+TxROM::TxROM(uint32_t prg_rom_size, uint32_t chr_size, std::shared_ptr<Cartridge> cart) : Mapper(prg_rom_size, chr_size, cart)
 {
     select_bank = 0;
     R0 = 0;
@@ -18,6 +18,8 @@ TxROM::TxROM(int n_prg_rom_banks, int n_chr_rom_banks, std::shared_ptr<Cartridge
     irq_latch = 0;
     irq_reload = 0;
     irq_counter = 0;
+    irq_enable = 0;
+    update_banks();
 }
 
 void TxROM::cpu_writes(uint16_t address, uint8_t value)
@@ -40,10 +42,11 @@ void TxROM::cpu_writes(uint16_t address, uint8_t value)
                 case 3: R3 = value; break;
                 case 4: R4 = value; break;
                 case 5: R5 = value; break;
-                case 6: R6 = (value & 0x3F) & (n_prg_rom_banks-1); break; // Ignore top 2 bits
-                case 7: R7 = (value & 0x3F) & (n_prg_rom_banks-1); break; // Ignore top 2 bits
+                case 6: R6 = (value & 0x3F); break; // Ignore top 2 bits
+                case 7: R7 = (value & 0x3F); break; // Ignore top 2 bits
             }
         }
+        update_banks();
     }
 
     if(address >= 0xA000 && address <= 0xBFFF)
@@ -59,91 +62,53 @@ void TxROM::cpu_writes(uint16_t address, uint8_t value)
     if(address >= 0xC000 && address <= 0xDFFF)
     {
         if(address & 0x1)
-            cart->set_irq_reload();
+        {
+            irq_counter = 0;
+            irq_reload = true;
+        }
         else
-            cart->set_irq_latch(value);
+            irq_latch = value;
 
     }
 
     if(address >= 0xE000 && address <= 0xFFFF)
     {
-        if(address & 0x1)
-            cart->set_irq_enable(1);
-        else
-            cart->set_irq_enable(0);
+        irq_enable = address & 0x1;
+        if(!irq_enable)
+            cart->set_irq(false);
     }
 }
 
-uint32_t TxROM::cpu_reads(uint16_t address)
+//Scanline counter, clocked by the PPU once per rendered line
+void TxROM::A12_rising()
 {
-    if(address >= 0x6000 && address < 0x8000) 
-        mapped_address = address & (PRG_ROM_BANK_SIZE_8KB-1);
-
-    else if(address >= 0x8000 && address <= 0xFFFF)
-    {
-        if(prg_rom_bank_mode)
-        {
-            if(address >= 0x8000 && address <= 0x9FFF)
-                mapped_address = ((n_prg_rom_banks-2) * PRG_ROM_BANK_SIZE_8KB) + (address & (PRG_ROM_BANK_SIZE_8KB-1));
-            if(address >= 0xA000 && address <= 0xBFFF)
-                mapped_address = (R7 * PRG_ROM_BANK_SIZE_8KB) + (address & (PRG_ROM_BANK_SIZE_8KB-1));
-            if(address >= 0xC000 && address <= 0xDFFF)
-                mapped_address = (R6 * PRG_ROM_BANK_SIZE_8KB) + (address & (PRG_ROM_BANK_SIZE_8KB-1));
-            if(address >= 0xE000 && address <= 0xFFFF)
-                mapped_address = ((n_prg_rom_banks-1) * PRG_ROM_BANK_SIZE_8KB) + (address & (PRG_ROM_BANK_SIZE_8KB-1));        
-        }
-    
-        else
-        {
-            if((address >= 0x8000) && (address <= 0x9FFF))
-                mapped_address = (R6 * PRG_ROM_BANK_SIZE_8KB) + (address & (PRG_ROM_BANK_SIZE_8KB-1));
-            if((address >= 0xA000) && (address <= 0xBFFF))
-                mapped_address = (R7 * PRG_ROM_BANK_SIZE_8KB) + (address & (PRG_ROM_BANK_SIZE_8KB-1));
-            if((address >= 0xC000) && (address <= 0xDFFF))
-                mapped_address = ((n_prg_rom_banks-2) * PRG_ROM_BANK_SIZE_8KB) + (address & (PRG_ROM_BANK_SIZE_8KB-1));
-            if((address >= 0xE000) && (address <= 0xFFFF))
-                mapped_address = ((n_prg_rom_banks-1) * PRG_ROM_BANK_SIZE_8KB) + (address & (PRG_ROM_BANK_SIZE_8KB-1));       
-        }
+    if ((irq_counter == 0) || irq_reload) 
+    {     
+        irq_counter = irq_latch; // Reload the counter
+        irq_reload = false;
     }
+    else
+        irq_counter--;
 
-    return mapped_address;
+    if (irq_enable && irq_counter == 0)
+        cart->set_irq(true);
 }
 
-uint32_t TxROM::ppu_reads(uint16_t address)
+void TxROM::update_banks()
 {
-    uint32_t mapped_address = 0; 
-
-    if(chr_inversion)
-    {
-        if(address >= 0x0000 && address <= 0x03FF)
-            mapped_address = (R2 * CHR_ROM_BANK_SIZE_1KB) + (address & (CHR_ROM_BANK_SIZE_1KB-1));
-        if(address >= 0x0400 && address <= 0x07FF)
-            mapped_address = (R3 * CHR_ROM_BANK_SIZE_1KB) + (address & (CHR_ROM_BANK_SIZE_1KB-1));
-        if(address >= 0x0800 && address <= 0x0BFF)
-            mapped_address = (R4 * CHR_ROM_BANK_SIZE_1KB) + (address & (CHR_ROM_BANK_SIZE_1KB-1));
-        if(address >= 0x0C00 && address <= 0x0FFF)
-            mapped_address = (R5 * CHR_ROM_BANK_SIZE_1KB) + (address & (CHR_ROM_BANK_SIZE_1KB-1));
-        if(address >= 0x1000 && address <= 0x17FF)
-            mapped_address = (R0 * CHR_ROM_BANK_SIZE_1KB) + (address & (CHR_ROM_BANK_SIZE_2KB-1));
-        if(address >= 0x1800 && address <= 0x1FFF)
-            mapped_address = (R1 * CHR_ROM_BANK_SIZE_1KB) + (address & (CHR_ROM_BANK_SIZE_2KB-1));
-    }
-
-    else
-    {
-        if(address >= 0x0000 && address <= 0x07FF)
-            mapped_address = (R0 * CHR_ROM_BANK_SIZE_1KB) + (address & (CHR_ROM_BANK_SIZE_2KB-1));
-        if(address >= 0x0800 && address <= 0x0FFF)
-            mapped_address = (R1 * CHR_ROM_BANK_SIZE_1KB) + (address & (CHR_ROM_BANK_SIZE_2KB-1));
-        if(address >= 0x1000 && address <= 0x13FF)
-            mapped_address = (R2 * CHR_ROM_BANK_SIZE_1KB) + (address & (CHR_ROM_BANK_SIZE_1KB-1));
-        if(address >= 0x1400 && address <= 0x17FF)
-            mapped_address = (R3 * CHR_ROM_BANK_SIZE_1KB) + (address & (CHR_ROM_BANK_SIZE_1KB-1));
-        if(address >= 0x1800 && address <= 0x1BFF)
-            mapped_address = (R4 * CHR_ROM_BANK_SIZE_1KB) + (address & (CHR_ROM_BANK_SIZE_1KB-1));
-        if(address >= 0x1C00 && address <= 0x1FFF)
-            mapped_address = (R5 * CHR_ROM_BANK_SIZE_1KB) + (address & (CHR_ROM_BANK_SIZE_1KB-1));     
-    }
+    //PRG mode 1 swaps $8000 and $C000, the second to last bank takes the place of R6
+    map_prg<8>(prg_rom_bank_mode ? 2 : 0, R6);
+    map_prg<8>(1, R7);
+    map_prg<8>(prg_rom_bank_mode ? 0 : 2, -2);
+    map_prg<8>(3, -1);
 
-    return mapped_address;
+    //CHR inversion swaps the 2KB banks at $0000 with the 1KB banks at $1000. R0 and R1 count 1KB banks
+    int two_kb_half = chr_inversion ? 1 : 0;
+    int one_kb_half = chr_inversion ? 0 : 1;
+    map_chr<2>(two_kb_half * 2, R0 >> 1);
+    map_chr<2>(two_kb_half * 2 + 1, R1 >> 1);
+    map_chr<1>(one_kb_half * 4, R2);
+    map_chr<1>(one_kb_half * 4 + 1, R3);
+    map_chr<1>(one_kb_half * 4 + 2, R4);
+    map_chr<1>(one_kb_half * 4 + 3, R5);
 }
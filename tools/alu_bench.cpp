@@ -0,0 +1,231 @@
+// Checks the table driven ALU (see include/ALU.h) against a straightforward branching implementation for
+// every input, then times both, one operation at a time, on a stream of random operands
+//
+// usage: alu_bench [operations]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "ALU.h"
+
+//The flag code the CPU handlers used before the ALU, one branch per flag
+namespace Branching
+{
+    void set_nz(uint8_t& P, uint8_t value)
+    {
+        if(value == 0x00)
+            P = P | 0x02;
+        else
+            P = P & 0xFD;
+        P = (P & 0x7F) | (value & 0x80);
+    }
+
+    uint8_t adc(uint8_t& P, uint8_t a, uint8_t operand)
+    {
+        uint16_t calc = a + operand + (P & 0x01);
+        uint8_t result = calc & 0xFF;
+        if(calc > 0xFF)
+            P |= 0x01;
+        else
+            P &= 0xFE;
+        if(((a & 0x80) == (operand & 0x80)) && ((result & 0x80) != (operand & 0x80)))
+            P |= 0x40;
+        else
+            P &= 0xBF;
+        set_nz(P, result);
+        return result;
+    }
+
+    uint8_t sbc(uint8_t& P, uint8_t a, uint8_t operand)
+    {
+        return adc(P, a, ~operand);
+    }
+
+    void cmp(uint8_t& P, uint8_t reg, uint8_t operand)
+    {
+        uint8_t calc = reg - operand;
+        if(reg >= operand)
+            P |= 0x01;
+        else
+            P &= 0xFE;
+        if(reg == operand)
+            P |= 0x02;
+        else
+            P &= 0xFD;
+        P = (P & 0x7F) | (calc & 0x80);
+    }
+
+    void bit(uint8_t& P, uint8_t a, uint8_t operand)
+    {
+        P = ((a & operand) == 0x00) ? (P | 0x02) : (P & 0xFD);
+        P = (P & 0x7F) | (operand & 0x80);
+        P = (P & 0xBF) | (operand & 0x40);
+    }
+
+    uint8_t asl(uint8_t& P, uint8_t value)
+    {
+        P = (P & 0xFE) | ((value & 0x80) >> 7);
+        value <<= 1;
+        set_nz(P, value);
+        return value;
+    }
+
+    uint8_t lsr(uint8_t& P, uint8_t value)
+    {
+        P = (P & 0xFE) | (value & 0x01);
+        value >>= 1;
+        set_nz(P, value);
+        return value;
+    }
+
+    uint8_t rol(uint8_t& P, uint8_t value)
+    {
+        uint8_t carry = (value >> 7) & 0x01;
+        value = (value << 1) | (P & 0x01);
+        P = (P & 0xFE) | carry;
+        set_nz(P, value);
+        return value;
+    }
+
+    uint8_t ror(uint8_t& P, uint8_t value)
+    {
+        uint8_t carry = value & 0x01;
+        value = (value >> 1) | ((P & 0x01) << 7);
+        P = (P & 0xFE) | carry;
+        set_nz(P, value);
+        return value;
+    }
+}
+
+enum Operation { ADC, SBC, CMP, BIT, ASL, LSR, ROL, ROR, LOAD, OPERATIONS };
+const char* operation_names[OPERATIONS] = {"ADC", "SBC", "CMP", "BIT", "ASL", "LSR", "ROL", "ROR", "LDA"};
+
+//Shifts work on the operand like their read-modify-write forms
+template <typename Unit>
+inline uint8_t apply(int operation, uint8_t A, uint8_t operand, uint8_t& P)
+{
+    switch(operation)
+    {
+        case ADC: return Unit::adc(P, A, operand);
+        case SBC: return Unit::sbc(P, A, operand);
+        case CMP: Unit::cmp(P, A, operand); return A;
+        case BIT: Unit::bit(P, A, operand); return A;
+        case ASL: return Unit::asl(P, operand);
+        case LSR: return Unit::lsr(P, operand);
+        case ROL: return Unit::rol(P, operand);
+        case ROR: return Unit::ror(P, operand);
+        default: Unit::set_nz(P, operand); return operand;
+    }
+}
+
+struct Table
+{
+    static void set_nz(uint8_t& P, uint8_t value) { ALU::set_nz(P, value); }
+    static uint8_t adc(uint8_t& P, uint8_t a, uint8_t operand) { return ALU::adc(P, a, operand); }
+    static uint8_t sbc(uint8_t& P, uint8_t a, uint8_t operand) { return ALU::sbc(P, a, operand); }
+    static void cmp(uint8_t& P, uint8_t a, uint8_t operand) { ALU::cmp(P, a, operand); }
+    static void bit(uint8_t& P, uint8_t a, uint8_t operand) { ALU::bit(P, a, operand); }
+    static uint8_t asl(uint8_t& P, uint8_t value) { return ALU::asl(P, value); }
+    static uint8_t lsr(uint8_t& P, uint8_t value) { return ALU::lsr(P, value); }
+    static uint8_t rol(uint8_t& P, uint8_t value) { return ALU::rol(P, value); }
+    static uint8_t ror(uint8_t& P, uint8_t value) { return ALU::ror(P, value); }
+};
+
+struct Reference
+{
+    static void set_nz(uint8_t& P, uint8_t value) { Branching::set_nz(P, value); }
+    static uint8_t adc(uint8_t& P, uint8_t a, uint8_t operand) { return Branching::adc(P, a, operand); }
+    static uint8_t sbc(uint8_t& P, uint8_t a, uint8_t operand) { return Branching::sbc(P, a, operand); }
+    static void cmp(uint8_t& P, uint8_t a, uint8_t operand) { Branching::cmp(P, a, operand); }
+    static void bit(uint8_t& P, uint8_t a, uint8_t operand) { Branching::bit(P, a, operand); }
+    static uint8_t asl(uint8_t& P, uint8_t value) { return Branching::asl(P, value); }
+    static uint8_t lsr(uint8_t& P, uint8_t value) { return Branching::lsr(P, value); }
+    static uint8_t rol(uint8_t& P, uint8_t value) { return Branching::rol(P, value); }
+    static uint8_t ror(uint8_t& P, uint8_t value) { return Branching::ror(P, value); }
+};
+
+//Every operation on every accumulator, operand and incoming P (all flags matter for the untouched bits)
+bool check()
+{
+    for(int op = 0; op < OPERATIONS; op++)
+    {
+        for(int P_in = 0; P_in < 256; P_in++)
+        {
+            for(int a = 0; a < 256; a++)
+            {
+                for(int operand = 0; operand < 256; operand++)
+                {
+                    uint8_t P_table = P_in;
+                    uint8_t P_reference = P_in;
+                    uint8_t A_table = apply<Table>(op, a, operand, P_table);
+                    uint8_t A_reference = apply<Reference>(op, a, operand, P_reference);
+                    if(A_table != A_reference || P_table != P_reference)
+                    {
+                        std::printf("%s A=%02X operand=%02X P=%02X: got A=%02X P=%02X, expected A=%02X P=%02X\n",
+                                    operation_names[op], a, operand, P_in, A_table, P_table, A_reference, P_reference);
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+//One operation over a stream of operands, A and P carry over from one step to the next like in a CPU.
+//The operation is a template parameter so the loop measures the ALU and not the dispatch, every P is
+//summed so none of the steps can be optimised away
+template <typename Unit, int operation>
+double time(const std::vector<uint8_t>& operands, uint8_t& A, uint8_t& P, uint32_t& checksum)
+{
+    auto start = std::chrono::steady_clock::now();
+    for(uint8_t operand : operands)
+    {
+        A = apply<Unit>(operation, A, operand, P);
+        checksum += P;
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e9 / operands.size();
+}
+
+template <int operation>
+void time_operation(const std::vector<uint8_t>& operands)
+{
+    uint8_t A_reference = 0, P_reference = 0x24;
+    uint8_t A_table = 0, P_table = 0x24;
+    uint32_t sum_reference = 0, sum_table = 0;
+    double reference = time<Reference, operation>(operands, A_reference, P_reference, sum_reference);
+    double table = time<Table, operation>(operands, A_table, P_table, sum_table);
+    std::printf("%s  branching %5.2f ns/op  table %5.2f ns/op%s\n", operation_names[operation], reference, table,
+                (A_reference != A_table || sum_reference != sum_table) ? "  MISMATCH" : "");
+}
+
+int main(int argc, char* argv[])
+{
+    int operations = (argc > 1) ? std::atoi(argv[1]) : 20000000;
+    if(operations <= 0)
+    {
+        std::printf("usage: alu_bench [operations]\n");
+        return 1;
+    }
+
+    if(!check())
+        return 1;
+    std::printf("table ALU matches the branching one for every input\n");
+
+    std::mt19937 random(2024);
+    std::vector<uint8_t> operands(operations);
+    for(uint8_t& operand : operands)
+        operand = random();
+
+    time_operation<ADC>(operands);
+    time_operation<SBC>(operands);
+    time_operation<CMP>(operands);
+    time_operation<BIT>(operands);
+    time_operation<ASL>(operands);
+    time_operation<LSR>(operands);
+    time_operation<ROL>(operands);
+    time_operation<ROR>(operands);
+    time_operation<LOAD>(operands);
+    return 0;
+}
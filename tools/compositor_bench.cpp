@@ -0,0 +1,116 @@
+// Benchmarks the scanline compositor (see include/Compositor.h) on synthetic lines and checks every
+// compiled backend against the scalar one
+//
+// usage: compositor_bench [lines]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "Compositor.h"
+
+using namespace Compositor;
+
+typedef int (*ComposeFunction)(const uint8_t*, const uint8_t*, const uint8_t*, const uint8_t*, const uint32_t*, uint32_t*);
+
+struct Backend
+{
+    const char* name;
+    ComposeFunction compose;
+};
+
+struct Line
+{
+    uint8_t bg_color[LINE_WIDTH];
+    uint8_t bg_pixel[LINE_WIDTH];
+    uint8_t sprite_color[LINE_WIDTH];
+    uint8_t sprite_flags[LINE_WIDTH];
+};
+
+//Background noise with 8 sprites at random positions, roughly what a busy game produces
+void make_line(Line& line, std::mt19937& random)
+{
+    for(int x = 0; x < LINE_WIDTH; x++)
+    {
+        line.bg_color[x] = random() & 0x3F;
+        line.bg_pixel[x] = random() & 0x3;
+        line.sprite_color[x] = 0;
+        line.sprite_flags[x] = 0;
+    }
+
+    for(int sprite = 7; sprite >= 0; sprite--)
+    {
+        int sprite_x = random() % LINE_WIDTH;
+        uint8_t flags = SPRITE_OPAQUE | ((random() & 1) ? SPRITE_BEHIND : 0) | (sprite == 0 ? SPRITE_ZERO : 0);
+        uint8_t color = random() & 0x3F;
+        for(int x = sprite_x; x < sprite_x + 8 && x < LINE_WIDTH; x++)
+        {
+            if(random() & 3)
+            {
+                line.sprite_flags[x] = flags;
+                line.sprite_color[x] = color;
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int lines = (argc > 1) ? std::atoi(argv[1]) : 1000000;
+    if(lines <= 0)
+    {
+        std::printf("usage: compositor_bench [lines]\n");
+        return 1;
+    }
+
+    std::vector<Backend> backends = {{"scalar", compose_line_scalar}};
+#ifdef __SSE2__
+    backends.push_back({"SSE2", compose_line_sse2});
+#endif
+#ifdef __AVX2__
+    backends.push_back({"AVX2", compose_line_avx2});
+#endif
+
+    uint32_t palette[64];
+    for(int i = 0; i < 64; i++)
+        palette[i] = 0x01000000u * i + 0x00FF00FFu;
+
+    //A small set of lines reused round robin keeps the benchmark about the compositor, not memory
+    std::mt19937 random(2024);
+    std::vector<Line> inputs(256);
+    for(Line& line : inputs)
+        make_line(line, random);
+
+    uint32_t expected[LINE_WIDTH];
+    uint32_t output[LINE_WIDTH];
+    for(const Line& line : inputs)
+    {
+        int expected_hit = compose_line_scalar(line.bg_color, line.bg_pixel, line.sprite_color, line.sprite_flags, palette, expected);
+        for(const Backend& backend : backends)
+        {
+            int hit = backend.compose(line.bg_color, line.bg_pixel, line.sprite_color, line.sprite_flags, palette, output);
+            if(hit != expected_hit || std::memcmp(output, expected, sizeof(output)) != 0)
+            {
+                std::printf("%s differs from scalar\n", backend.name);
+                return 1;
+            }
+        }
+    }
+
+    std::printf("compose_line uses %s\n", backend());
+    for(const Backend& backend : backends)
+    {
+        int hits = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < lines; i++)
+        {
+            const Line& line = inputs[i & (inputs.size() - 1)];
+            hits += backend.compose(line.bg_color, line.bg_pixel, line.sprite_color, line.sprite_flags, palette, output) >= 0;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::printf("%-8s %8.1f ns/line %10.1f Mpixel/s (%d hits)\n", backend.name, seconds * 1e9 / lines,
+                    lines * (double)LINE_WIDTH / seconds / 1e6, hits);
+    }
+    return 0;
+}
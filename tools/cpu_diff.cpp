@@ -0,0 +1,918 @@
+// Differential checks of the CPU core
+//
+// usage: cpu_diff lockstep <rom> [--frames N] [--movie FILE] [--history N] [--no-dummy-reads]
+//        cpu_diff record <rom> <trace file> [--frames N] [--movie FILE] [--blocks]
+//        cpu_diff compare <trace file> <trace file> [--history N]
+//
+// lockstep runs the CPU core against a small reference 6502 written from the data sheet, one instruction at
+// a time (see include/CPUProbe.h). The reference keeps its own mirror of internal RAM and takes every other
+// read from the core's bus log, so both see the same register and cartridge values. After each instruction
+// the registers, the cycle count and the bus accesses have to agree. The interpreter leaves out the dummy
+// read of indexed reads that cross a page, --no-dummy-reads stops that from counting as a divergence when
+// the read lands on a register.
+//
+// record and compare check two builds against each other. Both cores can't live in one process, so each
+// build records a trace (include/TraceRecorder.h) of the same ROM and movie and compare walks the two traces
+// to the first instruction where they differ.
+//
+// Either way a divergence prints the last --history instructions leading up to it.
+//
+// A movie is a text file with the controller state for each frame in hex, one frame per line and controller
+// 2 in the high byte. # starts a comment. Frames past the end of the movie have no buttons pressed.
+#define SDL_MAIN_HANDLED
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "Disassembler.h"
+#include "NES.h"
+
+// Bus.cpp reads the controller state from the frontend
+uint16_t controller_state = 0;
+
+const int DEFAULT_FRAMES = 600;
+const int DEFAULT_HISTORY = 32;
+
+bool load_movie(const std::string& filename, std::vector<uint16_t>& movie)
+{
+    std::ifstream file(filename);
+    if(!file)
+        return false;
+
+    std::string line;
+    while(std::getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        size_t start = line.find_first_not_of(" \t\r");
+        if(start != std::string::npos)
+            movie.push_back(std::strtoul(line.c_str() + start, nullptr, 16));
+    }
+    return true;
+}
+
+bool load_rom(NES& nes, const std::string& filename)
+{
+    nes.set_render_interval(0);
+    if(!nes.load_game(filename))
+    {
+        fprintf(stderr, "can't load %s: %s\n", filename.c_str(), nes.get_log().c_str());
+        return false;
+    }
+    return true;
+}
+
+//What the reference 6502 does on the bus. The lockstep checker serves every access and checks it against the core
+class ReferenceBus
+{
+    public:
+        virtual ~ReferenceBus() {}
+        virtual uint8_t read(uint16_t address) = 0;
+        //A read the real CPU makes only because it can't skip the cycle, its value is never used
+        virtual void dummy_read(uint16_t address) = 0;
+        //Bits in ignore aren't compared, for the unused bit of pushed status registers
+        virtual void write(uint16_t address, uint8_t value, uint8_t ignore = 0) = 0;
+        //The unmodified value a read-modify-write instruction writes back before the result
+        virtual void dummy_write(uint16_t address, uint8_t value) = 0;
+        //Whether the core read address during the current instruction
+        virtual bool core_read(uint16_t address) = 0;
+};
+
+enum Operation
+{
+    ADC, AND, ASL, BCC, BCS, BEQ, BIT, BMI, BNE, BPL, BRK, BVC, BVS, CLC, CLD, CLI, CLV, CMP, CPX, CPY,
+    DEC, DEX, DEY, EOR, INC, INX, INY, JMP, JSR, LDA, LDX, LDY, LSR, NOP, ORA, PHA, PHP, PLA, PLP, ROL,
+    ROR, RTI, RTS, SBC, SEC, SED, SEI, STA, STX, STY, TAX, TAY, TSX, TXA, TXS, TYA, UNKNOWN
+};
+
+const char* operation_names[UNKNOWN] =
+{
+    "ADC", "AND", "ASL", "BCC", "BCS", "BEQ", "BIT", "BMI", "BNE", "BPL", "BRK", "BVC", "BVS", "CLC", "CLD", "CLI",
+    "CLV", "CMP", "CPX", "CPY", "DEC", "DEX", "DEY", "EOR", "INC", "INX", "INY", "JMP", "JSR", "LDA", "LDX", "LDY",
+    "LSR", "NOP", "ORA", "PHA", "PHP", "PLA", "PLP", "ROL", "ROR", "RTI", "RTS", "SBC", "SEC", "SED", "SEI", "STA",
+    "STX", "STY", "TAX", "TAY", "TSX", "TXA", "TXS", "TYA"
+};
+
+//Official 6502 instructions one at a time, with the bus accesses and cycle counts of the data sheet. The 2A03
+//has no decimal mode. Deliberately shares no code with the core, flag arithmetic included
+class Reference6502
+{
+    public:
+        CPURegisters registers;
+
+        Reference6502()
+        {
+            for(int opcode = 0; opcode < 256; opcode++)
+            {
+                operations[opcode] = UNKNOWN;
+                for(int operation = 0; operation < UNKNOWN; operation++)
+                {
+                    if(std::strcmp(Disassembler::opcodes[opcode].mnemonic, operation_names[operation]) == 0)
+                        operations[opcode] = (Operation)operation;
+                }
+            }
+        }
+
+        //Runs the instruction at PC and returns its cycles, 0 for unofficial opcodes, which it doesn't model
+        int step(ReferenceBus& bus);
+        //The NMI or IRQ sequence, 7 cycles
+        int interrupt(ReferenceBus& bus, bool nmi);
+
+    private:
+        static const uint8_t C = 0x01, Z = 0x02, I = 0x04, D = 0x08, B = 0x10, U = 0x20, V = 0x40, N = 0x80;
+        Operation operations[256];
+
+        void set_flag(uint8_t flag, bool on)
+        {
+            registers.P = on ? (registers.P | flag) : (registers.P & ~flag);
+        }
+
+        uint8_t set_nz(uint8_t value)
+        {
+            set_flag(Z, value == 0);
+            set_flag(N, value & 0x80);
+            return value;
+        }
+
+        void push(ReferenceBus& bus, uint8_t value, uint8_t ignore = 0)
+        {
+            bus.write(0x100 + registers.SP, value, ignore);
+            registers.SP--;
+        }
+
+        uint8_t pull(ReferenceBus& bus)
+        {
+            registers.SP++;
+            return bus.read(0x100 + registers.SP);
+        }
+
+        void add(uint8_t operand)
+        {
+            unsigned sum = registers.A + operand + (registers.P & C);
+            uint8_t result = sum & 0xFF;
+            set_flag(C, sum > 0xFF);
+            set_flag(V, (~(registers.A ^ operand) & (registers.A ^ result)) & 0x80);
+            registers.A = set_nz(result);
+        }
+
+        void compare(uint8_t reg, uint8_t operand)
+        {
+            set_flag(C, reg >= operand);
+            set_nz(reg - operand);
+        }
+
+        uint8_t shift(Operation operation, uint8_t value)
+        {
+            uint8_t carry_in = registers.P & C;
+            switch(operation)
+            {
+                case ASL: set_flag(C, value & 0x80); return set_nz(value << 1);
+                case LSR: set_flag(C, value & 0x01); return set_nz(value >> 1);
+                case ROL: set_flag(C, value & 0x80); return set_nz((value << 1) | carry_in);
+                case ROR: set_flag(C, value & 0x01); return set_nz((value >> 1) | (carry_in << 7));
+                case INC: return set_nz(value + 1);
+                default:  return set_nz(value - 1);
+            }
+        }
+
+        //An NMI during an IRQ or BRK sequence takes over the vector on the real CPU as well
+        uint16_t read_vector(ReferenceBus& bus, bool nmi)
+        {
+            uint16_t vector = (nmi || bus.core_read(0xFFFA)) ? 0xFFFA : 0xFFFE;
+            registers.P |= I;
+            uint8_t low = bus.read(vector);
+            return low | (bus.read(vector + 1) << 8);
+        }
+
+        bool branch_taken(Operation operation)
+        {
+            uint8_t P = registers.P;
+            switch(operation)
+            {
+                case BCC: return !(P & C);
+                case BCS: return P & C;
+                case BNE: return !(P & Z);
+                case BEQ: return P & Z;
+                case BPL: return !(P & N);
+                case BMI: return P & N;
+                case BVC: return !(P & V);
+                default:  return P & V;
+            }
+        }
+};
+
+int Reference6502::step(ReferenceBus& bus)
+{
+    using namespace Disassembler;
+    CPURegisters& r = registers;
+    uint8_t opcode = bus.read(r.PC);
+    Operation operation = operations[opcode];
+    if(operation == UNKNOWN)
+        return 0;
+    r.PC++;
+
+    //JSR reads the high byte of its target only after pushing the return address
+    if(operation == JSR)
+    {
+        uint8_t low = bus.read(r.PC++);
+        bus.dummy_read(0x100 + r.SP);
+        push(bus, r.PC >> 8);
+        push(bus, r.PC & 0xFF);
+        r.PC = low | (bus.read(r.PC) << 8);
+        return 6;
+    }
+
+    Mode mode = opcodes[opcode].mode;
+    bool store = operation == STA || operation == STX || operation == STY;
+    bool modify = mode != ACC && (operation == ASL || operation == LSR || operation == ROL || operation == ROR
+                                  || operation == INC || operation == DEC);
+    int cycles = 2;
+    uint16_t address = 0;
+    uint8_t value = 0;
+    switch(mode)
+    {
+        case IMP: case ACC:
+            bus.dummy_read(r.PC);
+            break;
+        case IMM: case REL:
+            value = bus.read(r.PC++);
+            break;
+        case ZP:
+            address = bus.read(r.PC++);
+            cycles = 3;
+            break;
+        case ZPX: case ZPY:
+        {
+            uint8_t base = bus.read(r.PC++);
+            bus.dummy_read(base);
+            address = (uint8_t)(base + ((mode == ZPX) ? r.X : r.Y));
+            cycles = 4;
+            break;
+        }
+        case ABS: case ABX: case ABY: case IND:
+        {
+            uint8_t low = bus.read(r.PC++);
+            uint16_t base = low | (bus.read(r.PC++) << 8);
+            address = base;
+            cycles = (operation == JMP) ? 3 : 4;
+            if(mode == IND)
+            {
+                //The pointer's high byte comes from the same page
+                uint8_t target_low = bus.read(base);
+                address = target_low | (bus.read((base & 0xFF00) | ((base + 1) & 0xFF)) << 8);
+                cycles = 5;
+            }
+            else if(mode != ABS)
+            {
+                address = base + ((mode == ABX) ? r.X : r.Y);
+                //The first try at the address goes without the carry into the high byte
+                if((address ^ base) & 0xFF00 || store || modify)
+                {
+                    bus.dummy_read((base & 0xFF00) | (address & 0xFF));
+                    cycles++;
+                }
+            }
+            break;
+        }
+        case IZX:
+        {
+            uint8_t base = bus.read(r.PC++);
+            bus.dummy_read(base);
+            uint8_t pointer = base + r.X;
+            uint8_t low = bus.read(pointer);
+            address = low | (bus.read((uint8_t)(pointer + 1)) << 8);
+            cycles = 6;
+            break;
+        }
+        case IZY:
+        {
+            uint8_t pointer = bus.read(r.PC++);
+            uint8_t low = bus.read(pointer);
+            uint16_t base = low | (bus.read((uint8_t)(pointer + 1)) << 8);
+            address = base + r.Y;
+            cycles = 5;
+            if((address ^ base) & 0xFF00 || store)
+            {
+                bus.dummy_read((base & 0xFF00) | (address & 0xFF));
+                cycles++;
+            }
+            break;
+        }
+    }
+
+    bool reads_operand = mode != IMP && mode != ACC && mode != IMM && mode != REL && !store && operation != JMP;
+    if(reads_operand)
+        value = bus.read(address);
+    if(modify)
+    {
+        bus.dummy_write(address, value);
+        bus.write(address, shift(operation, value));
+        return cycles + 2;
+    }
+
+    switch(operation)
+    {
+        case LDA: r.A = set_nz(value); break;
+        case LDX: r.X = set_nz(value); break;
+        case LDY: r.Y = set_nz(value); break;
+        case STA: bus.write(address, r.A); break;
+        case STX: bus.write(address, r.X); break;
+        case STY: bus.write(address, r.Y); break;
+
+        case ADC: add(value); break;
+        case SBC: add(~value); break;
+        case AND: r.A = set_nz(r.A & value); break;
+        case ORA: r.A = set_nz(r.A | value); break;
+        case EOR: r.A = set_nz(r.A ^ value); break;
+        case CMP: compare(r.A, value); break;
+        case CPX: compare(r.X, value); break;
+        case CPY: compare(r.Y, value); break;
+        case BIT:
+            set_flag(Z, (r.A & value) == 0);
+            set_flag(N, value & 0x80);
+            set_flag(V, value & 0x40);
+            break;
+        case ASL: case LSR: case ROL: case ROR: r.A = shift(operation, r.A); break;
+
+        case TAX: r.X = set_nz(r.A); break;
+        case TAY: r.Y = set_nz(r.A); break;
+        case TXA: r.A = set_nz(r.X); break;
+        case TYA: r.A = set_nz(r.Y); break;
+        case TSX: r.X = set_nz(r.SP); break;
+        case TXS: r.SP = r.X; break;
+        case INX: r.X = set_nz(r.X + 1); break;
+        case INY: r.Y = set_nz(r.Y + 1); break;
+        case DEX: r.X = set_nz(r.X - 1); break;
+        case DEY: r.Y = set_nz(r.Y - 1); break;
+
+        case CLC: set_flag(C, false); break;
+        case SEC: set_flag(C, true); break;
+        case CLI: set_flag(I, false); break;
+        case SEI: set_flag(I, true); break;
+        case CLV: set_flag(V, false); break;
+        case CLD: set_flag(D, false); break;
+        case SED: set_flag(D, true); break;
+        case NOP: break;
+
+        case PHA:
+            push(bus, r.A);
+            cycles = 3;
+            break;
+        case PHP:
+            push(bus, r.P | B | U);
+            cycles = 3;
+            break;
+        case PLA:
+            bus.dummy_read(0x100 + r.SP);
+            r.A = set_nz(pull(bus));
+            cycles = 4;
+            break;
+        case PLP:
+            bus.dummy_read(0x100 + r.SP);
+            r.P = pull(bus);
+            cycles = 4;
+            break;
+
+        case JMP:
+            r.PC = address;
+            break;
+        case RTS:
+        {
+            bus.dummy_read(0x100 + r.SP);
+            uint8_t low = pull(bus);
+            r.PC = low | (pull(bus) << 8);
+            bus.dummy_read(r.PC++);
+            cycles = 6;
+            break;
+        }
+        case RTI:
+        {
+            bus.dummy_read(0x100 + r.SP);
+            r.P = pull(bus);
+            uint8_t low = pull(bus);
+            r.PC = low | (pull(bus) << 8);
+            cycles = 6;
+            break;
+        }
+        case BRK:
+            //The byte after BRK is skipped, the return address points past it
+            r.PC++;
+            push(bus, r.PC >> 8);
+            push(bus, r.PC & 0xFF);
+            push(bus, r.P | B | U);
+            r.PC = read_vector(bus, false);
+            cycles = 7;
+            break;
+
+        default: //Branches
+            if(branch_taken(operation))
+            {
+                uint16_t target = r.PC + (int8_t)value;
+                bus.dummy_read(r.PC);
+                cycles = 3;
+                if((target ^ r.PC) & 0xFF00)
+                {
+                    bus.dummy_read((r.PC & 0xFF00) | (target & 0xFF));
+                    cycles = 4;
+                }
+                r.PC = target;
+            }
+            break;
+    }
+    return cycles;
+}
+
+int Reference6502::interrupt(ReferenceBus& bus, bool nmi)
+{
+    bus.dummy_read(registers.PC);
+    bus.dummy_read(registers.PC);
+    push(bus, registers.PC >> 8);
+    push(bus, registers.PC & 0xFF);
+    push(bus, (registers.P & ~B) | U, U);
+    registers.PC = read_vector(bus, nmi);
+    return 7;
+}
+
+//One instruction as the core ran it, kept in the history ring
+struct InstructionRecord
+{
+    static const int MAX_ACCESSES = 16;
+    struct BusAccess
+    {
+        CPUProbe::Access kind;
+        uint16_t address;
+        uint8_t value;
+    };
+
+    CPUProbe::Entry entry;
+    CPURegisters before;
+    uint8_t bytes[3];
+    BusAccess accesses[MAX_ACCESSES];
+    int access_count;
+    bool overflow;
+    int stalls;
+};
+
+void print_record(const InstructionRecord& record)
+{
+    char instruction[32];
+    char raw[16];
+    if(record.entry == CPUProbe::INSTRUCTION)
+    {
+        Disassembler::format_bytes(record.bytes[0], &record.bytes[1], raw, sizeof(raw));
+        Disassembler::disassemble(record.before.PC, record.bytes[0], &record.bytes[1], instruction, sizeof(instruction));
+    }
+    else
+    {
+        raw[0] = '\0';
+        snprintf(instruction, sizeof(instruction), "<%s>", (record.entry == CPUProbe::NMI) ? "NMI" : "IRQ");
+    }
+
+    printf("%04X  %-8s  %-16sA:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%llu ", record.before.PC, raw, instruction,
+           record.before.A, record.before.X, record.before.Y, record.before.P, record.before.SP,
+           (unsigned long long)record.before.cycle);
+    for(int i = 0; i < record.access_count; i++)
+    {
+        const InstructionRecord::BusAccess& access = record.accesses[i];
+        printf(" %c$%04X=%02X", (access.kind == CPUProbe::READ) ? 'R' : 'W', access.address, access.value);
+    }
+    printf("\n");
+}
+
+//Checks the core against Reference6502 one instruction at a time. Accesses are matched in order. The core may
+//skip the reference's dummy reads and add reads of its own as long as they are of RAM or cartridge space, where
+//reading has no side effects, and may skip dummy writes to RAM. Every other write, and every access to PPU and
+//APU registers, has to match
+class Lockstep : public CPUProbe, public ReferenceBus
+{
+    public:
+        Lockstep(NES& nes, int history_size, bool dummy_reads) : nes(nes), history(std::max(1, history_size)),
+                                                                  dummy_reads(dummy_reads)
+        {
+            current = &history[0];
+        }
+
+        void begin(Entry entry, const CPURegisters& registers) override
+        {
+            if(diverged)
+                return;
+            if(tracking)
+                check(registers);
+            if(diverged)
+                return;
+
+            //Reset sequences aren't checked, the reference picks up from the first instruction after them
+            if(entry == RESET)
+                synced = false;
+            else if(!synced)
+            {
+                reference.registers = registers;
+                for(uint16_t address = 0; address < 0x800; address++)
+                    ram[address] = nes.peek(address);
+                synced = true;
+            }
+            tracking = synced;
+
+            current = &history[records % history.size()];
+            current->entry = entry;
+            current->before = registers;
+            for(int i = 0; i < 3; i++)
+                current->bytes[i] = nes.peek(registers.PC + i);
+            current->access_count = 0;
+            current->overflow = false;
+            current->stalls = 0;
+        }
+
+        void access(Access kind, uint16_t address, uint8_t value) override
+        {
+            if(!tracking || kind == DMA_READ || kind == DMA_WRITE)
+                return;
+            if(current->access_count == InstructionRecord::MAX_ACCESSES)
+                current->overflow = true;
+            else
+                current->accesses[current->access_count++] = {kind, address, value};
+        }
+
+        void stall() override
+        {
+            current->stalls++;
+        }
+
+        uint8_t read(uint16_t address) override
+        {
+            int found = find(READ, address);
+            uint8_t value;
+            if(found >= 0)
+            {
+                cursor = found + 1;
+                value = current->accesses[found].value;
+                if(address < 0x2000 && value != ram[address & 0x7FF])
+                    problem("the core read %02X from $%04X, RAM holds %02X", value, address, ram[address & 0x7FF]);
+            }
+            else if(has_side_effects(address))
+            {
+                problem("the core never read $%04X", address);
+                value = 0;
+            }
+            else
+                value = nes.peek(address);
+            return (address < 0x2000) ? ram[address & 0x7FF] : value;
+        }
+
+        //Elsewhere than at a register the core is free to make or skip the dummy read, so it matches nothing
+        void dummy_read(uint16_t address) override
+        {
+            if(!has_side_effects(address))
+                return;
+            if(cursor < current->access_count && current->accesses[cursor].kind == READ
+               && current->accesses[cursor].address == address)
+                cursor++;
+            else if(dummy_reads)
+                problem("the core skipped the dummy read of $%04X", address);
+        }
+
+        void write(uint16_t address, uint8_t value, uint8_t ignore) override
+        {
+            int found = find(WRITE, address);
+            if(found < 0)
+                problem("the core never wrote %02X to $%04X", value, address);
+            else
+            {
+                cursor = found + 1;
+                uint8_t written = current->accesses[found].value;
+                if((written ^ value) & ~ignore)
+                    problem("the core wrote %02X to $%04X instead of %02X", written, address, value);
+                //RAM holds what the core wrote in the bits that aren't compared
+                value = (value & ~ignore) | (written & ignore);
+            }
+            if(address < 0x2000)
+                ram[address & 0x7FF] = value;
+        }
+
+        //Writing RAM's own value back changes nothing, so only writes elsewhere have to be there
+        void dummy_write(uint16_t address, uint8_t value) override
+        {
+            if(cursor < current->access_count && current->accesses[cursor].kind == WRITE
+               && current->accesses[cursor].address == address && current->accesses[cursor].value == value)
+                cursor++;
+            else if(address >= 0x2000)
+                write(address, value, 0);
+        }
+
+        bool core_read(uint16_t address) override
+        {
+            for(int i = 0; i < current->access_count; i++)
+            {
+                if(current->accesses[i].kind == READ && current->accesses[i].address == address)
+                    return true;
+            }
+            return false;
+        }
+
+        bool has_diverged()
+        {
+            return diverged;
+        }
+
+        uint64_t get_instructions()
+        {
+            return instructions;
+        }
+
+        uint64_t get_interrupts()
+        {
+            return interrupts;
+        }
+
+        uint64_t get_unmodelled()
+        {
+            return unmodelled;
+        }
+
+    private:
+        NES& nes;
+        Reference6502 reference;
+        uint8_t ram[0x800];
+        std::vector<InstructionRecord> history;
+        bool dummy_reads; //Register dummy reads have to be there
+        InstructionRecord* current;
+        uint64_t records = 0;
+        bool tracking = false;
+        bool synced = false;
+        bool diverged = false;
+        int cursor = 0;
+        std::string problems;
+        uint64_t instructions = 0;
+        uint64_t interrupts = 0;
+        uint64_t unmodelled = 0;
+
+        static bool has_side_effects(uint16_t address)
+        {
+            return address >= 0x2000 && address < 0x4020;
+        }
+
+        template <typename... Args>
+        void problem(const char* format, Args... args)
+        {
+            char text[128];
+            snprintf(text, sizeof(text), format, args...);
+            problems += "  ";
+            problems += text;
+            problems += "\n";
+        }
+
+        //The core's next access of this kind to address. Accesses it made before that one and the reference
+        //doesn't make are reported, unless they are reads without side effects
+        int find(Access kind, uint16_t address)
+        {
+            for(int i = cursor; i < current->access_count; i++)
+            {
+                if(current->accesses[i].kind == kind && current->accesses[i].address == address)
+                {
+                    for(int skipped = cursor; skipped < i; skipped++)
+                        check_extra(current->accesses[skipped]);
+                    return i;
+                }
+            }
+            return -1;
+        }
+
+        void check_extra(const InstructionRecord::BusAccess& access)
+        {
+            if(access.kind != READ || has_side_effects(access.address))
+                problem("unexpected %s $%04X = %02X", (access.kind == READ) ? "read of" : "write to",
+                        access.address, access.value);
+        }
+
+        //Runs the instruction that just finished on the reference and compares the outcome with after
+        void check(const CPURegisters& after)
+        {
+            records++;
+            cursor = 0;
+            problems.clear();
+            int cycles;
+            if(current->entry == INSTRUCTION)
+            {
+                cycles = reference.step(*this);
+                if(cycles == 0)
+                {
+                    //Unofficial opcodes aren't modelled, the reference starts over from the core's registers
+                    unmodelled++;
+                    synced = false;
+                    return;
+                }
+                instructions++;
+            }
+            else
+            {
+                cycles = reference.interrupt(*this, current->entry == NMI);
+                interrupts++;
+            }
+
+            if(current->overflow)
+                problem("more than %d bus accesses", InstructionRecord::MAX_ACCESSES);
+            for(int i = cursor; i < current->access_count; i++)
+                check_extra(current->accesses[i]);
+
+            const CPURegisters& expected = reference.registers;
+            int core_cycles = (int)(after.cycle - current->before.cycle) - current->stalls;
+            //Bits 4 and 5 of P don't exist in the CPU, they are only made up when P is pushed
+            if(after.PC != expected.PC || after.A != expected.A || after.X != expected.X || after.Y != expected.Y
+               || after.SP != expected.SP || ((after.P ^ expected.P) & 0xCF) || core_cycles != cycles)
+            {
+                problem("core      PC:%04X A:%02X X:%02X Y:%02X P:%02X SP:%02X in %d cycles", after.PC, after.A,
+                        after.X, after.Y, after.P, after.SP, core_cycles);
+                problem("reference PC:%04X A:%02X X:%02X Y:%02X P:%02X SP:%02X in %d cycles", expected.PC,
+                        expected.A, expected.X, expected.Y, expected.P, expected.SP, cycles);
+            }
+
+            if(!problems.empty())
+                report();
+        }
+
+        void report()
+        {
+            diverged = true;
+            uint64_t shown = std::min<uint64_t>(records, history.size());
+            printf("divergence after %llu instructions, the last %llu:\n", (unsigned long long)(records - 1),
+                   (unsigned long long)shown);
+            for(uint64_t i = records - shown; i < records; i++)
+                print_record(history[i % history.size()]);
+            printf("%s", problems.c_str());
+        }
+};
+
+int run_lockstep(const std::string& rom, int frames, const std::vector<uint16_t>& movie, int history,
+                 bool dummy_reads)
+{
+    NES nes;
+    if(!load_rom(nes, rom))
+        return 1;
+    //Skipped idle loops and decoded instructions don't reach the probe
+    nes.set_idle_skip(false);
+    nes.set_block_mode(BLOCKS_OFF);
+
+    Lockstep lockstep(nes, history, dummy_reads);
+    nes.set_cpu_probe(&lockstep);
+    for(int frame = 0; frame < frames && !lockstep.has_diverged(); frame++)
+    {
+        controller_state = (frame < (int)movie.size()) ? movie[frame] : 0;
+        nes.run_frame();
+    }
+    nes.set_cpu_probe(nullptr);
+
+    if(lockstep.has_diverged())
+        return 1;
+    printf("%llu instructions and %llu interrupts match the reference, %llu unofficial opcodes not checked\n",
+           (unsigned long long)lockstep.get_instructions(), (unsigned long long)lockstep.get_interrupts(),
+           (unsigned long long)lockstep.get_unmodelled());
+    return 0;
+}
+
+int run_record(const std::string& rom, const std::string& trace, int frames, const std::vector<uint16_t>& movie,
+               bool blocks)
+{
+    NES nes;
+    if(!load_rom(nes, rom))
+        return 1;
+    nes.set_block_mode(blocks ? BLOCKS_ON : BLOCKS_OFF);
+    if(!nes.start_trace(trace))
+    {
+        fprintf(stderr, "can't write %s\n", trace.c_str());
+        return 1;
+    }
+    for(int frame = 0; frame < frames; frame++)
+    {
+        controller_state = (frame < (int)movie.size()) ? movie[frame] : 0;
+        nes.run_frame();
+    }
+    nes.stop_trace();
+    return 0;
+}
+
+void print_trace_record(const TraceRecord& entry)
+{
+    char raw[16];
+    char instruction[32];
+    Disassembler::format_bytes(entry.opcode, entry.operands, raw, sizeof(raw));
+    Disassembler::disassemble(entry.PC, entry.opcode, entry.operands, instruction, sizeof(instruction));
+    printf("%04X  %-8s  %-16sA:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3d,%3d CYC:%llu\n", entry.PC, raw,
+           instruction, entry.A, entry.X, entry.Y, entry.P, entry.SP, entry.scanline, entry.dot,
+           (unsigned long long)entry.cycle);
+}
+
+int run_compare(const std::string& first, const std::string& second, int history_size)
+{
+    TraceReader readers[2];
+    const std::string names[2] = {first, second};
+    for(int i = 0; i < 2; i++)
+    {
+        if(!readers[i].open(names[i]))
+        {
+            fprintf(stderr, "%s\n", readers[i].get_error().c_str());
+            return 1;
+        }
+    }
+
+    std::vector<TraceRecord> history(std::max(1, history_size));
+    uint64_t count = 0;
+    TraceRecord entries[2];
+    while(true)
+    {
+        bool more[2] = {readers[0].next(entries[0]), readers[1].next(entries[1])};
+        if(!more[0] || !more[1])
+        {
+            for(int i = 0; i < 2; i++)
+            {
+                if(readers[i].is_truncated())
+                    printf("%s is truncated\n", names[i].c_str());
+            }
+            if(more[0] == more[1])
+            {
+                printf("%llu instructions match\n", (unsigned long long)count);
+                return 0;
+            }
+            printf("%s ends after %llu instructions\n", names[more[0] ? 1 : 0].c_str(), (unsigned long long)count);
+            return 1;
+        }
+        if(std::memcmp(&entries[0], &entries[1], sizeof(TraceRecord)) != 0)
+            break;
+        history[count % history.size()] = entries[0];
+        count++;
+    }
+
+    uint64_t shown = std::min<uint64_t>(count, history.size());
+    printf("divergence after %llu instructions, the last %llu:\n", (unsigned long long)count, (unsigned long long)shown);
+    for(uint64_t i = count - shown; i < count; i++)
+        print_trace_record(history[i % history.size()]);
+    for(int i = 0; i < 2; i++)
+    {
+        printf("%s:\n", names[i].c_str());
+        print_trace_record(entries[i]);
+    }
+
+    const TraceRecord& a = entries[0];
+    const TraceRecord& b = entries[1];
+    const struct { const char* name; bool differs; } fields[] =
+    {
+        {"cycle", a.cycle != b.cycle}, {"PC", a.PC != b.PC}, {"opcode", a.opcode != b.opcode},
+        {"operands", a.operands[0] != b.operands[0] || a.operands[1] != b.operands[1]}, {"A", a.A != b.A},
+        {"X", a.X != b.X}, {"Y", a.Y != b.Y}, {"P", a.P != b.P}, {"SP", a.SP != b.SP},
+        {"scanline", a.scanline != b.scanline}, {"dot", a.dot != b.dot}
+    };
+    printf("differs in:");
+    for(const auto& field : fields)
+    {
+        if(field.differs)
+            printf(" %s", field.name);
+    }
+    printf("\n");
+    return 1;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string mode = (argc > 1) ? argv[1] : "";
+    int positional = (mode == "lockstep") ? 1 : 2;
+    if((mode != "lockstep" && mode != "record" && mode != "compare") || argc < 2 + positional)
+    {
+        printf("usage: %s lockstep <rom> [--frames N] [--movie FILE] [--history N] [--no-dummy-reads]\n", argv[0]);
+        printf("       %s record <rom> <trace file> [--frames N] [--movie FILE] [--blocks]\n", argv[0]);
+        printf("       %s compare <trace file> <trace file> [--history N]\n", argv[0]);
+        return 2;
+    }
+
+    int frames = DEFAULT_FRAMES;
+    int history = DEFAULT_HISTORY;
+    std::vector<uint16_t> movie;
+    bool blocks = false;
+    bool dummy_reads = true;
+    for(int i = 2 + positional; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "--frames" && i + 1 < argc)
+            frames = std::max(1, atoi(argv[++i]));
+        else if(arg == "--history" && i + 1 < argc)
+            history = std::max(1, atoi(argv[++i]));
+        else if(arg == "--movie" && i + 1 < argc)
+        {
+            if(!load_movie(argv[++i], movie))
+            {
+                fprintf(stderr, "can't read %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if(arg == "--blocks")
+            blocks = true;
+        else if(arg == "--no-dummy-reads")
+            dummy_reads = false;
+    }
+
+    if(mode == "lockstep")
+        return run_lockstep(argv[2], frames, movie, history, dummy_reads);
+    if(mode == "record")
+        return run_record(argv[2], argv[3], frames, movie, blocks);
+    return run_compare(argv[2], argv[3], history);
+}
@@ -0,0 +1,432 @@
+// Headless conformance runner for test ROM suites (blargg cpu/ppu/apu tests, etc.)
+//
+// usage: test_runner <rom_dir> [--jobs N] [--cache FILE] [--frames N] [--update-hashes] [--blocks | --validate-blocks] [--pipelined | --turbo] [--idle-skip] [--capture DIR]
+//
+// Every ROM runs in its own NES instance on a pool of worker threads. Pass/fail is taken from
+// the $6000 status protocol when the ROM implements it, otherwise the framebuffer hash after
+// --frames frames is compared against <rom>.hash. Results are cached by ROM hash, frame count, expected
+// framebuffer hash and build hash (a hash of the emulator sources when built with the makefile), a run only
+// replaces its own entries so builds and modes can share one cache file.
+// --blocks runs PRG-ROM code from the decoded block cache, --validate-blocks also checks every decoded
+// instruction against the interpreter and fails the ROM on any difference. --pipelined draws the frames
+// on the pipelined PPU's thread and --turbo on turbo rendering workers, the hashes must not change.
+// --idle-skip skips idle loops the way the frontend can, the verdicts must not change.
+// --capture records every ROM run to DIR/<rom>.y4m and DIR/<rom>.wav and skips the cache.
+#define SDL_MAIN_HANDLED
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "NES.h"
+
+#ifndef BUILD_HASH
+#define BUILD_HASH __DATE__ " " __TIME__
+#endif
+
+// Bus.cpp reads the controller state from the frontend
+uint16_t controller_state = 0;
+
+namespace fs = std::filesystem;
+
+const int AUDIO_BUFFER_SIZE = 8192;
+const int DEFAULT_MAX_FRAMES = 60 * 60;
+const int RESET_DELAY_FRAMES = 10;
+const int TURBO_WORKERS = 2;
+
+//Where the frames are drawn, the verdicts must be the same
+enum class PPUMode
+{
+    SERIAL,
+    PIPELINED,
+    TURBO
+};
+
+enum class Outcome
+{
+    PASS,
+    FAIL,
+    TIMEOUT,
+    NO_ORACLE,
+    LOAD_ERROR
+};
+
+struct TestResult
+{
+    Outcome outcome = Outcome::NO_ORACLE;
+    std::string message;
+    bool cached = false;
+};
+
+struct TestCase
+{
+    fs::path path;
+    uint64_t rom_hash = 0;
+    TestResult result;
+};
+
+uint64_t fnv1a(const uint8_t* data, size_t size, uint64_t hash = 1469598103934665603ull)
+{
+    for(size_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t hash_file(const fs::path& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return fnv1a(data.data(), data.size());
+}
+
+uint64_t hash_screen(std::vector<uint32_t>& screen)
+{
+    return fnv1a(reinterpret_cast<const uint8_t*>(screen.data()), screen.size() * sizeof(uint32_t));
+}
+
+std::string to_hex(uint64_t value)
+{
+    char text[17];
+    snprintf(text, sizeof(text), "%016llx", (unsigned long long)value);
+    return text;
+}
+
+const char* outcome_name(Outcome outcome)
+{
+    switch(outcome)
+    {
+        case Outcome::PASS: return "PASS";
+        case Outcome::FAIL: return "FAIL";
+        case Outcome::TIMEOUT: return "TIMEOUT";
+        case Outcome::NO_ORACLE: return "NO-ORACLE";
+        case Outcome::LOAD_ERROR: return "LOAD-ERROR";
+    }
+    return "?";
+}
+
+//blargg's protocol: $6001-$6003 = DE B0 61, $6000 = status, $6004 = zero terminated text
+bool has_status_protocol(NES& nes)
+{
+    return nes.peek(0x6001) == 0xDE && nes.peek(0x6002) == 0xB0 && nes.peek(0x6003) == 0x61;
+}
+
+std::string read_status_text(NES& nes)
+{
+    std::string text;
+    for(uint16_t address = 0x6004; address < 0x7000; address++)
+    {
+        char c = nes.peek(address);
+        if(c == 0)
+            break;
+        text += c;
+    }
+
+    std::replace(text.begin(), text.end(), '\n', ' ');
+    return text;
+}
+
+TestResult run_frames(NES& nes, const fs::path& path, int max_frames, bool update_hashes)
+{
+    TestResult result;
+    int reset_countdown = -1;
+    for(int frame = 0; frame < max_frames; frame++)
+    {
+        //Only the last frame is needed for the framebuffer oracle
+        if(frame == max_frames - 1)
+            nes.set_render_interval(1);
+        nes.run_frame();
+
+        if(!has_status_protocol(nes))
+            continue;
+
+        uint8_t status = nes.peek(0x6000);
+        if(status == 0x81)
+        {
+            if(reset_countdown < 0)
+                reset_countdown = RESET_DELAY_FRAMES;
+            else if(--reset_countdown == 0)
+            {
+                nes.press_reset();
+                reset_countdown = -1;
+            }
+        }
+
+        else if(status < 0x80)
+        {
+            result.outcome = (status == 0) ? Outcome::PASS : Outcome::FAIL;
+            result.message = read_status_text(nes);
+            return result;
+        }
+    }
+
+    if(has_status_protocol(nes))
+    {
+        result.outcome = Outcome::TIMEOUT;
+        result.message = read_status_text(nes);
+        return result;
+    }
+
+    nes.finish_frame();
+    std::string actual = to_hex(hash_screen(nes.get_screen()));
+    fs::path hash_path = path;
+    hash_path += ".hash";
+    std::ifstream hash_file(hash_path);
+    std::string expected;
+    if(hash_file >> expected)
+    {
+        result.outcome = (expected == actual) ? Outcome::PASS : Outcome::FAIL;
+        result.message = "framebuffer " + actual + ((expected == actual) ? "" : " expected " + expected);
+    }
+    else if(update_hashes)
+    {
+        std::ofstream(hash_path) << actual << "\n";
+        result.outcome = Outcome::PASS;
+        result.message = "framebuffer hash recorded " + actual;
+    }
+    else
+        result.message = "no status protocol and no .hash file, framebuffer " + actual;
+
+    return result;
+}
+
+TestResult run_test(const fs::path& path, int max_frames, bool update_hashes, BlockMode block_mode, PPUMode ppu_mode,
+                    bool idle_skip, const fs::path& capture_dir)
+{
+    int16_t audio_buffer[AUDIO_BUFFER_SIZE];
+    uint16_t write_pos = 0;
+
+    NES nes;
+    nes.set_audio_buffer(audio_buffer, AUDIO_BUFFER_SIZE, &write_pos);
+    //A recording needs every frame drawn
+    nes.set_render_interval(capture_dir.empty() ? 0 : 1);
+    nes.set_block_mode(block_mode);
+    nes.set_idle_skip(idle_skip);
+    nes.set_pipelined_ppu(ppu_mode == PPUMode::PIPELINED);
+    nes.set_turbo_render((ppu_mode == PPUMode::TURBO) ? TURBO_WORKERS : 0);
+    if(!nes.load_game(path.string()))
+    {
+        TestResult result;
+        result.outcome = Outcome::LOAD_ERROR;
+        result.message = nes.get_log();
+        return result;
+    }
+    //After loading, the frame rate follows the ROM's region
+    if(!capture_dir.empty() && !nes.start_capture((capture_dir / path.stem()).string(), MediaCapture::Y4M))
+        printf("could not record %s to %s\n", path.string().c_str(), capture_dir.string().c_str());
+
+    TestResult result = run_frames(nes, path, max_frames, update_hashes);
+    //A decoded instruction that disagreed with the interpreter fails the ROM whatever the ROM itself reported
+    if(nes.get_block_mismatches() != 0)
+    {
+        result.outcome = Outcome::FAIL;
+        result.message = std::to_string(nes.get_block_mismatches()) + " decoded block mismatches, first: "
+                       + nes.get_block_mismatch_report();
+    }
+    return result;
+}
+
+//Cache format: one line per entry "<cache key> <build hash> <outcome> <message>"
+//A verdict also depends on how long the ROM ran and on the framebuffer hash it was checked against
+std::string cache_key(const TestCase& test, int max_frames)
+{
+    fs::path hash_path = test.path;
+    hash_path += ".hash";
+    std::ifstream hash_file(hash_path);
+    std::string expected;
+    if(!(hash_file >> expected))
+        expected = "-";
+    return to_hex(test.rom_hash) + ":" + std::to_string(max_frames) + ":" + expected;
+}
+
+std::map<std::string, TestResult> load_cache(const fs::path& path, const std::string& build_hash)
+{
+    std::map<std::string, TestResult> cache;
+    std::ifstream file(path);
+    std::string line;
+    while(std::getline(file, line))
+    {
+        std::istringstream entry(line);
+        std::string key, entry_build, outcome;
+        if(!(entry >> key >> entry_build >> outcome) || entry_build != build_hash)
+            continue;
+
+        TestResult result;
+        result.outcome = (outcome == "PASS") ? Outcome::PASS : Outcome::FAIL;
+        std::getline(entry >> std::ws, result.message);
+        result.cached = true;
+        cache[key] = result;
+    }
+    return cache;
+}
+
+//Merges this run's verdicts into the file: entries of other builds, modes and frame counts are kept, the file is
+//replaced in one rename so an interrupted or concurrent run never leaves it half written
+void save_cache(const fs::path& path, const std::string& build_hash, const std::vector<TestCase>& tests, int max_frames)
+{
+    std::map<std::string, std::string> lines; //"key build" to the whole line
+    {
+        std::ifstream old_file(path);
+        std::string line;
+        while(std::getline(old_file, line))
+        {
+            std::istringstream entry(line);
+            std::string key, entry_build;
+            if(entry >> key >> entry_build)
+                lines[key + " " + entry_build] = line;
+        }
+    }
+
+    for(const TestCase& test : tests)
+    {
+        //Only deterministic verdicts are cached
+        if(test.result.outcome != Outcome::PASS && test.result.outcome != Outcome::FAIL)
+            continue;
+        //Keyed after the run, --update-hashes may have just written the .hash file
+        std::string id = cache_key(test, max_frames) + " " + build_hash;
+        lines[id] = id + " " + outcome_name(test.result.outcome) + " " + test.result.message;
+    }
+
+    fs::path temp_path = path;
+    temp_path += ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::trunc);
+        for(const auto& line : lines)
+            file << line.second << "\n";
+        if(!file.flush())
+        {
+            printf("could not write %s, cache not updated\n", temp_path.string().c_str());
+            return;
+        }
+    }
+    std::error_code error;
+    fs::rename(temp_path, path, error);
+    if(error)
+    {
+        printf("could not replace %s: %s\n", path.string().c_str(), error.message().c_str());
+        fs::remove(temp_path, error);
+    }
+}
+
+std::string sanitize_build_hash(std::string hash)
+{
+    std::replace(hash.begin(), hash.end(), ' ', '_');
+    return hash;
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2)
+    {
+        printf("usage: %s <rom_dir> [--jobs N] [--cache FILE] [--frames N] [--update-hashes] [--blocks | --validate-blocks] [--pipelined | --turbo] [--idle-skip] [--capture DIR]\n", argv[0]);
+        return 2;
+    }
+
+    fs::path rom_dir = argv[1];
+    fs::path cache_path = rom_dir / "test_runner.cache";
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+    int max_frames = DEFAULT_MAX_FRAMES;
+    bool update_hashes = false;
+    BlockMode block_mode = BLOCKS_OFF;
+    PPUMode ppu_mode = PPUMode::SERIAL;
+    bool idle_skip = false;
+    fs::path capture_dir;
+
+    for(int i = 2; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "--jobs" && i + 1 < argc)
+            jobs = std::max(1, atoi(argv[++i]));
+        else if(arg == "--cache" && i + 1 < argc)
+            cache_path = argv[++i];
+        else if(arg == "--frames" && i + 1 < argc)
+            max_frames = std::max(1, atoi(argv[++i]));
+        else if(arg == "--update-hashes")
+            update_hashes = true;
+        else if(arg == "--blocks")
+            block_mode = BLOCKS_ON;
+        else if(arg == "--validate-blocks")
+            block_mode = BLOCKS_VALIDATE;
+        else if(arg == "--pipelined")
+            ppu_mode = PPUMode::PIPELINED;
+        else if(arg == "--turbo")
+            ppu_mode = PPUMode::TURBO;
+        else if(arg == "--idle-skip")
+            idle_skip = true;
+        else if(arg == "--capture" && i + 1 < argc)
+            capture_dir = argv[++i];
+    }
+
+    if(!capture_dir.empty())
+        fs::create_directories(capture_dir);
+
+    std::vector<TestCase> tests;
+    for(const auto& entry : fs::recursive_directory_iterator(rom_dir))
+    {
+        std::string extension = entry.path().extension().string();
+        if(entry.is_regular_file() && (extension == ".nes" || extension == ".NES"))
+            tests.push_back({entry.path(), hash_file(entry.path())});
+    }
+    std::sort(tests.begin(), tests.end(), [](const TestCase& a, const TestCase& b) { return a.path < b.path; });
+
+    //Results from the other CPU and PPU modes are cached separately
+    std::string build_hash = sanitize_build_hash(BUILD_HASH);
+    if(block_mode == BLOCKS_ON)
+        build_hash += "+blocks";
+    else if(block_mode == BLOCKS_VALIDATE)
+        build_hash += "+validate-blocks";
+    if(ppu_mode == PPUMode::PIPELINED)
+        build_hash += "+pipelined";
+    else if(ppu_mode == PPUMode::TURBO)
+        build_hash += "+turbo";
+    if(idle_skip)
+        build_hash += "+idle-skip";
+    std::map<std::string, TestResult> cache = load_cache(cache_path, build_hash);
+
+    std::atomic<size_t> next_test(0);
+    std::mutex print_mutex;
+    auto worker = [&]()
+    {
+        for(size_t i = next_test++; i < tests.size(); i = next_test++)
+        {
+            TestCase& test = tests[i];
+            auto cached = cache.find(cache_key(test, max_frames));
+            if(cached != cache.end() && !update_hashes && capture_dir.empty())
+                test.result = cached->second;
+            else
+                test.result = run_test(test.path, max_frames, update_hashes, block_mode, ppu_mode, idle_skip, capture_dir);
+
+            std::lock_guard<std::mutex> lock(print_mutex);
+            printf("%-10s %s%s %s\n", outcome_name(test.result.outcome), test.path.string().c_str(),
+                   test.result.cached ? " (cached)" : "", test.result.message.c_str());
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for(unsigned i = 0; i < jobs; i++)
+        pool.emplace_back(worker);
+    for(std::thread& thread : pool)
+        thread.join();
+
+    save_cache(cache_path, build_hash, tests, max_frames);
+
+    int passed = 0, failed = 0;
+    for(const TestCase& test : tests)
+    {
+        if(test.result.outcome == Outcome::PASS)
+            passed++;
+        else if(test.result.outcome != Outcome::NO_ORACLE)
+            failed++;
+    }
+    printf("\n%d passed, %d failed, %zu total (build %s)\n", passed, failed, tests.size(), build_hash.c_str());
+
+    return failed ? 1 : 0;
+}
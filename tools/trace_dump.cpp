@@ -0,0 +1,54 @@
+// Renders a binary CPU trace (see include/TraceRecorder.h) as nestest style text
+//
+// usage: trace_dump <trace file> [output file]
+#include <cstdio>
+#include "Disassembler.h"
+#include "TraceRecorder.h"
+
+using namespace Disassembler;
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2)
+    {
+        printf("usage: %s <trace file> [output file]\n", argv[0]);
+        return 2;
+    }
+
+    TraceReader reader;
+    if(!reader.open(argv[1]))
+    {
+        fprintf(stderr, "%s\n", reader.get_error().c_str());
+        return 1;
+    }
+
+    FILE* output = (argc > 2) ? fopen(argv[2], "w") : stdout;
+    if(!output)
+    {
+        fprintf(stderr, "can't open %s\n", argv[2]);
+        return 1;
+    }
+
+    TraceRecord entry;
+    while(reader.next(entry))
+    {
+        char raw[16];
+        format_bytes(entry.opcode, entry.operands, raw, sizeof(raw));
+
+        char instruction[32];
+        disassemble(entry.PC, entry.opcode, entry.operands, instruction, sizeof(instruction));
+
+        fprintf(output, "%04X  %-8s  %-32sA:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3d,%3d CYC:%llu\n",
+                entry.PC, raw, instruction, entry.A, entry.X, entry.Y, entry.P, entry.SP,
+                entry.scanline, entry.dot, (unsigned long long)entry.cycle);
+    }
+    if(reader.is_truncated())
+    {
+        fprintf(stderr, "trace truncated after %llu records\n", (unsigned long long)reader.get_records_read());
+        return 1;
+    }
+
+    if(output != stdout)
+        fclose(output);
+    return 0;
+}